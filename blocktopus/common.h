@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// @file Basic vocabulary types shared by the client, server, and tooling
+/// halves of the library.
+
+namespace blocktopus {
+
+/// A sequence number; see the README for why this is not called a time.
+using Seq = int64_t;
+
+/// The server-assigned identity of a client.
+using ClientId = uint32_t;
+
+/// A datagram published on a channel.
+///
+/// `receive_seq` must be strictly greater than `send_seq`; the difference is
+/// the message's latency, and is what lets clients run concurrently.
+struct Message {
+  ClientId sender = 0;
+  std::string channel;
+  Seq send_seq = 0;
+  Seq receive_seq = 0;
+  std::vector<uint8_t> payload;
+};
+
+/// Everything about a `Message` except its payload bytes.
+struct MessageHeader {
+  ClientId sender = 0;
+  std::string channel;
+  Seq send_seq = 0;
+  Seq receive_seq = 0;
+  size_t payload_size = 0;
+  /// `HashPayload` of the payload, where that is carried (see
+  /// `peer_delivery.h`); otherwise 0.
+  uint64_t payload_hash = 0;
+};
+
+/// @return the header of @p message.
+inline MessageHeader HeaderOf(const Message& message) {
+  return MessageHeader{
+    .sender = message.sender,
+    .channel = message.channel,
+    .send_seq = message.send_seq,
+    .receive_seq = message.receive_seq,
+    .payload_size = message.payload.size()};
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,23 @@
+#include <exception>
+#include <iostream>
+
+#include "message_log.h"
+
+/// @file Command-line wrapper around `CompactLog`.
+///
+/// Usage:  compact_log <row_log_in> <columnar_log_out>
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " <row_log_in> <columnar_log_out>" << std::endl;
+    return 2;
+  }
+  try {
+    blocktopus::CompactLog(argv[1], argv[2]);
+  } catch (const std::exception& e) {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "delta_codec.h"
+
+#include <algorithm>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+enum FrameKind : uint8_t {
+  kKeyframe = 0,
+  kDelta = 1,
+};
+
+uint8_t PreviousByte(const std::vector<uint8_t>& previous, size_t i) {
+  return i < previous.size() ? previous[i] : 0;
+}
+
+/// Bytes past the end of the previous payload always count as changed, so
+/// a delta can never describe more than it carries plus the previous size.
+bool Unchanged(std::span<const uint8_t> payload,
+               const std::vector<uint8_t>& previous, size_t i) {
+  return i < previous.size() && payload[i] == previous[i];
+}
+
+}  // namespace
+
+void DeltaEncoder::Encode(std::span<const uint8_t> payload,
+                          std::vector<uint8_t>* out) {
+  const size_t start = out->size();
+  payload_bytes_ += payload.size();
+  bool keyframe = !started_ || frames_since_keyframe_ + 1 >=
+                                   config_.keyframe_interval;
+  if (!keyframe) {
+    scratch_.clear();
+    scratch_.push_back(kDelta);
+    PutVarint(payload.size(), &scratch_);
+    size_t i = 0;
+    while (i < payload.size() && scratch_.size() <= payload.size()) {
+      const size_t unchanged_start = i;
+      while (i < payload.size() && Unchanged(payload, previous_, i)) {
+        ++i;
+      }
+      const size_t changed_start = i;
+      if (changed_start == payload.size()) break;  // Unchanged to the end.
+      // A short unchanged gap costs more to encode than to XOR through.
+      size_t gap = 0;
+      while (i < payload.size() && gap < 2) {
+        gap = Unchanged(payload, previous_, i) ? gap + 1 : 0;
+        ++i;
+      }
+      const size_t changed_end = i - gap;
+      i = changed_end;
+      PutVarint(changed_start - unchanged_start, &scratch_);
+      PutVarint(changed_end - changed_start, &scratch_);
+      for (size_t j = changed_start; j < changed_end; ++j) {
+        scratch_.push_back(payload[j] ^ PreviousByte(previous_, j));
+      }
+    }
+    // Fall back to a keyframe if the delta saved nothing.
+    keyframe = scratch_.size() > payload.size();
+    if (!keyframe) {
+      out->insert(out->end(), scratch_.begin(), scratch_.end());
+      ++frames_since_keyframe_;
+    }
+  }
+  if (keyframe) {
+    out->push_back(kKeyframe);
+    out->insert(out->end(), payload.begin(), payload.end());
+    frames_since_keyframe_ = 0;
+    started_ = true;
+  }
+  previous_.assign(payload.begin(), payload.end());
+  encoded_bytes_ += out->size() - start;
+}
+
+Status DeltaDecoder::Decode(std::span<const uint8_t> frame,
+                            std::vector<uint8_t>* payload) {
+  if (frame.empty()) {
+    return Status(StatusCode::kProtocolError, "DeltaDecoder[empty frame]");
+  }
+  if (frame[0] == kKeyframe) {
+    previous_.assign(frame.begin() + 1, frame.end());
+    synchronized_ = true;
+    *payload = previous_;
+    return Status::Ok();
+  }
+  if (frame[0] != kDelta || !synchronized_) {
+    synchronized_ = false;
+    return Status(StatusCode::kProtocolError, "DeltaDecoder[unexpected delta]");
+  }
+  ByteReader reader(frame.subspan(1));
+  uint64_t size;
+  if (!reader.GetVarint(&size) || size > previous_.size() + frame.size()) {
+    synchronized_ = false;
+    return Status(StatusCode::kProtocolError, "DeltaDecoder[bad size]");
+  }
+  std::vector<uint8_t> result(size);
+  std::copy_n(previous_.begin(), std::min<size_t>(previous_.size(), size),
+              result.begin());
+  size_t position = 0;
+  while (!reader.done()) {
+    uint64_t unchanged;
+    uint64_t changed;
+    std::span<const uint8_t> bytes;
+    if (!reader.GetVarint(&unchanged) || !reader.GetVarint(&changed) ||
+        unchanged > size - position ||
+        changed > size - position - unchanged ||
+        !reader.GetBytes(changed, &bytes)) {
+      synchronized_ = false;
+      return Status(StatusCode::kProtocolError, "DeltaDecoder[bad run]");
+    }
+    position += unchanged;
+    for (uint8_t byte : bytes) result[position++] ^= byte;
+  }
+  previous_ = result;
+  *payload = std::move(result);
+  return Status::Ok();
+}
+
+}  // namespace blocktopus
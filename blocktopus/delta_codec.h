@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "status.h"
+
+/// @file Delta encoding of slowly changing payloads.
+///
+/// Many channels (joint states, occupancy grids) publish payloads that
+/// differ little from one message to the next.  A `DeltaEncoder` sends each
+/// payload as the XOR against the previous one on the same stream,
+/// run-length encoded so that unchanged bytes cost almost nothing, and a
+/// `DeltaDecoder` at the receiver reverses this.  A full *keyframe* is sent
+/// first, every `keyframe_interval` frames after that, and whenever a delta
+/// would be no smaller, so that the stream resynchronizes regularly and
+/// never expands much.
+///
+/// Streams are per (sender, receiver, channel):  the encoder and decoder
+/// must see the same payloads in the same order, which the server's
+/// deterministic delivery order guarantees.  Keyframes are scheduled by
+/// frame count, never by time, so a given sequence of payloads always
+/// encodes identically.
+///
+/// A frame is a kind byte, then either the raw payload (keyframe) or the
+/// payload's varint size followed by (varint unchanged-run length, varint
+/// changed-run length, XORed bytes) triples (delta).
+
+namespace blocktopus {
+
+struct DeltaCodecConfig {
+  /// Send a keyframe at least this often.
+  uint32_t keyframe_interval = 64;
+};
+
+class DeltaEncoder final {
+ public:
+  explicit DeltaEncoder(const DeltaCodecConfig& config) : config_(config) {}
+
+  /// Append the frame encoding @p payload to @p out.
+  void Encode(std::span<const uint8_t> payload, std::vector<uint8_t>* out);
+
+  /// @return the total size of the payloads encoded and of the frames
+  /// produced for them.
+  uint64_t payload_bytes() const { return payload_bytes_; }
+  uint64_t encoded_bytes() const { return encoded_bytes_; }
+
+ private:
+  const DeltaCodecConfig config_;
+  std::vector<uint8_t> previous_;
+  uint32_t frames_since_keyframe_ = 0;
+  bool started_ = false;
+  std::vector<uint8_t> scratch_;
+  uint64_t payload_bytes_ = 0;
+  uint64_t encoded_bytes_ = 0;
+};
+
+class DeltaDecoder final {
+ public:
+  DeltaDecoder() = default;
+
+  /// Decode @p frame into @p payload.
+  ///
+  /// Fails with `kProtocolError` if the frame is malformed or is a delta
+  /// with no keyframe before it; the decoder then waits for a keyframe.
+  Status Decode(std::span<const uint8_t> frame, std::vector<uint8_t>* payload);
+
+ private:
+  std::vector<uint8_t> previous_;
+  bool synchronized_ = false;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,286 @@
+#include "dictionary_compression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+enum FrameKind : uint8_t {
+  kRaw = 0,
+  kCompressed = 1,
+};
+
+// Training scores candidate segments by the 8-byte strings they contain.
+constexpr size_t kGramSize = 8;
+constexpr size_t kSegmentSize = 64;
+constexpr size_t kSegmentStride = 16;
+
+// Matches shorter than this cost more to encode than to send as literals.
+constexpr size_t kMinMatch = 4;
+constexpr int kDictionaryTableBits = 14;
+constexpr int kMaxInputTableBits = 12;
+
+uint64_t GramAt(const uint8_t* p) {
+  uint64_t gram;
+  std::memcpy(&gram, p, sizeof(gram));
+  return gram;
+}
+
+uint32_t HashAt(const uint8_t* p, int bits) {
+  uint32_t word;
+  std::memcpy(&word, p, sizeof(word));
+  return (word * 2654435761u) >> (32 - bits);
+}
+
+size_t MatchLength(const uint8_t* a, const uint8_t* b, size_t limit) {
+  size_t length = 0;
+  while (length < limit && a[length] == b[length]) ++length;
+  return length;
+}
+
+// LZ77-compress @p input, finding matches both in @p dictionary (indexed
+// by @p dictionary_table) and earlier in @p input.  Each sequence is a
+// varint literal count, the literals, and a varint match length (zero
+// ending the input) followed by the varint distance back from the current
+// position into the dictionary's bytes followed by the input's.
+void CompressWithDictionary(std::span<const uint8_t> dictionary,
+                            const std::vector<int32_t>& dictionary_table,
+                            std::span<const uint8_t> input,
+                            std::vector<uint8_t>* out) {
+  int input_bits = 6;
+  while (input_bits < kMaxInputTableBits &&
+         (size_t{1} << input_bits) < input.size()) {
+    ++input_bits;
+  }
+  std::vector<int32_t> input_table(size_t{1} << input_bits, -1);
+  size_t anchor = 0;
+  size_t i = 0;
+  while (i + kMinMatch <= input.size()) {
+    const uint8_t* here = input.data() + i;
+    const size_t limit = input.size() - i;
+    size_t best_length = 0;
+    size_t best_distance = 0;
+    const int32_t d = dictionary_table[HashAt(here, kDictionaryTableBits)];
+    if (d >= 0) {
+      const size_t length = MatchLength(dictionary.data() + d, here,
+                                        std::min(limit, dictionary.size() - d));
+      best_length = length;
+      best_distance = i + dictionary.size() - d;
+    }
+    int32_t& slot = input_table[HashAt(here, input_bits)];
+    if (slot >= 0) {
+      const size_t length = MatchLength(input.data() + slot, here, limit);
+      if (length > best_length) {
+        best_length = length;
+        best_distance = i - slot;
+      }
+    }
+    slot = i;
+    if (best_length < kMinMatch) {
+      ++i;
+      continue;
+    }
+    PutVarint(i - anchor, out);
+    out->insert(out->end(), input.begin() + anchor, input.begin() + i);
+    PutVarint(best_length, out);
+    PutVarint(best_distance, out);
+    i += best_length;
+    anchor = i;
+  }
+  PutVarint(input.size() - anchor, out);
+  out->insert(out->end(), input.begin() + anchor, input.end());
+  PutVarint(0, out);
+}
+
+Status DecompressWithDictionary(std::span<const uint8_t> dictionary,
+                                ByteReader* reader, size_t size,
+                                std::vector<uint8_t>* out) {
+  const Status malformed(StatusCode::kProtocolError,
+                         "Decompress[malformed]");
+  out->clear();
+  // Not all of @p size:  it has yet to be checked against the frame.
+  out->reserve(std::min<size_t>(size, 64 << 10));
+  while (true) {
+    uint64_t literals;
+    std::span<const uint8_t> bytes;
+    uint64_t length;
+    if (!reader->GetVarint(&literals) || literals > size - out->size() ||
+        !reader->GetBytes(literals, &bytes) || !reader->GetVarint(&length)) {
+      return malformed;
+    }
+    out->insert(out->end(), bytes.begin(), bytes.end());
+    if (length == 0) break;
+    uint64_t distance;
+    const size_t position = dictionary.size() + out->size();
+    if (length > size - out->size() || !reader->GetVarint(&distance) ||
+        distance == 0 || distance > position) {
+      return malformed;
+    }
+    // Byte at a time:  a match may overlap what it produces.
+    for (size_t from = position - distance; length > 0; --length, ++from) {
+      out->push_back(from < dictionary.size()
+                         ? dictionary[from]
+                         : (*out)[from - dictionary.size()]);
+    }
+  }
+  if (out->size() != size || !reader->done()) return malformed;
+  return Status::Ok();
+}
+
+}  // namespace
+
+std::vector<uint8_t> TrainDictionary(
+    const std::vector<std::vector<uint8_t>>& samples, size_t max_size) {
+  // Count the samples containing each gram.
+  std::unordered_map<uint64_t, uint32_t> frequency;
+  for (const std::vector<uint8_t>& sample : samples) {
+    std::unordered_set<uint64_t> seen;
+    for (size_t i = 0; i + kGramSize <= sample.size(); ++i) {
+      const uint64_t gram = GramAt(sample.data() + i);
+      if (seen.insert(gram).second) ++frequency[gram];
+    }
+  }
+  struct Candidate {
+    uint64_t score;
+    std::span<const uint8_t> segment;
+    bool operator<(const Candidate& other) const {
+      return score < other.score;
+    }
+  };
+  // A segment is worth the grams it contains that recur across samples and
+  // that no segment already chosen covers.
+  const auto score = [&frequency](std::span<const uint8_t> segment) {
+    uint64_t total = 0;
+    std::unordered_set<uint64_t> seen;
+    for (size_t i = 0; i + kGramSize <= segment.size(); ++i) {
+      const uint64_t gram = GramAt(segment.data() + i);
+      if (!seen.insert(gram).second) continue;
+      const uint32_t count = frequency[gram];
+      if (count > 1) total += count;
+    }
+    return total;
+  };
+  std::priority_queue<Candidate> candidates;
+  for (const std::vector<uint8_t>& sample : samples) {
+    for (size_t i = 0; i + kGramSize <= sample.size(); i += kSegmentStride) {
+      const auto segment = std::span<const uint8_t>(sample).subspan(
+          i, std::min(kSegmentSize, sample.size() - i));
+      candidates.push({.score = score(segment), .segment = segment});
+    }
+  }
+  // Lazy greedy:  a popped candidate is rescored, and chosen only if it
+  // still beats the next best.
+  std::vector<std::span<const uint8_t>> chosen;
+  size_t size = 0;
+  while (!candidates.empty() && size < max_size) {
+    Candidate best = candidates.top();
+    candidates.pop();
+    best.score = score(best.segment);
+    if (best.score == 0) continue;
+    if (!candidates.empty() && best.score < candidates.top().score) {
+      candidates.push(best);
+      continue;
+    }
+    const auto segment =
+        best.segment.first(std::min(best.segment.size(), max_size - size));
+    for (size_t i = 0; i + kGramSize <= segment.size(); ++i) {
+      frequency[GramAt(segment.data() + i)] = 0;
+    }
+    chosen.push_back(segment);
+    size += segment.size();
+  }
+  // The best segments go last, nearest the input, for the shortest
+  // distances.
+  std::vector<uint8_t> dictionary;
+  dictionary.reserve(size);
+  for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+    dictionary.insert(dictionary.end(), it->begin(), it->end());
+  }
+  return dictionary;
+}
+
+ChannelCompressor::ChannelCompressor(
+    const DictionaryCompressionConfig& config)
+    : config_(config) {}
+
+void ChannelCompressor::Compress(std::span<const uint8_t> payload,
+                                 std::vector<uint8_t>* out) {
+  const size_t start = out->size();
+  payload_bytes_ += payload.size();
+  const bool small = payload.size() <= config_.max_payload_size;
+  bool compressed = false;
+  if (small && dictionary_ != nullptr) {
+    scratch_.clear();
+    scratch_.push_back(kCompressed);
+    PutVarint(dictionary_->id, &scratch_);
+    PutVarint(payload.size(), &scratch_);
+    CompressWithDictionary(dictionary_->bytes, dictionary_table_, payload,
+                           &scratch_);
+    compressed = scratch_.size() <= payload.size();
+    if (compressed) out->insert(out->end(), scratch_.begin(), scratch_.end());
+  }
+  if (!compressed) {
+    out->push_back(kRaw);
+    out->insert(out->end(), payload.begin(), payload.end());
+  }
+  encoded_bytes_ += out->size() - start;
+  if (small && dictionary_ == nullptr) {
+    samples_.emplace_back(payload.begin(), payload.end());
+    if (samples_.size() >= config_.training_samples) Train();
+  }
+}
+
+void ChannelCompressor::Train() {
+  std::vector<uint8_t> bytes = TrainDictionary(samples_,
+                                               config_.dictionary_size);
+  samples_ = {};
+  if (bytes.size() < kMinMatch) return;  // Nothing in common; stay raw.
+  dictionary_table_.assign(size_t{1} << kDictionaryTableBits, -1);
+  for (size_t i = 0; i + kMinMatch <= bytes.size(); ++i) {
+    dictionary_table_[HashAt(bytes.data() + i, kDictionaryTableBits)] = i;
+  }
+  dictionary_ = std::make_shared<const CompressionDictionary>(
+      CompressionDictionary{.id = 1, .bytes = std::move(bytes)});
+}
+
+void ChannelDecompressor::AddDictionary(
+    std::shared_ptr<const CompressionDictionary> dictionary) {
+  dictionaries_[dictionary->id] = std::move(dictionary);
+}
+
+Status ChannelDecompressor::Decompress(std::span<const uint8_t> frame,
+                                       std::vector<uint8_t>* payload) {
+  if (frame.empty()) {
+    return Status(StatusCode::kProtocolError, "Decompress[empty frame]");
+  }
+  if (frame[0] == kRaw) {
+    payload->assign(frame.begin() + 1, frame.end());
+    return Status::Ok();
+  }
+  ByteReader reader(frame.subspan(1));
+  uint64_t id;
+  uint64_t size;
+  if (frame[0] != kCompressed || !reader.GetVarint(&id) ||
+      !reader.GetVarint(&size)) {
+    return Status(StatusCode::kProtocolError, "Decompress[malformed]");
+  }
+  // Matches can expand without limit, so the size is bounded up front.
+  if (size > max_payload_size_) {
+    return Status(StatusCode::kProtocolError, "Decompress[too large]");
+  }
+  auto it = dictionaries_.find(id);
+  if (it == dictionaries_.end()) {
+    return Status(StatusCode::kProtocolError, "Decompress[unknown dictionary]");
+  }
+  return DecompressWithDictionary(it->second->bytes, &reader, size, payload);
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "status.h"
+
+/// @file Compression of small payloads against a per-channel dictionary.
+///
+/// A small structured message (a pose, a status record) compresses poorly
+/// on its own, having too little history to find repeats in.  Yet the
+/// messages on one channel share most of their structure:  field tags,
+/// names, units, values that rarely change.  A `ChannelCompressor` samples
+/// the channel's first small payloads, trains a dictionary of the byte
+/// strings most common among them, and from then on compresses small
+/// payloads as LZ77 matches against that dictionary as well as against
+/// themselves.
+///
+/// The dictionary is distributed out of band:  once `dictionary()` is set,
+/// the server must give it to each subscriber's `ChannelDecompressor`
+/// (including subscribers that join later) before the first frame
+/// compressed with it.
+///
+/// A frame is a kind byte, then either the raw payload, or the dictionary's
+/// varint id, the payload's varint size, and the compressed payload.
+
+namespace blocktopus {
+
+struct DictionaryCompressionConfig {
+  /// Larger payloads are sent as they are, and not sampled.
+  size_t max_payload_size = 4096;
+  /// The number of payloads sampled before training.
+  size_t training_samples = 128;
+  /// The most bytes of dictionary to train.
+  size_t dictionary_size = 16 << 10;
+};
+
+struct CompressionDictionary {
+  uint32_t id;
+  std::vector<uint8_t> bytes;
+};
+
+/// @return a dictionary of at most @p max_size bytes of the substrings
+/// found in the most @p samples.  Empty if the samples share nothing.
+std::vector<uint8_t> TrainDictionary(
+    const std::vector<std::vector<uint8_t>>& samples, size_t max_size);
+
+/// Compresses the payloads published on one channel.
+class ChannelCompressor final {
+ public:
+  explicit ChannelCompressor(const DictionaryCompressionConfig& config);
+
+  ChannelCompressor(const ChannelCompressor&) = delete;
+  ChannelCompressor& operator=(const ChannelCompressor&) = delete;
+
+  /// Append the frame encoding @p payload to @p out.
+  void Compress(std::span<const uint8_t> payload, std::vector<uint8_t>* out);
+
+  /// @return the trained dictionary, or null while still sampling.
+  const std::shared_ptr<const CompressionDictionary>& dictionary() const {
+    return dictionary_;
+  }
+
+  /// @return the total size of the payloads compressed and of the frames
+  /// produced for them.
+  uint64_t payload_bytes() const { return payload_bytes_; }
+  uint64_t encoded_bytes() const { return encoded_bytes_; }
+
+ private:
+  void Train();
+
+  const DictionaryCompressionConfig config_;
+  std::vector<std::vector<uint8_t>> samples_;
+  std::shared_ptr<const CompressionDictionary> dictionary_;
+  // Positions in the dictionary by hash of the 4 bytes starting there.
+  std::vector<int32_t> dictionary_table_;
+  std::vector<uint8_t> scratch_;
+  uint64_t payload_bytes_ = 0;
+  uint64_t encoded_bytes_ = 0;
+};
+
+/// Decompresses the frames of one channel.
+class ChannelDecompressor final {
+ public:
+  ChannelDecompressor() : ChannelDecompressor(DictionaryCompressionConfig()) {}
+  /// Only `config.max_payload_size` is used; it must be the compressor's.
+  explicit ChannelDecompressor(const DictionaryCompressionConfig& config)
+      : max_payload_size_(config.max_payload_size) {}
+
+  /// Accept a dictionary distributed by the channel's compressor.
+  void AddDictionary(std::shared_ptr<const CompressionDictionary> dictionary);
+
+  /// Decode @p frame into @p payload.  Fails with `kProtocolError` if the
+  /// frame is malformed, claims a payload larger than any the compressor
+  /// compresses, or uses a dictionary not yet added.
+  Status Decompress(std::span<const uint8_t> frame,
+                    std::vector<uint8_t>* payload);
+
+ private:
+  const size_t max_payload_size_;
+  std::map<uint32_t, std::shared_ptr<const CompressionDictionary>>
+      dictionaries_;
+};
+
+}  // namespace blocktopus
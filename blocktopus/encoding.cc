@@ -0,0 +1,130 @@
+#include "encoding.h"
+
+#include <cstring>
+
+namespace blocktopus {
+
+void PutVarint(uint64_t value, std::vector<uint8_t>* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(value));
+}
+
+void PutZigzag(int64_t value, std::vector<uint8_t>* out) {
+  PutVarint((static_cast<uint64_t>(value) << 1) ^
+            static_cast<uint64_t>(value >> 63), out);
+}
+
+void PutString(const std::string& value, std::vector<uint8_t>* out) {
+  PutVarint(value.size(), out);
+  out->insert(out->end(), value.begin(), value.end());
+}
+
+void PutFixed64(uint64_t value, std::vector<uint8_t>* out) {
+  for (int i = 0; i < 8; ++i) {
+    out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+bool ByteReader::GetVarint(uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (done()) return false;
+    const uint8_t byte = data_[position_++];
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;  // Overlong encoding.
+}
+
+bool ByteReader::GetZigzag(int64_t* value) {
+  uint64_t raw;
+  if (!GetVarint(&raw)) return false;
+  *value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+  return true;
+}
+
+bool ByteReader::GetString(std::string* value) {
+  uint64_t size;
+  std::span<const uint8_t> bytes;
+  if (!GetVarint(&size) || !GetBytes(size, &bytes)) return false;
+  value->assign(bytes.begin(), bytes.end());
+  return true;
+}
+
+bool ByteReader::GetFixed64(uint64_t* value) {
+  std::span<const uint8_t> bytes;
+  if (!GetBytes(8, &bytes)) return false;
+  *value = 0;
+  for (int i = 0; i < 8; ++i) {
+    *value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+  }
+  return true;
+}
+
+bool ByteReader::GetBytes(size_t size, std::span<const uint8_t>* value) {
+  if (size > remaining()) return false;
+  *value = data_.subspan(position_, size);
+  position_ += size;
+  return true;
+}
+
+void SerializeMessage(const Message& message, std::vector<uint8_t>* out) {
+  PutVarint(message.sender, out);
+  PutString(message.channel, out);
+  PutZigzag(message.send_seq, out);
+  PutZigzag(message.receive_seq, out);
+  PutVarint(message.payload.size(), out);
+  out->insert(out->end(), message.payload.begin(), message.payload.end());
+}
+
+std::optional<Message> DeserializeMessage(ByteReader* reader) {
+  Message result;
+  uint64_t sender;
+  uint64_t payload_size;
+  std::span<const uint8_t> payload;
+  if (!reader->GetVarint(&sender) ||
+      !reader->GetString(&result.channel) ||
+      !reader->GetZigzag(&result.send_seq) ||
+      !reader->GetZigzag(&result.receive_seq) ||
+      !reader->GetVarint(&payload_size) ||
+      !reader->GetBytes(payload_size, &payload)) {
+    return std::nullopt;
+  }
+  result.sender = static_cast<ClientId>(sender);
+  result.payload.assign(payload.begin(), payload.end());
+  return result;
+}
+
+namespace {
+
+constexpr uint64_t kMultiplier = 0x9e3779b97f4a7c15ULL;
+
+uint64_t Mix(uint64_t h) {
+  h ^= h >> 32;
+  h *= kMultiplier;
+  h ^= h >> 29;
+  return h;
+}
+
+}  // namespace
+
+uint64_t HashPayload(std::span<const uint8_t> payload) {
+  // A word at a time, since payloads on this path are large.
+  uint64_t h = payload.size() * kMultiplier;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= payload.size(); i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, payload.data() + i, sizeof(word));
+    h = Mix(h ^ word) + i;
+  }
+  uint64_t tail = 0;
+  if (i < payload.size()) {
+    std::memcpy(&tail, payload.data() + i, payload.size() - i);
+  }
+  return Mix(h ^ tail ^ (payload.size() - i));
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+/// @file Byte-level encoding helpers:  LEB128 varints, zigzag signed
+/// varints, length-prefixed strings, a compact serialization of `Message`,
+/// and a fast payload hash.
+///
+/// Writers append to a `std::vector<uint8_t>`; readers consume a span via
+/// `ByteReader` and report malformed input by returning `false` rather than
+/// throwing, since the input frequently comes off the network.
+
+namespace blocktopus {
+
+/// Append @p value as an unsigned LEB128 varint.
+void PutVarint(uint64_t value, std::vector<uint8_t>* out);
+
+/// Append @p value zigzag-encoded (small magnitudes encode small).
+void PutZigzag(int64_t value, std::vector<uint8_t>* out);
+
+/// Append @p value as a varint length followed by its bytes.
+void PutString(const std::string& value, std::vector<uint8_t>* out);
+
+/// Append @p value as a little-endian fixed 64-bit integer.
+void PutFixed64(uint64_t value, std::vector<uint8_t>* out);
+
+/// A cursor over a span of encoded bytes.
+///
+/// Every `Get` method returns `false` (and leaves its output unspecified)
+/// if the input is exhausted or malformed.
+class ByteReader {
+ public:
+  explicit ByteReader(std::span<const uint8_t> data) : data_(data) {}
+
+  bool GetVarint(uint64_t* value);
+  bool GetZigzag(int64_t* value);
+  bool GetString(std::string* value);
+  bool GetFixed64(uint64_t* value);
+
+  /// Take the next @p size bytes without copying them.
+  bool GetBytes(size_t size, std::span<const uint8_t>* value);
+
+  size_t remaining() const { return data_.size() - position_; }
+  bool done() const { return remaining() == 0; }
+
+ private:
+  std::span<const uint8_t> data_;
+  size_t position_ = 0;
+};
+
+/// Append an encoding of @p message.
+void SerializeMessage(const Message& message, std::vector<uint8_t>* out);
+
+/// Decode a `Message` from @p reader.
+/// @return `std::nullopt` if the data is malformed.
+std::optional<Message> DeserializeMessage(ByteReader* reader);
+
+/// @return a 64-bit hash of @p payload.  Not cryptographic:  it detects
+/// corruption and mismatches, not forgery.
+uint64_t HashPayload(std::span<const uint8_t> payload);
+
+}  // namespace blocktopus
@@ -0,0 +1,222 @@
+#include "ensemble.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace blocktopus {
+
+Ensemble::Ensemble(const Ensemble::Config& config)
+    : config_(config) {
+  universes_.reserve(config_.num_universes);
+  for (size_t u = 0; u < config_.num_universes; ++u) {
+    universes_.push_back(
+        std::make_unique<Sequencer>(config_.sequencer_config));
+  }
+}
+
+void Ensemble::SetClear(size_t universe, ClientId client, Seq clear) {
+  const size_t n = universes_.size();
+  const size_t row = row_of_.at(client);
+  Seq* cells = &clears_[row * n];
+  if (universe == 0) {
+    cells[0] = clear;
+    size_t count = 0;
+    for (size_t u = 1; u < n; ++u) count += (cells[u] != cells[0]);
+    total_mismatches_ += count;
+    total_mismatches_ -= mismatches_[row];
+    mismatches_[row] = count;
+    return;
+  }
+  const bool was_mismatched = cells[universe] != cells[0];
+  cells[universe] = clear;
+  const bool is_mismatched = cells[universe] != cells[0];
+  if (was_mismatched && !is_mismatched) {
+    --mismatches_[row];
+    --total_mismatches_;
+  } else if (!was_mismatched && is_mismatched) {
+    ++mismatches_[row];
+    ++total_mismatches_;
+  }
+}
+
+Status Ensemble::AddClient(ClientId client, Seq start,
+                           Seq* effective_start) {
+  if (row_of_.contains(client)) {
+    return Status(StatusCode::kProtocolError, "AddClient[duplicate]");
+  }
+  const size_t n = universes_.size();
+  const size_t row = client_of_row_.size();
+  row_of_[client] = row;
+  client_of_row_.push_back(client);
+  clears_.resize(clears_.size() + n);
+  mismatches_.push_back(0);
+  Seq latest = start;
+  for (size_t u = 0; u < n; ++u) {
+    // Cannot fail:  every universe has exactly the ensemble's clients.
+    universes_[u]->AddClient(client, start, &clears_[row * n + u]);
+    latest = std::max(latest, clears_[row * n + u]);
+  }
+  // Universes whose bounds had passed `start` begin this row mismatched.
+  if (n > 0) SetClear(0, client, clears_[row * n]);
+  if (effective_start != nullptr) *effective_start = latest;
+  return Status::Ok();
+}
+
+Status Ensemble::AddObserver(ClientId client,
+                             const Sequencer::ObserverConfig& config) {
+  // Observers take no part in the bound, and so have no row.
+  for (auto& universe : universes_) {
+    const Status status = universe->AddObserver(client, config);
+    if (!status) return status;
+  }
+  return Status::Ok();
+}
+
+void Ensemble::RemoveClient(ClientId client) {
+  for (auto& universe : universes_) universe->RemoveClient(client);
+  auto it = row_of_.find(client);
+  if (it == row_of_.end()) return;
+
+  // Move the last row into the vacated one.
+  const size_t n = universes_.size();
+  const size_t row = it->second;
+  const size_t last = client_of_row_.size() - 1;
+  total_mismatches_ -= mismatches_[row];
+  if (row != last) {
+    std::copy_n(clears_.begin() + last * n, n, clears_.begin() + row * n);
+    mismatches_[row] = mismatches_[last];
+    client_of_row_[row] = client_of_row_[last];
+    row_of_[client_of_row_[row]] = row;
+  }
+  clears_.resize(last * n);
+  mismatches_.pop_back();
+  client_of_row_.pop_back();
+  row_of_.erase(it);
+}
+
+Status Ensemble::Subscribe(ClientId client,
+                           const std::optional<std::string>& channel,
+                           Seq seq, Seq* effective) {
+  *effective = seq;
+  for (auto& universe : universes_) {
+    Seq universe_effective;
+    const Status status =
+        universe->Subscribe(client, channel, seq, &universe_effective);
+    if (!status) return status;
+    *effective = std::max(*effective, universe_effective);
+  }
+  return Status::Ok();
+}
+
+Status Ensemble::Unsubscribe(ClientId client,
+                             const std::optional<std::string>& channel,
+                             Seq seq, Seq* effective) {
+  *effective = seq;
+  for (auto& universe : universes_) {
+    Seq universe_effective;
+    const Status status =
+        universe->Unsubscribe(client, channel, seq, &universe_effective);
+    if (!status) return status;
+    *effective = std::max(*effective, universe_effective);
+  }
+  return Status::Ok();
+}
+
+Status Ensemble::Publish(size_t universe, Message&& message) {
+  if (universe >= universes_.size()) {
+    return Status(StatusCode::kProtocolError, "Publish[no such universe]");
+  }
+  const ClientId sender = message.sender;
+  const Seq send_seq = message.send_seq;
+  const std::optional<Seq> limit = universes_[universe]->publish_limit();
+  const Status status = universes_[universe]->Publish(std::move(message));
+  if (status) {
+    SetClear(universe, sender, send_seq);
+  } else if (status.code() == StatusCode::kBackpressure) {
+    // The sequencer took the refusal as a promise up to the limit (see
+    // `Sequencer::Publish`); so must the bound here, or it never moves.
+    const Seq clear = clears_[row_of_.at(sender) * universes_.size() +
+                              universe];
+    SetClear(universe, sender,
+             std::max(clear, std::min(send_seq, *limit)));
+  }
+  return status;
+}
+
+Status Ensemble::ClearToAdvance(size_t universe, ClientId client,
+                                Seq clear_until) {
+  if (universe >= universes_.size()) {
+    return Status(StatusCode::kProtocolError,
+                  "ClearToAdvance[no such universe]");
+  }
+  const Status status =
+      universes_[universe]->ClearToAdvance(client, clear_until);
+  if (status) SetClear(universe, client, clear_until);
+  return status;
+}
+
+void Ensemble::AcknowledgeObserver(size_t universe, ClientId client,
+                                   size_t count) {
+  if (universe < universes_.size()) {
+    universes_[universe]->AcknowledgeObserver(client, count);
+  }
+}
+
+Ensemble::Output Ensemble::Step() {
+  const size_t n = universes_.size();
+  const size_t rows = client_of_row_.size();
+  Output result;
+  result.deliveries.resize(n);
+  result.observer_deliveries.resize(n);
+  result.lockstep = lockstep();
+
+  if (result.lockstep) {
+    // One bound (column 0 speaks for every universe) and one set of grants.
+    std::optional<Seq> bound;
+    if (rows > 0) {
+      bound = std::numeric_limits<Seq>::max();
+      for (size_t row = 0; row < rows; ++row) {
+        bound = std::min(*bound, clears_[row * n]);
+      }
+    }
+    bool grant_due = false;
+    for (size_t u = 0; u < n; ++u) {
+      universes_[u]->AdvanceTo(bound, &result.deliveries[u],
+                               &result.observer_deliveries[u]);
+      grant_due = grant_due || universes_[u]->GrantDue();
+    }
+    if (grant_due) {
+      // Universe 0 may already have granted this bound while another (after
+      // a step out of lockstep) has not; grant it regardless.
+      universes_[0]->last_granted_.reset();
+      universes_[0]->AppendGrants(&result.shared_grants);
+      for (auto& universe : universes_) universe->MarkGranted();
+    }
+  } else {
+    // Every universe's bound in one row-major pass over the matrix.
+    std::vector<Seq> bounds(n, std::numeric_limits<Seq>::max());
+    for (size_t row = 0; row < rows; ++row) {
+      const Seq* cells = &clears_[row * n];
+      for (size_t u = 0; u < n; ++u) bounds[u] = std::min(bounds[u], cells[u]);
+    }
+    result.grants.resize(n);
+    for (size_t u = 0; u < n; ++u) {
+      universes_[u]->AdvanceTo(
+          rows > 0 ? std::optional<Seq>(bounds[u]) : std::nullopt,
+          &result.deliveries[u], &result.observer_deliveries[u]);
+      universes_[u]->AppendGrants(&result.grants[u]);
+    }
+  }
+
+  for (auto& universe : universes_) universe->DropEndedSubscriptions();
+  return result;
+}
+
+void Ensemble::Reset(Seq start, bool keep_subscriptions) {
+  for (auto& universe : universes_) universe->Reset(start, keep_subscriptions);
+  std::fill(clears_.begin(), clears_.end(), start);
+  std::fill(mismatches_.begin(), mismatches_.end(), 0);
+  total_mismatches_ = 0;
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "sequencer.h"
+#include "status.h"
+
+/// @file Lockstep ensembles of topologically identical universes.
+///
+/// RL workloads often run N copies ("universes") of one simulation, with the
+/// same clients, subscriptions, and latencies, differing only in payloads.
+/// Such universes very often also agree on every client's clear sequence
+/// number, and therefore on their bounds and on every advance grant.  An
+/// `Ensemble` runs one `Sequencer` per universe but computes the bound and
+/// grants once for the whole batch whenever that is so, and otherwise
+/// computes every universe's bound in a single pass over a clients-by-
+/// universes matrix.
+///
+/// Topology (clients and subscriptions) is shared by construction:  it can
+/// only be changed for all universes at once.  Publications and clear
+/// promises are per universe.
+
+namespace blocktopus {
+
+class Ensemble final {
+ public:
+  struct Config {
+    size_t num_universes = 1;
+    Sequencer::Config sequencer_config;
+  };
+
+  struct Output {
+    /// `deliveries[u]` are the deliveries for universe `u`, in order.
+    std::vector<std::vector<Sequencer::Delivery>> deliveries;
+
+    /// Grants that apply identically to every universe.  Populated instead
+    /// of `grants` when the universes are in lockstep.
+    std::vector<Sequencer::Grant> shared_grants;
+
+    /// `grants[u]` are the grants for universe `u` when the universes are
+    /// not in lockstep (and empty otherwise).
+    std::vector<std::vector<Sequencer::Grant>> grants;
+
+    /// `observer_deliveries[u]` are the observer deliveries for universe
+    /// `u`.
+    std::vector<std::vector<Sequencer::Delivery>> observer_deliveries;
+
+    /// Whether every universe had identical clear sequence numbers.
+    bool lockstep = false;
+  };
+
+  explicit Ensemble(const Config& config);
+
+  Ensemble(const Ensemble&) = delete;
+  Ensemble& operator=(const Ensemble&) = delete;
+
+  size_t size() const { return universes_.size(); }
+
+  /// As the `Sequencer` methods of the same names, applied to every
+  /// universe.  Where universes' bounds differ, the effective sequence
+  /// number reported is the latest of theirs.
+  Status AddClient(ClientId client, Seq start,
+                   Seq* effective_start = nullptr);
+  Status AddObserver(ClientId client,
+                     const Sequencer::ObserverConfig& config = {});
+  void RemoveClient(ClientId client);
+  Status Subscribe(ClientId client, const std::optional<std::string>& channel,
+                   Seq seq, Seq* effective);
+  Status Unsubscribe(ClientId client,
+                     const std::optional<std::string>& channel,
+                     Seq seq, Seq* effective);
+  void Reset(Seq start = 0, bool keep_subscriptions = true);
+
+  /// As the `Sequencer` methods of the same names, in universe
+  /// @p universe.
+  Status Publish(size_t universe, Message&& message);
+  Status ClearToAdvance(size_t universe, ClientId client, Seq clear_until);
+  void AcknowledgeObserver(size_t universe, ClientId client, size_t count);
+
+  /// `Sequencer::Step` for every universe.
+  Output Step();
+
+  /// @return the current bound of universe @p universe.
+  Seq bound(size_t universe) const { return universes_[universe]->bound(); }
+
+  /// @return whether every universe currently has identical clear sequence
+  /// numbers for every client.
+  bool lockstep() const { return total_mismatches_ == 0; }
+
+ private:
+  // Record that @p client is clear to @p clear in @p universe.
+  void SetClear(size_t universe, ClientId client, Seq clear);
+
+  const Config config_;
+  std::vector<std::unique_ptr<Sequencer>> universes_;
+
+  // Clear sequence numbers, clients by universes, one contiguous row per
+  // client so that the per-universe minimum vectorizes.
+  std::map<ClientId, size_t> row_of_;
+  std::vector<ClientId> client_of_row_;
+  std::vector<Seq> clears_;
+
+  // For each row, how many universes disagree with universe 0; and the sum
+  // of those counts.
+  std::vector<size_t> mismatches_;
+  size_t total_mismatches_ = 0;
+};
+
+}  // namespace blocktopus
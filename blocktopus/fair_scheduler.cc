@@ -0,0 +1,111 @@
+#include "fair_scheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace blocktopus {
+
+DeficitRoundRobin::DeficitRoundRobin(const Config& config) : config_(config) {}
+
+Status DeficitRoundRobin::Enqueue(ClientId client,
+                                  std::vector<uint8_t>&& frame) {
+  Queue& queue = queues_[client];
+  if (queue.bytes >= config_.max_queued_bytes) {
+    return Status(StatusCode::kBackpressure, "Enqueue[client queue full]");
+  }
+  if (queue.frames.empty() && !queue.paused) active_.push_back(client);
+  queue.bytes += frame.size();
+  queued_bytes_ += frame.size();
+  queue.frames.push_back(std::move(frame));
+  return Status::Ok();
+}
+
+size_t DeficitRoundRobin::Serve(
+    size_t max_bytes, size_t max_frames,
+    const std::function<void(ClientId, std::vector<uint8_t>&&)>& serve) {
+  size_t served = 0;
+  size_t frames = 0;
+  const auto within_budget = [&] {
+    return served < max_bytes && frames < max_frames;
+  };
+  while (within_budget() && !active_.empty()) {
+    const ClientId client = active_.front();
+    Queue& queue = queues_[client];
+    if (!turn_started_) {
+      queue.deficit += config_.quantum_bytes;
+      turn_started_ = true;
+      turn_frames_ = 0;
+    }
+    while (within_budget() && !queue.frames.empty() &&
+           queue.frames.front().size() <= queue.deficit &&
+           turn_frames_ < config_.max_frames_per_turn) {
+      std::vector<uint8_t> frame = std::move(queue.frames.front());
+      queue.frames.pop_front();
+      queue.deficit -= frame.size();
+      queue.bytes -= frame.size();
+      queued_bytes_ -= frame.size();
+      served += frame.size();
+      ++frames;
+      ++turn_frames_;
+      serve(client, std::move(frame));
+    }
+    if (!within_budget() && !queue.frames.empty() &&
+        queue.frames.front().size() <= queue.deficit &&
+        turn_frames_ < config_.max_frames_per_turn) {
+      break;  // Out of budget mid-turn; resume here next call.
+    }
+    // The turn is over.
+    active_.pop_front();
+    turn_started_ = false;
+    if (queue.frames.empty()) {
+      // An idle client banks nothing.
+      queue.deficit = 0;
+    } else {
+      if (turn_frames_ >= config_.max_frames_per_turn) {
+        // Cut short by the frame quota, not by bytes; carry no more than
+        // one quantum over, or small frames would bank a large allowance.
+        queue.deficit = std::min(queue.deficit, config_.quantum_bytes);
+      }
+      active_.push_back(client);
+    }
+  }
+  return served;
+}
+
+void DeficitRoundRobin::Pause(ClientId client) {
+  Queue& queue = queues_[client];
+  if (queue.paused) return;
+  queue.paused = true;
+  // As if idle:  it banks nothing.
+  queue.deficit = 0;
+  Deactivate(client);
+}
+
+void DeficitRoundRobin::Resume(ClientId client) {
+  auto it = queues_.find(client);
+  if (it == queues_.end() || !it->second.paused) return;
+  it->second.paused = false;
+  if (!it->second.frames.empty()) active_.push_back(client);
+}
+
+void DeficitRoundRobin::RemoveClient(ClientId client) {
+  auto it = queues_.find(client);
+  if (it == queues_.end()) return;
+  queued_bytes_ -= it->second.bytes;
+  queues_.erase(it);
+  Deactivate(client);
+}
+
+void DeficitRoundRobin::Deactivate(ClientId client) {
+  auto position = std::find(active_.begin(), active_.end(), client);
+  if (position == active_.end()) return;
+  if (position == active_.begin()) turn_started_ = false;
+  active_.erase(position);
+}
+
+size_t DeficitRoundRobin::queued_bytes(ClientId client) const {
+  auto it = queues_.find(client);
+  return it == queues_.end() ? 0 : it->second.bytes;
+}
+
+}  // namespace blocktopus
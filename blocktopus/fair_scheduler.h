@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "common.h"
+#include "status.h"
+
+/// @file Deficit-round-robin scheduling of per-client I/O.
+///
+/// A server loop that simply drains each connection in turn lets a client
+/// publishing a huge burst delay everyone else's `ClearToAdvance` frames,
+/// and so everyone's `AwaitAdvance`.  A `DeficitRoundRobin` holds each
+/// client's frames in its own queue and serves the clients in rounds:  each
+/// turn, a client may take up to a quantum of bytes (plus whatever it could
+/// not use last turn) and at most a quota of frames.  A small control frame
+/// therefore waits for at most one turn of each other client, however much
+/// they have queued, and clients share bandwidth in proportion to bytes, not
+/// frames.
+///
+/// `ServerPipeline` keeps one scheduler per I/O thread for ingest (frames
+/// read from connections, waiting to be decoded).  A server whose clients
+/// share an egress queue (rather than each having its own connection) can
+/// keep one for egress too.  Each client's frames are served in the order
+/// queued; only clients are interleaved, never frames within a client,
+/// since a client's requests depend on their order.  Scheduling depends
+/// only on the order of calls, never on time, so it is reproducible.
+
+namespace blocktopus {
+
+class DeficitRoundRobin final {
+ public:
+  struct Config {
+    /// Bytes added to a client's allowance each turn.
+    size_t quantum_bytes = 16 << 10;
+    /// The most frames a client may have served in one turn.
+    size_t max_frames_per_turn = 32;
+    /// `Enqueue` pushes back once a client has this many bytes queued.
+    size_t max_queued_bytes = 4 << 20;
+  };
+
+  DeficitRoundRobin() : DeficitRoundRobin(Config()) {}
+  explicit DeficitRoundRobin(const Config& config);
+
+  DeficitRoundRobin(const DeficitRoundRobin&) = delete;
+  DeficitRoundRobin& operator=(const DeficitRoundRobin&) = delete;
+
+  /// Queue @p frame for @p client.
+  ///
+  /// Fails with `kBackpressure`, leaving @p frame unconsumed, if @p client
+  /// already has `max_queued_bytes` queued; stop reading from (or producing
+  /// for) it until some are served.
+  Status Enqueue(ClientId client, std::vector<uint8_t>&& frame);
+
+  /// Serve queued frames, in deficit-round-robin order, passing each to
+  /// @p serve, until about @p max_bytes have been served (one frame may
+  /// take it over) or nothing is left.  A turn cut short by @p max_bytes
+  /// resumes on the next call.
+  ///
+  /// @return the number of bytes served.
+  size_t Serve(size_t max_bytes,
+               const std::function<void(ClientId, std::vector<uint8_t>&&)>&
+                   serve) {
+    return Serve(max_bytes, SIZE_MAX, serve);
+  }
+
+  /// As above, but also stop after @p max_frames frames, e.g. when the
+  /// next stage has room for only so many.
+  size_t Serve(size_t max_bytes, size_t max_frames,
+               const std::function<void(ClientId, std::vector<uint8_t>&&)>&
+                   serve);
+
+  /// Serve @p client nothing until `Resume`d, e.g. while the next stage
+  /// will not accept its frames.  Its frames stay queued, and `Enqueue`
+  /// still takes more up to `max_queued_bytes`.
+  void Pause(ClientId client);
+  void Resume(ClientId client);
+
+  /// Drop @p client and everything queued for it.
+  void RemoveClient(ClientId client);
+
+  /// @return the bytes queued for @p client, or in all.
+  size_t queued_bytes(ClientId client) const;
+  size_t queued_bytes() const { return queued_bytes_; }
+
+ private:
+  struct Queue {
+    std::deque<std::vector<uint8_t>> frames;
+    size_t bytes = 0;
+    size_t deficit = 0;
+    bool paused = false;
+  };
+
+  // Take @p client out of the turn order.
+  void Deactivate(ClientId client);
+
+  const Config config_;
+  std::map<ClientId, Queue> queues_;
+  // Clients with frames queued and not paused, in turn order; the front is
+  // being served.
+  std::deque<ClientId> active_;
+  // Whether the front client's turn has begun (and got its quantum), and
+  // how many frames it has been served in it.
+  bool turn_started_ = false;
+  size_t turn_frames_ = 0;
+  size_t queued_bytes_ = 0;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,100 @@
+#include "file_region.h"
+
+#include "fmt/core.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+/// @brief Throw, describing @p what and `errno`.
+[[noreturn]] void ThrowErrno(const std::string& what, int error) {
+  throw std::runtime_error(
+    fmt::format("ERROR[{} => {}]: {}", what, error, strerror(error)));
+}
+
+}  // namespace
+
+void SerializeFileRegionRef(const FileRegionRef& ref,
+                            std::vector<uint8_t>* out) {
+  PutString(ref.path, out);
+  PutVarint(ref.offset, out);
+  PutVarint(ref.length, out);
+}
+
+std::optional<FileRegionRef> ParseFileRegionRef(
+    std::span<const uint8_t> data) {
+  ByteReader reader(data);
+  FileRegionRef ref;
+  if (!reader.GetString(&ref.path) || !reader.GetVarint(&ref.offset) ||
+      !reader.GetVarint(&ref.length) || !reader.done()) {
+    return std::nullopt;
+  }
+  return ref;
+}
+
+MappedFileRegion::MappedFileRegion(void* mapping, size_t mapping_size,
+                                   std::span<const uint8_t> bytes)
+    : mapping_(mapping), mapping_size_(mapping_size), bytes_(bytes) {}
+
+MappedFileRegion::MappedFileRegion(MappedFileRegion&& other)
+    : mapping_(std::exchange(other.mapping_, nullptr)),
+      mapping_size_(std::exchange(other.mapping_size_, 0)),
+      bytes_(std::exchange(other.bytes_, {})) {}
+
+MappedFileRegion::~MappedFileRegion() {
+  if (mapping_ != nullptr) munmap(mapping_, mapping_size_);
+}
+
+std::shared_ptr<const FileRegion> FileRegion::Open(const FileRegionRef& ref) {
+  const int fd = open(ref.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) ThrowErrno("open(" + ref.path + ")", errno);
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    const int error = errno;
+    close(fd);
+    ThrowErrno("fstat(" + ref.path + ")", error);
+  }
+  // Written so as not to overflow:  `ref` may have come off the network.
+  const uint64_t size = info.st_size;
+  if (ref.offset > size || ref.length > size - ref.offset) {
+    close(fd);
+    throw std::runtime_error(fmt::format(
+        "{} has {} bytes; region of {} bytes at {} is out of range",
+        ref.path, size, ref.length, ref.offset));
+  }
+  return std::shared_ptr<const FileRegion>(
+      new FileRegion(fd, ref.offset, ref.length));
+}
+
+FileRegion::~FileRegion() {
+  close(fd_);
+}
+
+MappedFileRegion FileRegion::Map() const {
+  if (length_ == 0) return MappedFileRegion(nullptr, 0, {});
+  // Mappings must start on a page boundary.
+  const uint64_t page = sysconf(_SC_PAGESIZE);
+  const uint64_t start = offset_ / page * page;
+  const size_t mapping_size = offset_ - start + length_;
+  void* mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd_,
+                       start);
+  if (mapping == MAP_FAILED) ThrowErrno("mmap", errno);
+  return MappedFileRegion(
+      mapping, mapping_size,
+      std::span<const uint8_t>(
+          static_cast<const uint8_t*>(mapping) + (offset_ - start), length_));
+}
+
+}  // namespace blocktopus
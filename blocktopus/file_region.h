@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+/// @file Payloads that live in files.
+///
+/// Some payloads (maps, meshes, recorded sensor data) already exist on
+/// disk.  Rather than read them into memory to publish them, a publisher
+/// can publish a `FileRegionRef` naming the bytes.  A server forwarding one
+/// to a remote subscriber opens it as a `FileRegion` and hands that to
+/// `Transport::SendFileRegion`, which moves the bytes from the page cache to
+/// the socket with `sendfile`; a subscriber on the same host can instead
+/// `Map` the region and read the page cache directly.  Either way the bytes
+/// never pass through a user-space buffer.
+
+namespace blocktopus {
+
+/// Names a byte range of a file.
+struct FileRegionRef {
+  std::string path;
+  uint64_t offset = 0;
+  uint64_t length = 0;
+};
+
+/// Append an encoding of @p ref (e.g. as a message payload).
+void SerializeFileRegionRef(const FileRegionRef& ref,
+                            std::vector<uint8_t>* out);
+
+/// @return the reference encoded in @p data, or `nullopt` if malformed.
+std::optional<FileRegionRef> ParseFileRegionRef(std::span<const uint8_t> data);
+
+/// A read-only memory mapping of a file region, unmapped on destruction.
+class MappedFileRegion final {
+ public:
+  MappedFileRegion(MappedFileRegion&& other);
+  ~MappedFileRegion();
+
+  MappedFileRegion(const MappedFileRegion&) = delete;
+  MappedFileRegion& operator=(const MappedFileRegion&) = delete;
+
+  std::span<const uint8_t> bytes() const { return bytes_; }
+
+ private:
+  friend class FileRegion;
+  MappedFileRegion(void* mapping, size_t mapping_size,
+                   std::span<const uint8_t> bytes);
+
+  void* mapping_;
+  size_t mapping_size_;
+  std::span<const uint8_t> bytes_;
+};
+
+/// An open file region.  Immutable, so one may be shared by every
+/// transport sending it.
+class FileRegion final {
+ public:
+  /// Open @p ref.  Throws if the file cannot be opened or is shorter than
+  /// the region.
+  static std::shared_ptr<const FileRegion> Open(const FileRegionRef& ref);
+
+  ~FileRegion();
+
+  FileRegion(const FileRegion&) = delete;
+  FileRegion& operator=(const FileRegion&) = delete;
+
+  int fd() const { return fd_; }
+  uint64_t offset() const { return offset_; }
+  uint64_t length() const { return length_; }
+
+  /// Map the region into memory, sharing the page cache.  Throws if that
+  /// fails.
+  MappedFileRegion Map() const;
+
+ private:
+  FileRegion(int fd, uint64_t offset, uint64_t length)
+      : fd_(fd), offset_(offset), length_(length) {}
+
+  const int fd_;
+  const uint64_t offset_;
+  const uint64_t length_;
+};
+
+}  // namespace blocktopus
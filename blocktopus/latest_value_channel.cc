@@ -0,0 +1,237 @@
+#include "latest_value_channel.h"
+
+#include "fmt/core.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace blocktopus {
+
+namespace {
+
+constexpr uint64_t kMagic = 0x62746c76616c0001ULL;  // "btlval", version 1
+constexpr size_t kCacheLine = 64;
+// How often a reader retries one slot before deciding that its writer died
+// mid-write.  A live writer holds a slot for one short copy.
+constexpr int kMaxReadAttempts = 1 << 20;
+
+/// @brief Throw, describing @p what and `errno`.
+[[noreturn]] void ThrowErrno(const std::string& what, int error) {
+  throw std::runtime_error(
+    fmt::format("ERROR[{} => {}]: {}", what, error, strerror(error)));
+}
+
+size_t RoundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+struct LatestValueChannel::Header {
+  uint64_t magic;
+  uint64_t slot_count;
+  uint64_t max_value_size;
+  uint64_t slot_stride;
+  // The writer and the server each own a cache line.
+  alignas(kCacheLine) std::atomic<uint64_t> write_count;
+  alignas(kCacheLine) std::atomic<Seq> visible_through;
+};
+
+struct LatestValueChannel::Slot {
+  // Odd while the writer is changing the slot.
+  std::atomic<uint64_t> lock;
+  std::atomic<Seq> seq;
+  std::atomic<uint64_t> size;
+  // The value follows.
+  uint8_t* value() { return reinterpret_cast<uint8_t*>(this + 1); }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+              std::atomic<Seq>::is_always_lock_free,
+              "Shared-memory atomics must be lock-free to be address-free");
+
+LatestValueChannel LatestValueChannel::Create(const Config& config) {
+  if (config.slot_count == 0) {
+    throw std::invalid_argument("LatestValueChannel needs at least one slot");
+  }
+  const size_t stride =
+      RoundUp(sizeof(Slot) + config.max_value_size, kCacheLine);
+  const size_t size = RoundUp(sizeof(Header), kCacheLine) +
+                      stride * config.slot_count;
+  const int fd = shm_open(config.name.c_str(), O_CREAT | O_TRUNC | O_RDWR,
+                          0600);
+  if (fd < 0) ThrowErrno("shm_open(" + config.name + ")", errno);
+  if (ftruncate(fd, size) < 0) {
+    const int error = errno;
+    close(fd);
+    ThrowErrno("ftruncate", error);
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                       0);
+  const int error = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) ThrowErrno("mmap", error);
+
+  LatestValueChannel result(mapping, size);
+  Header* header = new (mapping) Header{
+    .magic = 0,
+    .slot_count = config.slot_count,
+    .max_value_size = config.max_value_size,
+    .slot_stride = stride};
+  header->write_count.store(0);
+  header->visible_through.store(std::numeric_limits<Seq>::min());
+  for (size_t i = 0; i < config.slot_count; ++i) {
+    new (result.slot(i)) Slot{};
+  }
+  // Publish the magic number last, so openers never see a half-built
+  // segment as valid.
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = kMagic;
+  return result;
+}
+
+LatestValueChannel LatestValueChannel::Open(const std::string& name) {
+  const int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) ThrowErrno("shm_open(" + name + ")", errno);
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    const int error = errno;
+    close(fd);
+    ThrowErrno("fstat", error);
+  }
+  const size_t size = info.st_size;
+  if (size < sizeof(Header)) {
+    close(fd);
+    throw std::runtime_error(fmt::format("{} is not a channel", name));
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                       0);
+  const int error = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) ThrowErrno("mmap", error);
+
+  LatestValueChannel result(mapping, size);
+  const Header* header = result.header();
+  if (header->magic != kMagic ||
+      RoundUp(sizeof(Header), kCacheLine) +
+          header->slot_stride * header->slot_count > size) {
+    throw std::runtime_error(fmt::format("{} is not a channel", name));
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return result;
+}
+
+void LatestValueChannel::Unlink(const std::string& name) {
+  shm_unlink(name.c_str());
+}
+
+LatestValueChannel::LatestValueChannel(void* mapping, size_t mapping_size)
+    : mapping_(mapping), mapping_size_(mapping_size) {}
+
+LatestValueChannel::LatestValueChannel(LatestValueChannel&& other)
+    : mapping_(std::exchange(other.mapping_, nullptr)),
+      mapping_size_(std::exchange(other.mapping_size_, 0)) {}
+
+LatestValueChannel::~LatestValueChannel() {
+  if (mapping_ != nullptr) munmap(mapping_, mapping_size_);
+}
+
+LatestValueChannel::Header* LatestValueChannel::header() const {
+  return static_cast<Header*>(mapping_);
+}
+
+LatestValueChannel::Slot* LatestValueChannel::slot(uint64_t index) const {
+  uint8_t* base = static_cast<uint8_t*>(mapping_) +
+                  RoundUp(sizeof(Header), kCacheLine);
+  return reinterpret_cast<Slot*>(
+      base + (index % header()->slot_count) * header()->slot_stride);
+}
+
+size_t LatestValueChannel::slot_count() const {
+  return header()->slot_count;
+}
+
+size_t LatestValueChannel::max_value_size() const {
+  return header()->max_value_size;
+}
+
+Status LatestValueChannel::Write(Seq seq, std::span<const uint8_t> value) {
+  Header* h = header();
+  if (value.size() > h->max_value_size) {
+    return Status(StatusCode::kProtocolError, "Write[value too large]");
+  }
+  const uint64_t count = h->write_count.load(std::memory_order_relaxed);
+  if (count > 0 &&
+      seq <= slot(count - 1)->seq.load(std::memory_order_relaxed)) {
+    return Status(StatusCode::kProtocolError, "Write[seq went backwards]");
+  }
+  if (seq <= visible_through()) {
+    // Readers at `seq` may already have read an older version.
+    return Status(StatusCode::kProtocolError, "Write[seq already visible]");
+  }
+  Slot* target = slot(count);
+  const uint64_t lock = target->lock.load(std::memory_order_relaxed);
+  target->lock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  target->seq.store(seq, std::memory_order_relaxed);
+  target->size.store(value.size(), std::memory_order_relaxed);
+  if (!value.empty()) std::memcpy(target->value(), value.data(), value.size());
+  target->lock.store(lock + 2, std::memory_order_release);
+  h->write_count.store(count + 1, std::memory_order_release);
+  return Status::Ok();
+}
+
+void LatestValueChannel::SetVisibleThrough(Seq seq) {
+  header()->visible_through.store(seq, std::memory_order_release);
+}
+
+Seq LatestValueChannel::visible_through() const {
+  return header()->visible_through.load(std::memory_order_acquire);
+}
+
+Status LatestValueChannel::Read(Seq at, std::vector<uint8_t>* value,
+                                Seq* version) const {
+  const Header* h = header();
+  if (at > visible_through()) {
+    return Status(StatusCode::kBackpressure, "Read[not yet visible]");
+  }
+  const uint64_t count = h->write_count.load(std::memory_order_acquire);
+  const uint64_t oldest = count > h->slot_count ? count - h->slot_count : 0;
+  // Newest first; versions are in increasing seq order.
+  for (uint64_t index = count; index-- > oldest;) {
+    Slot* candidate = slot(index);
+    for (int attempt = 0;; ++attempt) {
+      if (attempt == kMaxReadAttempts) {
+        return Status(StatusCode::kIoError, "Read[writer stalled mid-write]");
+      }
+      const uint64_t lock = candidate->lock.load(std::memory_order_acquire);
+      if (lock & 1) continue;  // Mid-write; the writer never waits, so spin.
+      const Seq seq = candidate->seq.load(std::memory_order_relaxed);
+      const size_t size = std::min<uint64_t>(
+          candidate->size.load(std::memory_order_relaxed), h->max_value_size);
+      if (seq <= at) {
+        value->resize(size);
+        if (size > 0) std::memcpy(value->data(), candidate->value(), size);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (candidate->lock.load(std::memory_order_relaxed) != lock) continue;
+      if (seq > at) break;  // Too new; try the next older slot.
+      *version = seq;
+      return Status::Ok();
+    }
+  }
+  return Status(StatusCode::kProtocolError, "Read[no version retained]");
+}
+
+}  // namespace blocktopus
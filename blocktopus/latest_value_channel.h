@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "status.h"
+
+/// @file Shared-memory latest-value channels for same-host state.
+///
+/// For high-rate state (poses, joint states, ...) where only the latest
+/// value matters and every party is on one host, delivering each version as
+/// a message is wasted work.  A `LatestValueChannel` instead keeps the last
+/// few versions in a ring of slots in a POSIX shared-memory segment, each
+/// tagged with the sequence number at which it was published and guarded by
+/// a seqlock.  The single writer overwrites the oldest slot without ever
+/// waiting for readers; readers copy out the version valid at their current
+/// receive sequence number, retrying if the writer overwrote it meanwhile.
+///
+/// Determinism is kept by the server rather than the writer:  a version is
+/// only readable once the server has advanced the channel's *visible* mark
+/// (`SetVisibleThrough`, typically to each new bound) past its sequence
+/// number, so every reader reading at a given sequence number sees the same
+/// version however the processes are scheduled.
+
+namespace blocktopus {
+
+class LatestValueChannel final {
+ public:
+  struct Config {
+    /// The shared-memory object name, e.g. "/blocktopus.pose".
+    std::string name;
+    /// How many versions are kept; readers more than this many versions
+    /// behind the writer cannot be served.
+    size_t slot_count = 8;
+    /// The largest value that can be written.
+    size_t max_value_size = 4096;
+  };
+
+  /// Create (replacing any existing) segment as described by @p config.
+  /// Throws if that fails.
+  static LatestValueChannel Create(const Config& config);
+
+  /// Map the existing segment @p name.  Throws if that fails or it is not a
+  /// channel segment.
+  static LatestValueChannel Open(const std::string& name);
+
+  /// Remove the segment @p name; mappings already made remain valid.
+  static void Unlink(const std::string& name);
+
+  LatestValueChannel(LatestValueChannel&& other);
+  ~LatestValueChannel();
+
+  LatestValueChannel(const LatestValueChannel&) = delete;
+  LatestValueChannel& operator=(const LatestValueChannel&) = delete;
+
+  /// (Writer only) Publish @p value as the version at @p seq, which must
+  /// exceed that of every earlier version and `visible_through()`; a
+  /// version at an already visible sequence number would change what
+  /// readers there see (`kProtocolError`).
+  Status Write(Seq seq, std::span<const uint8_t> value);
+
+  /// (Server only) Make every version at or before @p seq visible.
+  void SetVisibleThrough(Seq seq);
+
+  /// @return the latest sequence number through which versions are visible.
+  Seq visible_through() const;
+
+  /// Copy the version valid at @p at -- the latest one at or before it --
+  /// into @p value, and its sequence number into @p version.
+  ///
+  /// Fails with `kBackpressure` if @p at is not yet visible (retry after the
+  /// server advances), with `kProtocolError` if there is no such version
+  /// or it has already been overwritten, and with `kIoError` if the writer
+  /// has held a slot mid-write for far longer than a write takes (most
+  /// likely because it died there).
+  Status Read(Seq at, std::vector<uint8_t>* value, Seq* version) const;
+
+  size_t slot_count() const;
+  size_t max_value_size() const;
+
+ private:
+  struct Header;
+  struct Slot;
+
+  LatestValueChannel(void* mapping, size_t mapping_size);
+
+  Header* header() const;
+  Slot* slot(uint64_t index) const;
+
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,108 @@
+#include "launcher.h"
+
+#include "fmt/core.h"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+extern char** environ;
+
+namespace blocktopus {
+
+namespace {
+
+/// The descriptor number at which components find their socket.  As with
+/// systemd socket activation, this is the first after stdin/out/err; a
+/// fixed small number keeps even shell scripts able to use it.
+constexpr int kComponentFd = 3;
+
+/// @brief Throw, describing @p what and `errno`.
+[[noreturn]] void ThrowErrno(const std::string& what, int error) {
+  throw std::runtime_error(
+    fmt::format("ERROR[{} => {}]: {}", what, error, strerror(error)));
+}
+
+}  // namespace
+
+LaunchedComponent LaunchComponent(
+    const std::vector<std::string>& argv,
+    const Transport::Config& server_end_config) {
+  if (argv.empty()) {
+    throw std::invalid_argument("LaunchComponent requires a program");
+  }
+  // Both ends are close-on-exec; the child's `dup2` onto `kComponentFd`
+  // clears the flag on that copy only, so the component inherits exactly one
+  // descriptor for the socket and passes none on to its own children by
+  // accident.
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+    ThrowErrno("socketpair", errno);
+  }
+  const int server_fd = fds[0];
+  int component_fd = fds[1];
+  if (component_fd == kComponentFd) {
+    // `dup2` onto itself would leave the flag set; move it out of the way.
+    component_fd = fcntl(fds[1], F_DUPFD_CLOEXEC, kComponentFd + 1);
+    const int error = errno;
+    close(fds[1]);
+    if (component_fd < 0) {
+      close(server_fd);
+      ThrowErrno("fcntl(F_DUPFD_CLOEXEC)", error);
+    }
+  }
+
+  std::vector<std::string> env_storage;
+  const std::string prefix =
+    std::string(Transport::kInheritedSocketEnvVar) + "=";
+  for (char** entry = environ; *entry != nullptr; ++entry) {
+    if (strncmp(*entry, prefix.c_str(), prefix.size()) != 0) {
+      env_storage.push_back(*entry);
+    }
+  }
+  env_storage.push_back(prefix + std::to_string(kComponentFd));
+  std::vector<char*> envp;
+  for (std::string& entry : env_storage) envp.push_back(entry.data());
+  envp.push_back(nullptr);
+
+  std::vector<std::string> argv_storage = argv;
+  std::vector<char*> argvp;
+  for (std::string& arg : argv_storage) argvp.push_back(arg.data());
+  argvp.push_back(nullptr);
+
+  posix_spawn_file_actions_t file_actions;
+  posix_spawn_file_actions_init(&file_actions);
+  posix_spawn_file_actions_adddup2(&file_actions, component_fd, kComponentFd);
+  pid_t pid;
+  const int spawn_error = posix_spawnp(&pid, argvp[0], &file_actions, nullptr,
+                                       argvp.data(), envp.data());
+  posix_spawn_file_actions_destroy(&file_actions);
+  close(component_fd);
+  if (spawn_error != 0) {
+    close(server_fd);
+    ThrowErrno(fmt::format("posix_spawnp({})", argv[0]), spawn_error);
+  }
+
+  Transport::Config config = server_end_config;
+  config.end = Transport::End::kServer;
+  return LaunchedComponent{
+    .pid = pid,
+    .transport = Transport::FromConnectedSocket(server_fd, config)};
+}
+
+int AwaitComponentExit(pid_t pid) {
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) ThrowErrno(fmt::format("waitpid({})", pid), errno);
+  }
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+}  // namespace blocktopus
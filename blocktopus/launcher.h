@@ -0,0 +1,61 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "transport.h"
+
+/// @file Launching component processes with pre-connected transports.
+///
+/// Normally every component of a simulation connects to the server over TCP,
+/// and the server accepts each connection in turn; with hundreds of
+/// components that handshake dominates cold start.  A launcher instead
+/// creates a `socketpair` per component, keeps one end as the server-side
+/// `Transport`, and hands the other down to the component as an inherited
+/// descriptor, which the component adopts with
+/// `Transport::FromInheritedSocket` -- no listen, accept, or connect at all.
+/// It is a library rather than a program because the server ends must stay
+/// in the server's own process.
+///
+/// > // Server:
+/// > LaunchedComponent c = LaunchComponent({"my_component", "--flag"}, {});
+/// > // ...then serve c.transport as any accepted connection, e.g.
+/// > while (c.transport.ProcessIO()) {
+/// >   for (const auto& datagram : c.transport.ReceiveAll()) { /* ... */ }
+/// > }
+/// > AwaitComponentExit(c.pid);
+/// >
+/// > // Component:
+/// > auto transport = Transport::FromInheritedSocket(config);
+/// > if (!transport) { /* connect over TCP as usual */ }
+
+namespace blocktopus {
+
+/// A running component process and the server end of its connection.
+struct LaunchedComponent {
+  pid_t pid;
+  Transport transport;
+};
+
+/// (BLOCKING) Spawn @p argv (searching `PATH` for `argv[0]`) with one end of
+/// a fresh `socketpair` inherited as descriptor 3 and named in its
+/// environment.
+///
+/// @param server_end_config configures the returned server-end transport;
+/// its `end` is forced to `Transport::End::kServer`.
+///
+/// Throws if the socketpair cannot be made or the process cannot be
+/// spawned.
+LaunchedComponent LaunchComponent(
+    const std::vector<std::string>& argv,
+    const Transport::Config& server_end_config);
+
+/// (BLOCKING) Wait for the process @p pid to exit.
+///
+/// @return its exit status, or 128 plus the signal number if it was killed
+/// by a signal (the shell convention).
+int AwaitComponentExit(pid_t pid);
+
+}  // namespace blocktopus
@@ -0,0 +1,108 @@
+#include "local_fanout.h"
+
+#include <algorithm>
+
+namespace blocktopus {
+
+Seq LocalFanout::EffectiveFrom(Seq seq) const {
+  if (granted_.has_value()) seq = std::max(seq, *granted_);
+  if (delivered_through_.has_value()) seq = std::max(seq, *delivered_through_);
+  return seq;
+}
+
+Seq LocalFanout::Subscribe(LocalId subscriber,
+                           const std::optional<std::string>& channel,
+                           Seq seq, std::vector<WireRequest>* wire) {
+  std::vector<Subscription>& list = subscriptions_[channel];
+  if (std::none_of(list.begin(), list.end(), IsOpen)) {
+    wire->push_back(WireRequest{.kind = WireRequest::Kind::kSubscribe,
+                                .channel = channel, .seq = seq});
+  }
+  const Seq effective = EffectiveFrom(seq);
+  list.push_back(Subscription{.subscriber = subscriber, .from = effective});
+  return effective;
+}
+
+std::optional<Seq> LocalFanout::Unsubscribe(
+    LocalId subscriber, const std::optional<std::string>& channel, Seq seq,
+    std::vector<WireRequest>* wire) {
+  auto it = subscriptions_.find(channel);
+  if (it == subscriptions_.end()) return std::nullopt;
+  std::vector<Subscription>& list = it->second;
+  auto found = std::find_if(list.begin(), list.end(),
+                            [subscriber](const Subscription& subscription) {
+    return subscription.subscriber == subscriber && IsOpen(subscription);
+  });
+  if (found == list.end()) return std::nullopt;
+  const Seq effective = EffectiveFrom(seq);
+  found->until = effective;
+  if (std::none_of(list.begin(), list.end(), IsOpen)) {
+    // The wire subscription must last as long as the longest local one.
+    Seq last = effective;
+    for (const Subscription& subscription : list) {
+      last = std::max(last, *subscription.until);
+    }
+    wire->push_back(WireRequest{.kind = WireRequest::Kind::kUnsubscribe,
+                                .channel = channel, .seq = last});
+  }
+  return effective;
+}
+
+void LocalFanout::OnWireSubscribed(const std::optional<std::string>& channel,
+                                   Seq effective) {
+  auto it = subscriptions_.find(channel);
+  if (it == subscriptions_.end()) return;
+  for (Subscription& subscription : it->second) {
+    if (IsOpen(subscription)) {
+      subscription.from = std::max(subscription.from, effective);
+    }
+  }
+}
+
+void LocalFanout::OnDelivery(const std::shared_ptr<const Message>& message) {
+  delivered_through_ =
+      std::max(delivered_through_.value_or(message->receive_seq),
+               message->receive_seq);
+  std::vector<LocalId> recipients;
+  for (const auto& channel : {std::optional<std::string>(message->channel),
+                              std::optional<std::string>()}) {
+    auto it = subscriptions_.find(channel);
+    if (it == subscriptions_.end()) continue;
+    for (const Subscription& subscription : it->second) {
+      if (message->receive_seq > subscription.from &&
+          (IsOpen(subscription) ||
+           message->receive_seq <= *subscription.until)) {
+        recipients.push_back(subscription.subscriber);
+      }
+    }
+  }
+  // As on the server, one copy per subscriber however many of its
+  // subscriptions match.
+  std::sort(recipients.begin(), recipients.end());
+  recipients.erase(std::unique(recipients.begin(), recipients.end()),
+                   recipients.end());
+  for (LocalId recipient : recipients) queues_[recipient].push_back(message);
+  if (!recipients.empty()) shared_deliveries_ += recipients.size() - 1;
+}
+
+void LocalFanout::OnGrant(Seq seq) {
+  granted_ = seq;
+  // Ended subscriptions that can match no further message are dropped.
+  for (auto it = subscriptions_.begin(); it != subscriptions_.end();) {
+    std::erase_if(it->second, [seq](const Subscription& subscription) {
+      return !IsOpen(subscription) && *subscription.until <= seq;
+    });
+    it = it->second.empty() ? subscriptions_.erase(it) : std::next(it);
+  }
+}
+
+std::vector<std::shared_ptr<const Message>> LocalFanout::Take(
+    LocalId subscriber) {
+  auto it = queues_.find(subscriber);
+  if (it == queues_.end()) return {};
+  std::vector<std::shared_ptr<const Message>> result = std::move(it->second);
+  queues_.erase(it);
+  return result;
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+/// @file Sharing subscriptions among the components of one process.
+///
+/// When several components in one process subscribe to the same channel,
+/// having each subscribe separately makes the server send the process one
+/// identical copy per component.  A `LocalFanout` instead makes one *wire*
+/// subscription per channel on behalf of all of them (carried by any one of
+/// the process's clients), and hands each message it receives to every
+/// local subscriber whose own subscription covers it -- by reference, so
+/// that one copy serves them all.
+///
+/// Each local subscription keeps its own effective start and end, exactly as
+/// a subscription made directly with the server would:  a subscription made
+/// at @p seq takes effect after the latest of @p seq, the latest grant the
+/// process has received, and the latest message it has received, since every
+/// message up to either of those has already been handed out.
+
+namespace blocktopus {
+
+class LocalFanout final {
+ public:
+  /// Identifies a component within the process.
+  using LocalId = uint32_t;
+
+  /// A subscription change that must be sent to the server.
+  struct WireRequest {
+    enum class Kind { kSubscribe, kUnsubscribe };
+    Kind kind;
+    std::optional<std::string> channel;
+    Seq seq;
+  };
+
+  LocalFanout() = default;
+
+  LocalFanout(const LocalFanout&) = delete;
+  LocalFanout& operator=(const LocalFanout&) = delete;
+
+  /// Subscribe @p subscriber to @p channel (or every channel if `nullopt`)
+  /// from @p seq onwards.  If the process is not yet subscribed to
+  /// @p channel, a wire subscription is appended to @p wire.
+  ///
+  /// @return the sequence number after which delivery is guaranteed.  If
+  /// a wire subscription was needed this is provisional until the server
+  /// replies (see `OnWireSubscribed`).
+  Seq Subscribe(LocalId subscriber, const std::optional<std::string>& channel,
+                Seq seq, std::vector<WireRequest>* wire);
+
+  /// End @p subscriber's subscription to @p channel; if it was the last on
+  /// that channel, a wire unsubscription is appended to @p wire.
+  ///
+  /// @return the sequence number through which delivery continues, or
+  /// `nullopt` if @p subscriber was not subscribed.
+  std::optional<Seq> Unsubscribe(LocalId subscriber,
+                                 const std::optional<std::string>& channel,
+                                 Seq seq, std::vector<WireRequest>* wire);
+
+  /// Record the server's reply to a wire subscription to @p channel:  local
+  /// subscriptions waiting on it take effect no earlier than @p effective.
+  void OnWireSubscribed(const std::optional<std::string>& channel,
+                        Seq effective);
+
+  /// Accept a message delivered to the process, queuing it for every local
+  /// subscriber it is for.
+  void OnDelivery(const std::shared_ptr<const Message>& message);
+
+  /// Record that the process has been granted @p seq.
+  void OnGrant(Seq seq);
+
+  /// Take every message queued for @p subscriber, in delivery order.
+  std::vector<std::shared_ptr<const Message>> Take(LocalId subscriber);
+
+  /// @return how many local deliveries were served by sharing a copy that
+  /// some other local subscriber also received; i.e. the number of copies
+  /// the server did not have to send.
+  uint64_t shared_deliveries() const { return shared_deliveries_; }
+
+ private:
+  struct Subscription {
+    LocalId subscriber;
+    Seq from;                  // Deliver messages with receive_seq > from ...
+    std::optional<Seq> until;  // ... and <= until, if set.
+  };
+
+  static bool IsOpen(const Subscription& subscription) {
+    return !subscription.until.has_value();
+  }
+
+  // @return when a (un)subscription made at @p seq takes effect.
+  Seq EffectiveFrom(Seq seq) const;
+
+  // Bucketed by channel; `nullopt` is the wildcard.  A channel has a wire
+  // subscription exactly when its list has an open (until-less) entry.
+  std::map<std::optional<std::string>, std::vector<Subscription>>
+      subscriptions_;
+  std::map<LocalId, std::vector<std::shared_ptr<const Message>>> queues_;
+  std::optional<Seq> granted_;
+  // The highest `receive_seq` delivered to the process.
+  std::optional<Seq> delivered_through_;
+  uint64_t shared_deliveries_ = 0;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,230 @@
+#include "logging.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "spsc_ring.h"
+
+namespace blocktopus {
+namespace internal {
+
+LogRecord& LogRecord::operator=(LogRecord&& other) {
+  if (this == &other) return *this;
+  Reset();
+  level_ = other.level_;
+  time_ = other.time_;
+  format_ = other.format_;
+  if (other.ops_ != nullptr) {
+    other.ops_->move(other.storage_, storage_);
+    ops_ = other.ops_;
+    other.Reset();
+  }
+  return *this;
+}
+
+void LogRecord::Reset() {
+  if (ops_ != nullptr) {
+    ops_->destroy(storage_);
+    ops_ = nullptr;
+  }
+}
+
+void LogRecord::FormatTo(std::string* out) const {
+  if (ops_ == nullptr) return;
+  try {
+    ops_->format(format_, storage_, out);
+  } catch (const std::runtime_error& e) {  // e.g. fmt::format_error
+    out->append(fmt::format("<bad log format \"{}\": {}>", format_, e.what()));
+  }
+}
+
+namespace {
+
+constexpr size_t kRingCapacity = 1024;
+
+/// How long the writer sleeps when it finds nothing to write.  Producers
+/// never signal it, since that would cost them a syscall.
+constexpr std::chrono::milliseconds kWriterIdlePeriod{5};
+
+const char* LevelName(LogLevel level) {
+  switch (level) {
+    case LogLevel::kDebug: return "DEBUG";
+    case LogLevel::kInfo: return "INFO";
+    case LogLevel::kWarning: return "WARNING";
+    case LogLevel::kError: return "ERROR";
+  }
+  return "?";
+}
+
+struct ThreadRing {
+  explicit ThreadRing(int id_in) : id(id_in), ring(kRingCapacity) {}
+
+  const int id;  // A small number identifying the logging thread.
+  SpscRing<LogRecord> ring;
+  std::atomic<bool> retired = false;  // The owning thread has exited.
+};
+
+class Logger final {
+ public:
+  static Logger& Get() {
+    // Deliberately leaked:  threads may log during static destruction.
+    static Logger* const instance = new Logger();
+    return *instance;
+  }
+
+  std::shared_ptr<ThreadRing> Register() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = std::make_shared<ThreadRing>(next_thread_id_++);
+    rings_.push_back(result);
+    return result;
+  }
+
+  void Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const uint64_t ticket = ++flush_requested_;
+    flush_requested_cv_.notify_one();
+    flush_completed_cv_.wait(lock, [&]() {
+      return flush_completed_ >= ticket;
+    });
+  }
+
+  std::atomic<std::FILE*> sink{stderr};
+  std::atomic<int> min_level{static_cast<int>(LogLevel::kInfo)};
+  std::atomic<size_t> dropped{0};
+
+ private:
+  Logger() : writer_([this]() { WriterLoop(); }) {
+    writer_.detach();
+    // Don't lose the last lines of a program that exits normally.
+    std::atexit([]() { Get().Flush(); });
+  }
+
+  void WriterLoop() {
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    std::vector<std::pair<LogRecord, int>> batch;
+    std::string text;
+    while (true) {
+      uint64_t flush_target;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        flush_requested_cv_.wait_for(lock, kWriterIdlePeriod, [&]() {
+          return flush_requested_ > flush_completed_;
+        });
+        flush_target = flush_requested_;
+        // Any thread that retired before this point has nothing further to
+        // add after the drain below, so it may be forgotten.
+        std::erase_if(rings_, [](const std::shared_ptr<ThreadRing>& r) {
+          return r->retired && r->ring.empty();
+        });
+        rings = rings_;
+      }
+
+      for (const auto& thread_ring : rings) {
+        LogRecord record;
+        while (thread_ring->ring.TryPop(&record)) {
+          batch.emplace_back(std::move(record), thread_ring->id);
+        }
+      }
+      // Interleave the threads' lines in the order they were logged.
+      std::stable_sort(batch.begin(), batch.end(),
+                       [](const auto& a, const auto& b) {
+                         return a.first.time() < b.first.time();
+                       });
+      std::FILE* out = sink.load();
+      for (const auto& [record, thread_id] : batch) {
+        text.clear();
+        AppendPrefix(record, thread_id, &text);
+        record.FormatTo(&text);
+        text.push_back('\n');
+        std::fwrite(text.data(), 1, text.size(), out);
+      }
+      if (!batch.empty() || flush_target > flush_completed_) {
+        std::fflush(out);
+      }
+      batch.clear();
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (flush_target > flush_completed_) {
+        flush_completed_ = flush_target;
+        flush_completed_cv_.notify_all();
+      }
+    }
+  }
+
+  static void AppendPrefix(const LogRecord& record, int thread_id,
+                           std::string* out) {
+    const auto since_epoch = record.time().time_since_epoch();
+    const time_t seconds =
+      std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+    const auto micros =
+      std::chrono::duration_cast<std::chrono::microseconds>(since_epoch)
+      .count() % 1000000;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    out->append(fmt::format("[{} {:02}:{:02}:{:02}.{:06} t{}] ",
+                            LevelName(record.level()), local.tm_hour,
+                            local.tm_min, local.tm_sec, micros, thread_id));
+  }
+
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<ThreadRing>> rings_;
+  int next_thread_id_ = 0;
+  uint64_t flush_requested_ = 0;
+  uint64_t flush_completed_ = 0;
+  std::condition_variable flush_requested_cv_;
+  std::condition_variable flush_completed_cv_;
+  std::thread writer_;
+};
+
+/// Owns the calling thread's ring, and retires it when the thread exits.
+struct ThreadRingHandle {
+  ~ThreadRingHandle() {
+    if (ring != nullptr) ring->retired = true;
+  }
+  std::shared_ptr<ThreadRing> ring;
+};
+
+}  // namespace
+
+void Enqueue(LogRecord&& record) {
+  thread_local ThreadRingHandle handle;
+  if (handle.ring == nullptr) {
+    handle.ring = Logger::Get().Register();
+  }
+  if (!handle.ring->ring.TryPush(std::move(record))) {
+    Logger::Get().dropped++;
+  }
+}
+
+bool LevelEnabled(LogLevel level) {
+  return static_cast<int>(level) >= Logger::Get().min_level.load();
+}
+
+}  // namespace internal
+
+void SetLogSink(std::FILE* sink) {
+  internal::Logger::Get().sink = sink;
+}
+
+void SetMinLogLevel(LogLevel level) {
+  internal::Logger::Get().min_level = static_cast<int>(level);
+}
+
+void FlushLog() {
+  internal::Logger::Get().Flush();
+}
+
+size_t DroppedLogLines() {
+  return internal::Logger::Get().dropped.load();
+}
+
+}  // namespace blocktopus
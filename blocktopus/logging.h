@@ -0,0 +1,195 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "fmt/core.h"
+
+/// @file Asynchronous diagnostics logging.
+///
+/// Logging a line does no formatting and no I/O on the calling thread:  the
+/// format string and copies of the arguments are pushed into a lock-free
+/// ring owned by that thread, and a background writer thread formats and
+/// writes them.  This lets I/O and ordering threads log without ever
+/// blocking on a terminal or file.  If a thread's ring is full, the line is
+/// dropped and counted rather than waiting.
+///
+/// Format strings must be string literals (they are kept by reference until
+/// the writer formats them).  Arguments are copied; `const char*` and
+/// `std::string_view` arguments are copied into a `std::string`, since the
+/// memory they point at (e.g. the result of `strerror`) may not outlive the
+/// call.
+///
+/// > LogWarning("connection to {} reset ({} in flight)", peer, count);
+
+namespace blocktopus {
+
+enum class LogLevel : int {
+  kDebug = 0,
+  kInfo = 1,
+  kWarning = 2,
+  kError = 3,
+};
+
+namespace internal {
+
+/// Maps an argument type to the type in which it is stored until formatted.
+template <typename T>
+struct LogStored { using type = std::decay_t<T>; };
+template <>
+struct LogStored<const char*> { using type = std::string; };
+template <>
+struct LogStored<char*> { using type = std::string; };
+template <>
+struct LogStored<std::string_view> { using type = std::string; };
+template <typename T>
+using LogStoredT = typename LogStored<std::decay_t<T>>::type;
+
+/// One not-yet-formatted log line.  The arguments live inline in `storage_`
+/// and are operated on through a small table of functions generated for
+/// their types.
+class LogRecord final {
+ public:
+  /// Arguments whose copies exceed this many bytes are formatted eagerly
+  /// instead.
+  static constexpr size_t kMaxArgBytes = 160;
+
+  LogRecord() = default;
+  ~LogRecord() { Reset(); }
+  LogRecord(const LogRecord&) = delete;
+  LogRecord& operator=(const LogRecord&) = delete;
+  LogRecord(LogRecord&& other) { *this = std::move(other); }
+  LogRecord& operator=(LogRecord&& other);
+
+  template <typename... Args>
+  static LogRecord Make(LogLevel level, std::string_view format,
+                        Args&&... args);
+
+  LogLevel level() const { return level_; }
+  std::chrono::system_clock::time_point time() const { return time_; }
+
+  /// Append the formatted message (without decoration) to @p out.
+  void FormatTo(std::string* out) const;
+
+ private:
+  struct Ops {
+    void (*format)(std::string_view, const void*, std::string*);
+    void (*move)(void* from, void* to);
+    void (*destroy)(void*);
+  };
+
+  template <typename Tuple>
+  static const Ops* OpsFor();
+
+  void Reset();
+
+  LogLevel level_ = LogLevel::kDebug;
+  std::chrono::system_clock::time_point time_;
+  std::string_view format_;
+  const Ops* ops_ = nullptr;
+  alignas(std::max_align_t) unsigned char storage_[kMaxArgBytes];
+};
+
+template <typename Tuple>
+const LogRecord::Ops* LogRecord::OpsFor() {
+  static constexpr Ops ops{
+    .format = [](std::string_view format, const void* args,
+                 std::string* out) {
+      std::apply([&](const auto&... unpacked) {
+        fmt::vformat_to(std::back_inserter(*out), format,
+                        fmt::make_format_args(unpacked...));
+      }, *static_cast<const Tuple*>(args));
+    },
+    .move = [](void* from, void* to) {
+      new (to) Tuple(std::move(*static_cast<Tuple*>(from)));
+    },
+    .destroy = [](void* args) { static_cast<Tuple*>(args)->~Tuple(); },
+  };
+  return &ops;
+}
+
+template <typename... Args>
+LogRecord LogRecord::Make(LogLevel level, std::string_view format,
+                          Args&&... args) {
+  using Tuple = std::tuple<LogStoredT<Args>...>;
+  LogRecord result;
+  result.level_ = level;
+  result.time_ = std::chrono::system_clock::now();
+  if constexpr (sizeof(Tuple) <= kMaxArgBytes &&
+                alignof(Tuple) <= alignof(std::max_align_t)) {
+    result.format_ = format;
+    new (result.storage_) Tuple(std::forward<Args>(args)...);
+    result.ops_ = OpsFor<Tuple>();
+  } else {
+    // Too big to defer; pay for formatting now rather than fail.
+    using Eager = std::tuple<std::string>;
+    result.format_ = "{}";
+    new (result.storage_) Eager(fmt::vformat(
+        format, fmt::make_format_args(args...)));
+    result.ops_ = OpsFor<Eager>();
+  }
+  return result;
+}
+
+/// Hand @p record to the calling thread's ring (or drop it if that ring is
+/// full).
+void Enqueue(LogRecord&& record);
+
+/// @return whether lines at @p level are currently being logged at all.
+bool LevelEnabled(LogLevel level);
+
+}  // namespace internal
+
+/// Set the stream that the writer thread writes to (default `stderr`).
+/// The stream is not closed by the logger.
+void SetLogSink(std::FILE* sink);
+
+/// Discard lines below @p level (default `LogLevel::kInfo`).
+void SetMinLogLevel(LogLevel level);
+
+/// (BLOCKING) Wait until every line logged before this call (by any thread)
+/// has been written and the sink flushed.  Not for use on hot paths.
+void FlushLog();
+
+/// @return the number of lines dropped because their thread's ring was full.
+size_t DroppedLogLines();
+
+template <typename... Args>
+void Log(LogLevel level, fmt::format_string<Args...> format,
+         Args&&... args) {
+  if (!internal::LevelEnabled(level)) return;
+  const fmt::string_view view = format;
+  internal::Enqueue(internal::LogRecord::Make(
+      level, std::string_view(view.data(), view.size()),
+      std::forward<Args>(args)...));
+}
+
+template <typename... Args>
+void LogDebug(fmt::format_string<Args...> format, Args&&... args) {
+  Log(LogLevel::kDebug, format, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void LogInfo(fmt::format_string<Args...> format, Args&&... args) {
+  Log(LogLevel::kInfo, format, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void LogWarning(fmt::format_string<Args...> format, Args&&... args) {
+  Log(LogLevel::kWarning, format, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void LogError(fmt::format_string<Args...> format, Args&&... args) {
+  Log(LogLevel::kError, format, std::forward<Args>(args)...);
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,489 @@
+#include "message_log.h"
+
+#include "fmt/core.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <stdexcept>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+constexpr char kColumnarMagic[4] = {'B', 'T', 'C', 'L'};
+constexpr uint8_t kColumnarVersion = 1;
+// Magic, version, record count, then an (offset, size) pair per column.
+constexpr size_t kDirectorySize =
+    sizeof(kColumnarMagic) + 1 + 8 + kNumLogColumns * 16;
+
+/// Column bytes are buffered in memory up to this size, then spilled.
+constexpr size_t kSpillThreshold = 1 << 20;
+
+/// @brief One column of a columnar log under construction.
+///
+/// Bytes accumulate in `buffer()`; once there are more than
+/// `kSpillThreshold` of them they are appended to a scratch file beside the
+/// output, so that memory use does not grow with the log.
+class ColumnSpill final {
+ public:
+  explicit ColumnSpill(std::string path) : path_(std::move(path)) {}
+  ~ColumnSpill() {
+    if (file_.is_open()) {
+      file_.close();
+      std::remove(path_.c_str());
+    }
+  }
+
+  std::vector<uint8_t>* buffer() { return &buffer_; }
+
+  /// Spill the buffer if it has grown past the threshold.
+  void MaybeSpill() {
+    if (buffer_.size() < kSpillThreshold) return;
+    if (!file_.is_open()) {
+      file_.open(path_, std::ios::binary | std::ios::in | std::ios::out |
+                            std::ios::trunc);
+      if (!file_) {
+        throw std::runtime_error(
+            fmt::format("Could not open scratch file {}", path_));
+      }
+    }
+    Write(buffer_);
+  }
+
+  uint64_t size() const { return spilled_ + buffer_.size(); }
+
+  /// Append the whole column to @p out.
+  void CopyTo(std::ofstream* out) {
+    if (file_.is_open()) {
+      file_.seekg(0);
+      std::vector<char> chunk(kSpillThreshold);
+      for (uint64_t left = spilled_; left > 0;) {
+        const size_t n = std::min<uint64_t>(left, chunk.size());
+        if (!file_.read(chunk.data(), n)) {
+          throw std::runtime_error(
+              fmt::format("Could not read scratch file {}", path_));
+        }
+        out->write(chunk.data(), n);
+        left -= n;
+      }
+    }
+    out->write(reinterpret_cast<const char*>(buffer_.data()), buffer_.size());
+  }
+
+ private:
+  void Write(std::vector<uint8_t>& bytes) {
+    file_.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    if (!file_) {
+      throw std::runtime_error(
+          fmt::format("Could not write scratch file {}", path_));
+    }
+    spilled_ += bytes.size();
+    bytes.clear();
+  }
+
+  const std::string path_;
+  std::fstream file_;
+  std::vector<uint8_t> buffer_;
+  uint64_t spilled_ = 0;
+};
+
+/// @brief Dictionary-encodes a column one value at a time.
+///
+/// The dictionary (in first-appearance order, so that the output is
+/// deterministic) is kept in memory and written ahead of the indices, which
+/// are spilled as they are produced.
+template <typename T>
+class DictionaryColumn final {
+ public:
+  explicit DictionaryColumn(std::string spill_path)
+      : indices_(std::move(spill_path)) {}
+
+  void Add(const T& value) {
+    auto [it, inserted] = index_of_.emplace(value, dictionary_.size());
+    if (inserted) dictionary_.push_back(&it->first);
+    PutVarint(it->second, indices_.buffer());
+    indices_.MaybeSpill();
+  }
+
+  /// Encode the dictionary with @p put_value; call once, after every `Add`.
+  template <typename PutValue>
+  void Finish(PutValue put_value) {
+    PutVarint(dictionary_.size(), &encoded_dictionary_);
+    for (const T* entry : dictionary_) put_value(*entry, &encoded_dictionary_);
+  }
+
+  uint64_t size() const { return encoded_dictionary_.size() + indices_.size(); }
+
+  void CopyTo(std::ofstream* out) {
+    out->write(reinterpret_cast<const char*>(encoded_dictionary_.data()),
+               encoded_dictionary_.size());
+    indices_.CopyTo(out);
+  }
+
+ private:
+  std::map<T, uint64_t> index_of_;
+  std::vector<const T*> dictionary_;
+  std::vector<uint8_t> encoded_dictionary_;
+  ColumnSpill indices_;
+};
+
+/// @brief Builds a columnar log one message at a time.
+class ColumnarLogBuilder final {
+ public:
+  explicit ColumnarLogBuilder(const std::string& path)
+      : path_(path),
+        senders_(path + ".sender"),
+        channels_(path + ".channel"),
+        send_seqs_(path + ".send_seq"),
+        receive_seqs_(path + ".receive_seq"),
+        payload_sizes_(path + ".payload_size"),
+        payloads_(path + ".payload") {}
+
+  void Add(const Message& message) {
+    senders_.Add(message.sender);
+    channels_.Add(message.channel);
+    PutZigzag(message.send_seq - previous_send_seq_, send_seqs_.buffer());
+    PutZigzag(message.receive_seq - previous_receive_seq_,
+              receive_seqs_.buffer());
+    previous_send_seq_ = message.send_seq;
+    previous_receive_seq_ = message.receive_seq;
+    PutVarint(message.payload.size(), payload_sizes_.buffer());
+    payloads_.buffer()->insert(payloads_.buffer()->end(),
+                               message.payload.begin(), message.payload.end());
+    send_seqs_.MaybeSpill();
+    receive_seqs_.MaybeSpill();
+    payload_sizes_.MaybeSpill();
+    payloads_.MaybeSpill();
+    ++num_records_;
+  }
+
+  void Finish() {
+    senders_.Finish(PutVarint);
+    channels_.Finish(PutString);
+    const std::array<uint64_t, kNumLogColumns> sizes = {
+        senders_.size(),        channels_.size(),      send_seqs_.size(),
+        receive_seqs_.size(),   payload_sizes_.size(), payloads_.size()};
+
+    std::vector<uint8_t> directory(std::begin(kColumnarMagic),
+                                   std::end(kColumnarMagic));
+    directory.push_back(kColumnarVersion);
+    PutFixed64(num_records_, &directory);
+    uint64_t offset = kDirectorySize;
+    for (uint64_t size : sizes) {
+      PutFixed64(offset, &directory);
+      PutFixed64(size, &directory);
+      offset += size;
+    }
+
+    std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error(fmt::format("Could not open log {}", path_));
+    }
+    out.write(reinterpret_cast<const char*>(directory.data()),
+              directory.size());
+    senders_.CopyTo(&out);
+    channels_.CopyTo(&out);
+    send_seqs_.CopyTo(&out);
+    receive_seqs_.CopyTo(&out);
+    payload_sizes_.CopyTo(&out);
+    payloads_.CopyTo(&out);
+    if (!out) {
+      throw std::runtime_error(fmt::format("Could not write log {}", path_));
+    }
+  }
+
+ private:
+  const std::string path_;
+  DictionaryColumn<ClientId> senders_;
+  DictionaryColumn<std::string> channels_;
+  ColumnSpill send_seqs_;
+  ColumnSpill receive_seqs_;
+  ColumnSpill payload_sizes_;
+  ColumnSpill payloads_;
+  Seq previous_send_seq_ = 0;
+  Seq previous_receive_seq_ = 0;
+  uint64_t num_records_ = 0;
+};
+
+/// @brief Call @p visit on each message of the row log at @p path, reading
+/// one record at a time.
+template <typename Visit>
+void ForEachLoggedMessage(const std::string& path, Visit visit) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error(fmt::format("Could not open log {}", path));
+  }
+  in.seekg(0, std::ios::end);
+  const uint64_t file_size = in.tellg();
+  in.seekg(0);
+  std::vector<uint8_t> record;
+  for (uint64_t position = 0; position < file_size;) {
+    uint64_t record_size = 0;
+    for (int shift = 0;; shift += 7) {
+      const int byte = in.get();
+      if (byte == EOF || shift > 63) {
+        throw std::runtime_error(fmt::format("Truncated log {}", path));
+      }
+      ++position;
+      record_size |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) break;
+    }
+    // Check the size before allocating for it.
+    if (record_size > file_size - position) {
+      throw std::runtime_error(fmt::format("Truncated log {}", path));
+    }
+    record.resize(record_size);
+    if (!in.read(reinterpret_cast<char*>(record.data()), record.size())) {
+      throw std::runtime_error(fmt::format("Truncated log {}", path));
+    }
+    position += record_size;
+    ByteReader record_reader(record);
+    std::optional<Message> message = DeserializeMessage(&record_reader);
+    if (!message.has_value()) {
+      throw std::runtime_error(fmt::format("Corrupt record in log {}", path));
+    }
+    visit(std::move(*message));
+  }
+}
+
+template <typename T, typename GetValue>
+std::vector<T> GetDictionaryColumn(std::span<const uint8_t> data,
+                                   size_t num_records,
+                                   GetValue get_value) {
+  ByteReader reader(data);
+  uint64_t dictionary_size;
+  if (!reader.GetVarint(&dictionary_size)) {
+    throw std::runtime_error("Corrupt dictionary column");
+  }
+  // Every entry takes at least a byte.
+  if (dictionary_size > reader.remaining()) {
+    throw std::runtime_error("Corrupt dictionary column");
+  }
+  std::vector<T> dictionary(dictionary_size);
+  for (T& entry : dictionary) {
+    if (!get_value(&reader, &entry)) {
+      throw std::runtime_error("Corrupt dictionary column");
+    }
+  }
+  std::vector<T> result;
+  result.reserve(num_records);
+  for (size_t i = 0; i < num_records; ++i) {
+    uint64_t index;
+    if (!reader.GetVarint(&index) || index >= dictionary.size()) {
+      throw std::runtime_error("Corrupt dictionary column");
+    }
+    result.push_back(dictionary[index]);
+  }
+  return result;
+}
+
+std::vector<Seq> GetDeltaColumn(std::span<const uint8_t> data,
+                                size_t num_records) {
+  ByteReader reader(data);
+  std::vector<Seq> result;
+  result.reserve(num_records);
+  Seq previous = 0;
+  for (size_t i = 0; i < num_records; ++i) {
+    int64_t delta;
+    if (!reader.GetZigzag(&delta)) {
+      throw std::runtime_error("Corrupt sequence column");
+    }
+    previous += delta;
+    result.push_back(previous);
+  }
+  return result;
+}
+
+}  // namespace
+
+MessageLogWriter::MessageLogWriter(const std::string& path)
+    : path_(path), out_(path, std::ios::binary | std::ios::trunc) {
+  if (!out_) {
+    throw std::runtime_error(fmt::format("Could not open log {}", path));
+  }
+}
+
+void MessageLogWriter::Append(const Message& message) {
+  scratch_.clear();
+  SerializeMessage(message, &scratch_);
+  std::vector<uint8_t> prefix;
+  PutVarint(scratch_.size(), &prefix);
+  out_.write(reinterpret_cast<const char*>(prefix.data()), prefix.size());
+  out_.write(reinterpret_cast<const char*>(scratch_.data()), scratch_.size());
+  CheckWritten();
+}
+
+void MessageLogWriter::Flush() {
+  out_.flush();
+  CheckWritten();
+}
+
+void MessageLogWriter::CheckWritten() {
+  if (!out_.good()) {
+    throw std::runtime_error(fmt::format("Could not write log {}", path_));
+  }
+}
+
+std::vector<Message> ReadMessageLog(const std::string& path) {
+  std::vector<Message> result;
+  ForEachLoggedMessage(path, [&](Message&& message) {
+    result.push_back(std::move(message));
+  });
+  return result;
+}
+
+void WriteColumnarLog(const std::vector<Message>& messages,
+                      const std::string& path) {
+  ColumnarLogBuilder builder(path);
+  for (const Message& message : messages) builder.Add(message);
+  builder.Finish();
+}
+
+void CompactLog(const std::string& row_log_path,
+                const std::string& columnar_log_path) {
+  ColumnarLogBuilder builder(columnar_log_path);
+  ForEachLoggedMessage(row_log_path,
+                       [&](Message&& message) { builder.Add(message); });
+  builder.Finish();
+}
+
+ColumnarLogReader::ColumnarLogReader(const std::string& path)
+    : path_(path), in_(path, std::ios::binary) {
+  if (!in_) {
+    throw std::runtime_error(fmt::format("Could not open log {}", path));
+  }
+  std::vector<uint8_t> directory(kDirectorySize);
+  in_.read(reinterpret_cast<char*>(directory.data()), directory.size());
+  bytes_read_ += in_.gcount();
+  if (!in_ ||
+      !std::equal(std::begin(kColumnarMagic), std::end(kColumnarMagic),
+                  directory.begin()) ||
+      directory[sizeof(kColumnarMagic)] != kColumnarVersion) {
+    throw std::runtime_error(
+        fmt::format("{} is not a columnar log (or is a newer version)", path));
+  }
+  ByteReader reader(
+      std::span<const uint8_t>(directory).subspan(sizeof(kColumnarMagic) + 1));
+  uint64_t num_records;
+  reader.GetFixed64(&num_records);
+  num_records_ = num_records;
+  // Check every size against the file before anything is allocated for it.
+  in_.seekg(0, std::ios::end);
+  const uint64_t file_size = in_.tellg();
+  for (ColumnExtent& extent : columns_) {
+    reader.GetFixed64(&extent.offset);
+    reader.GetFixed64(&extent.size);
+    if (extent.offset > file_size || extent.size > file_size - extent.offset) {
+      throw std::runtime_error(
+          fmt::format("Column extends past the end of log {}", path));
+    }
+  }
+  // Every record takes at least a byte in each column but the payloads.
+  for (int column = 0; column < static_cast<int>(LogColumn::kPayload);
+       ++column) {
+    if (num_records_ > columns_[column].size) {
+      throw std::runtime_error(
+          fmt::format("Record count too large for log {}", path));
+    }
+  }
+}
+
+std::vector<uint8_t> ColumnarLogReader::ReadColumn(LogColumn column) {
+  const ColumnExtent& extent = columns_[static_cast<int>(column)];
+  std::vector<uint8_t> result(extent.size);
+  in_.seekg(extent.offset);
+  in_.read(reinterpret_cast<char*>(result.data()), result.size());
+  bytes_read_ += in_.gcount();
+  if (!in_) {
+    throw std::runtime_error(fmt::format(
+        "Truncated column {} in log {}", static_cast<int>(column), path_));
+  }
+  return result;
+}
+
+std::vector<ClientId> ColumnarLogReader::ReadSenders() {
+  return GetDictionaryColumn<ClientId>(
+      ReadColumn(LogColumn::kSender), num_records_,
+      [](ByteReader* reader, ClientId* value) {
+        uint64_t raw;
+        if (!reader->GetVarint(&raw)) return false;
+        *value = static_cast<ClientId>(raw);
+        return true;
+      });
+}
+
+std::vector<std::string> ColumnarLogReader::ReadChannels() {
+  return GetDictionaryColumn<std::string>(
+      ReadColumn(LogColumn::kChannel), num_records_,
+      [](ByteReader* reader, std::string* value) {
+        return reader->GetString(value);
+      });
+}
+
+std::vector<Seq> ColumnarLogReader::ReadSendSeqs() {
+  return GetDeltaColumn(ReadColumn(LogColumn::kSendSeq), num_records_);
+}
+
+std::vector<Seq> ColumnarLogReader::ReadReceiveSeqs() {
+  return GetDeltaColumn(ReadColumn(LogColumn::kReceiveSeq), num_records_);
+}
+
+std::vector<size_t> ColumnarLogReader::ReadPayloadSizes() {
+  const std::vector<uint8_t> data = ReadColumn(LogColumn::kPayloadSize);
+  ByteReader reader(data);
+  std::vector<size_t> result;
+  result.reserve(num_records_);
+  for (size_t i = 0; i < num_records_; ++i) {
+    uint64_t size;
+    if (!reader.GetVarint(&size)) {
+      throw std::runtime_error("Corrupt payload size column");
+    }
+    result.push_back(size);
+  }
+  return result;
+}
+
+std::vector<MessageHeader> ColumnarLogReader::ReadHeaders() {
+  std::vector<ClientId> senders = ReadSenders();
+  std::vector<std::string> channels = ReadChannels();
+  std::vector<Seq> send_seqs = ReadSendSeqs();
+  std::vector<Seq> receive_seqs = ReadReceiveSeqs();
+  std::vector<size_t> payload_sizes = ReadPayloadSizes();
+  std::vector<MessageHeader> result(num_records_);
+  for (size_t i = 0; i < num_records_; ++i) {
+    result[i].sender = senders[i];
+    result[i].channel = std::move(channels[i]);
+    result[i].send_seq = send_seqs[i];
+    result[i].receive_seq = receive_seqs[i];
+    result[i].payload_size = payload_sizes[i];
+  }
+  return result;
+}
+
+std::vector<Message> ColumnarLogReader::ReadMessages() {
+  std::vector<MessageHeader> headers = ReadHeaders();
+  const std::vector<uint8_t> payloads = ReadColumn(LogColumn::kPayload);
+  std::vector<Message> result(num_records_);
+  size_t offset = 0;
+  for (size_t i = 0; i < num_records_; ++i) {
+    if (headers[i].payload_size > payloads.size() - offset) {
+      throw std::runtime_error("Payload column shorter than its sizes");
+    }
+    result[i].sender = headers[i].sender;
+    result[i].channel = std::move(headers[i].channel);
+    result[i].send_seq = headers[i].send_seq;
+    result[i].receive_seq = headers[i].receive_seq;
+    result[i].payload.assign(
+        payloads.begin() + offset,
+        payloads.begin() + offset + headers[i].payload_size);
+    offset += headers[i].payload_size;
+  }
+  return result;
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+/// @file Recording of message traffic, and compaction of those recordings.
+///
+/// There are two on-disk formats:
+///
+/// * The *row log* is what a running system appends to:  one length-prefixed
+///   serialized `Message` per record.  It is cheap to write and useless to
+///   analyze at scale.
+/// * The *columnar log* is what `CompactLog` rewrites a row log into.  Each
+///   message field is stored in its own column, so a reader that only wants
+///   (say) sequence numbers never touches payload bytes:
+///   * senders and channels are dictionary-encoded,
+///   * send and receive sequence numbers are delta-encoded as zigzag varints,
+///   * payload sizes are varints, and
+///   * payloads are concatenated raw at the end of the file.
+///
+/// Neither format is meant for interchange with other programs; both may
+/// change without notice.
+
+namespace blocktopus {
+
+/// Appends messages to a row log.
+class MessageLogWriter final {
+ public:
+  /// Opens (truncating) @p path; throws if that fails.
+  explicit MessageLogWriter(const std::string& path);
+
+  /// Both throw if writing fails (e.g. the disk is full).  Records are
+  /// buffered, so a failure may surface only at a later call.
+  void Append(const Message& message);
+  void Flush();
+
+ private:
+  void CheckWritten();
+
+  const std::string path_;
+  std::ofstream out_;
+  std::vector<uint8_t> scratch_;
+};
+
+/// (BLOCKING) Read every message in the row log at @p path.
+/// Throws if the file is missing or corrupt.
+std::vector<Message> ReadMessageLog(const std::string& path);
+
+/// The columns of a columnar log, in file order.
+enum class LogColumn : int {
+  kSender = 0,
+  kChannel = 1,
+  kSendSeq = 2,
+  kReceiveSeq = 3,
+  kPayloadSize = 4,
+  kPayload = 5,
+};
+constexpr size_t kNumLogColumns = 6;
+
+/// (BLOCKING) Write @p messages to @p path as a columnar log.
+void WriteColumnarLog(const std::vector<Message>& messages,
+                      const std::string& path);
+
+/// (BLOCKING) Rewrite the row log at @p row_log_path into a columnar log at
+/// @p columnar_log_path.
+void CompactLog(const std::string& row_log_path,
+                const std::string& columnar_log_path);
+
+/// Reads a columnar log one column at a time.
+///
+/// Construction reads only the fixed-size column directory; each `Read`
+/// method then reads exactly the columns it needs.
+class ColumnarLogReader final {
+ public:
+  /// Opens @p path and reads its column directory; throws if that fails.
+  explicit ColumnarLogReader(const std::string& path);
+
+  /// @return the number of messages in the log.
+  size_t size() const { return num_records_; }
+
+  std::vector<ClientId> ReadSenders();
+  std::vector<std::string> ReadChannels();
+  std::vector<Seq> ReadSendSeqs();
+  std::vector<Seq> ReadReceiveSeqs();
+  std::vector<size_t> ReadPayloadSizes();
+
+  /// Every field but the payloads; does not read the payload column.
+  std::vector<MessageHeader> ReadHeaders();
+
+  /// Every field, payloads included.
+  std::vector<Message> ReadMessages();
+
+  /// @return the total number of file bytes read so far, including the
+  /// directory.
+  size_t bytes_read() const { return bytes_read_; }
+
+ private:
+  struct ColumnExtent {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+  };
+
+  std::vector<uint8_t> ReadColumn(LogColumn column);
+
+  std::string path_;
+  std::ifstream in_;
+  size_t num_records_ = 0;
+  std::array<ColumnExtent, kNumLogColumns> columns_;
+  size_t bytes_read_ = 0;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,340 @@
+#include "multicast_channel.h"
+
+#include "fmt/core.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+enum PacketKind : uint8_t {
+  kData = 0,
+  kHeartbeat = 1,
+};
+
+constexpr size_t kPacketHeaderSize = 1 + 2 * sizeof(uint64_t);
+constexpr size_t kMaxUdpPayload = 65507;
+
+/// @brief Throw, describing @p what and `errno`.
+[[noreturn]] void ThrowErrno(const std::string& what, int error) {
+  throw std::runtime_error(
+    fmt::format("ERROR[{} => {}]: {}", what, error, strerror(error)));
+}
+
+in_addr ParseAddress(const std::string& addr) {
+  in_addr result;
+  if (inet_pton(AF_INET, addr.c_str(), &result) != 1) {
+    throw std::runtime_error(
+        fmt::format("ERROR[inet_pton]: bad IPv4 address \"{}\"", addr));
+  }
+  return result;
+}
+
+// Call @p visit on each payload of the data packet body @p body.
+// @return false if @p body is malformed.
+template <typename Visitor>
+bool ForEachPayload(std::span<const uint8_t> body, Visitor&& visit) {
+  ByteReader reader(body);
+  while (!reader.done()) {
+    uint64_t size;
+    std::span<const uint8_t> payload;
+    if (!reader.GetVarint(&size) || !reader.GetBytes(size, &payload)) {
+      return false;
+    }
+    visit(payload);
+  }
+  return true;
+}
+
+}  // namespace
+
+uint64_t MulticastStreamId(std::string_view channel, uint64_t epoch) {
+  // FNV-1a, which every build of either end computes alike.
+  uint64_t h = 0xcbf29ce484222325ULL;
+  const auto mix = [&h](uint8_t byte) {
+    h ^= byte;
+    h *= 0x100000001b3ULL;
+  };
+  for (const char c : channel) mix(static_cast<uint8_t>(c));
+  for (int shift = 0; shift < 64; shift += 8) mix(epoch >> shift);
+  return h;
+}
+
+void SerializeMulticastNack(const MulticastNack& nack,
+                            std::vector<uint8_t>* out) {
+  PutVarint(nack.first, out);
+  PutVarint(nack.last, out);
+}
+
+std::optional<MulticastNack> ParseMulticastNack(
+    std::span<const uint8_t> data) {
+  ByteReader reader(data);
+  MulticastNack nack;
+  if (!reader.GetVarint(&nack.first) || !reader.GetVarint(&nack.last) ||
+      !reader.done() || nack.first > nack.last) {
+    return std::nullopt;
+  }
+  return nack;
+}
+
+MulticastSender::MulticastSender(const Config& config) : config_(config) {
+  const in_addr interface = ParseAddress(config_.interface_addr);
+  ParseAddress(config_.group_addr);
+  sock_fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock_fd_ < 0) ThrowErrno("socket", errno);
+  const unsigned char ttl = config_.ttl;
+  const unsigned char loop = 1;
+  if (setsockopt(sock_fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                 sizeof(ttl)) < 0 ||
+      setsockopt(sock_fd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+                 sizeof(loop)) < 0 ||
+      setsockopt(sock_fd_, IPPROTO_IP, IP_MULTICAST_IF, &interface,
+                 sizeof(interface)) < 0) {
+    const int error = errno;
+    close(sock_fd_);
+    ThrowErrno("setsockopt(IP_MULTICAST_*)", error);
+  }
+}
+
+MulticastSender::MulticastSender(MulticastSender&& other)
+    : config_(other.config_),
+      sock_fd_(std::exchange(other.sock_fd_, -1)),
+      packet_(std::move(other.packet_)),
+      next_packet_(other.next_packet_),
+      retained_(std::move(other.retained_)) {}
+
+MulticastSender::~MulticastSender() {
+  if (sock_fd_ >= 0) close(sock_fd_);
+}
+
+Status MulticastSender::Send(std::span<const uint8_t> payload) {
+  std::vector<uint8_t> prefix;
+  PutVarint(payload.size(), &prefix);
+  const size_t size = prefix.size() + payload.size();
+  if (kPacketHeaderSize + size >
+      std::min(config_.max_packet_size, kMaxUdpPayload)) {
+    return Status(StatusCode::kProtocolError,
+                  "MulticastSender[payload too large]");
+  }
+  if (packet_.size() + size > config_.max_packet_size) {
+    Status status = Flush();
+    if (!status) return status;
+  }
+  if (packet_.empty()) {
+    packet_.push_back(kData);
+    PutFixed64(config_.stream_id, &packet_);
+    PutFixed64(next_packet_, &packet_);
+  }
+  packet_.insert(packet_.end(), prefix.begin(), prefix.end());
+  packet_.insert(packet_.end(), payload.begin(), payload.end());
+  return Status::Ok();
+}
+
+Status MulticastSender::Flush() {
+  if (packet_.empty()) return Status::Ok();
+  retained_.push_back(std::exchange(packet_, {}));
+  if (retained_.size() > config_.retained_packets) retained_.pop_front();
+  ++next_packet_;
+  // Sent or not, the packet is retained, and can be repaired.
+  return SendPacket(retained_.back());
+}
+
+Status MulticastSender::Heartbeat() {
+  std::vector<uint8_t> heartbeat{kHeartbeat};
+  PutFixed64(config_.stream_id, &heartbeat);
+  PutFixed64(next_packet_, &heartbeat);
+  return SendPacket(heartbeat);
+}
+
+Status MulticastSender::SendPacket(std::span<const uint8_t> packet) {
+  sockaddr_in group{};
+  group.sin_family = AF_INET;
+  group.sin_port = htons(config_.port);
+  group.sin_addr = ParseAddress(config_.group_addr);
+  while (sendto(sock_fd_, packet.data(), packet.size(), 0,
+                reinterpret_cast<const sockaddr*>(&group),
+                sizeof(group)) < 0) {
+    if (errno == EINTR) continue;
+    // A full queue is just loss, which receivers repair.
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) break;
+    return Status::FromErrno("MulticastSender::sendto", errno);
+  }
+  return Status::Ok();
+}
+
+Status MulticastSender::Repair(
+    const MulticastNack& nack,
+    std::vector<std::vector<uint8_t>>* packets) const {
+  const uint64_t oldest = first_retained();
+  if (nack.first > nack.last || nack.first < oldest ||
+      nack.last >= next_packet_) {
+    return Status(StatusCode::kProtocolError,
+                  "MulticastSender[not retained]");
+  }
+  for (uint64_t number = nack.first; number <= nack.last; ++number) {
+    packets->push_back(retained_[number - oldest]);
+  }
+  return Status::Ok();
+}
+
+MulticastReceiver::MulticastReceiver(const Config& config)
+    : config_(config), receive_buffer_(kMaxUdpPayload) {
+  ip_mreq membership{};
+  membership.imr_multiaddr = ParseAddress(config_.group_addr);
+  membership.imr_interface = ParseAddress(config_.interface_addr);
+  sock_fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock_fd_ < 0) ThrowErrno("socket", errno);
+  const int one = 1;
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(config_.port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t address_size = sizeof(address);
+  if (setsockopt(sock_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+      bind(sock_fd_, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) < 0 ||
+      getsockname(sock_fd_, reinterpret_cast<sockaddr*>(&address),
+                  &address_size) < 0 ||
+      setsockopt(sock_fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+                 sizeof(membership)) < 0) {
+    const int error = errno;
+    close(sock_fd_);
+    ThrowErrno("MulticastReceiver setup (" + config_.group_addr + ")",
+               error);
+  }
+  port_ = ntohs(address.sin_port);
+}
+
+MulticastReceiver::MulticastReceiver(MulticastReceiver&& other)
+    : config_(other.config_),
+      sock_fd_(std::exchange(other.sock_fd_, -1)),
+      port_(other.port_),
+      next_packet_(other.next_packet_),
+      known_end_(other.known_end_),
+      nacked_through_(other.nacked_through_),
+      held_(std::move(other.held_)),
+      released_(std::move(other.released_)),
+      foreign_packets_(other.foreign_packets_),
+      receive_buffer_(std::move(other.receive_buffer_)) {}
+
+MulticastReceiver::~MulticastReceiver() {
+  if (sock_fd_ >= 0) close(sock_fd_);
+}
+
+Status MulticastReceiver::ProcessIO() {
+  Status result = Status::Ok();
+  while (true) {
+    const ssize_t size = recv(sock_fd_, receive_buffer_.data(),
+                              receive_buffer_.size(), 0);
+    if (size < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return Status::FromErrno("MulticastReceiver::recv", errno);
+    }
+    Status status = Accept(std::span<const uint8_t>(receive_buffer_.data(),
+                                                    size));
+    if (result && !status) result = status;
+  }
+  return result;
+}
+
+Status MulticastReceiver::OnRepair(std::span<const uint8_t> packet) {
+  return Accept(packet);
+}
+
+Status MulticastReceiver::Accept(std::span<const uint8_t> packet) {
+  ByteReader reader(packet);
+  std::span<const uint8_t> kind;
+  uint64_t stream;
+  uint64_t number;
+  if (!reader.GetBytes(1, &kind) || !reader.GetFixed64(&stream) ||
+      !reader.GetFixed64(&number) ||
+      (kind[0] != kData && kind[0] != kHeartbeat)) {
+    return Status(StatusCode::kProtocolError,
+                  "MulticastReceiver[malformed packet]");
+  }
+  if (stream != config_.stream_id) {
+    // Another channel on this group and port, or an earlier sender.
+    ++foreign_packets_;
+    return Status::Ok();
+  }
+  const auto body = packet.subspan(kPacketHeaderSize);
+  if (kind[0] == kHeartbeat) {
+    known_end_ = std::max(known_end_, number);
+    return Status::Ok();
+  }
+  if (!ForEachPayload(body, [](std::span<const uint8_t>) {})) {
+    return Status(StatusCode::kProtocolError,
+                  "MulticastReceiver[malformed packet]");
+  }
+  known_end_ = std::max(known_end_, number + 1);
+  if ((next_packet_ && number < *next_packet_) || held_.contains(number)) {
+    return Status::Ok();  // A duplicate, or skipped.
+  }
+  if (number != next_packet_ && held_.size() >= config_.max_held_packets) {
+    // Dropped; ask for it again.
+    nacked_through_ = std::min(nacked_through_, number);
+    return Status(StatusCode::kBackpressure,
+                  "MulticastReceiver[too many held packets]");
+  }
+  held_.emplace(number, std::vector<uint8_t>(body.begin(), body.end()));
+  Release();
+  return Status::Ok();
+}
+
+void MulticastReceiver::SkipTo(uint64_t first_packet) {
+  if (next_packet_ && *next_packet_ >= first_packet) return;
+  next_packet_ = first_packet;
+  // Whatever was asked for in vain is asked for again from here.
+  nacked_through_ = first_packet;
+  held_.erase(held_.begin(), held_.lower_bound(first_packet));
+  Release();
+}
+
+void MulticastReceiver::Release() {
+  if (!next_packet_) return;
+  for (auto it = held_.begin();
+       it != held_.end() && it->first == *next_packet_;
+       it = held_.erase(it)) {
+    ForEachPayload(it->second, [this](std::span<const uint8_t> payload) {
+      released_.emplace_back(payload.begin(), payload.end());
+    });
+    ++*next_packet_;
+  }
+  nacked_through_ = std::max(nacked_through_, *next_packet_);
+}
+
+std::vector<MulticastNack> MulticastReceiver::TakeNacks() {
+  std::vector<MulticastNack> nacks;
+  if (!next_packet_) return nacks;
+  uint64_t position = std::max(nacked_through_, *next_packet_);
+  for (auto it = held_.lower_bound(position); it != held_.end(); ++it) {
+    if (it->first > position) {
+      nacks.push_back({.first = position, .last = it->first - 1});
+    }
+    position = it->first + 1;
+  }
+  if (position < known_end_) {
+    nacks.push_back({.first = position, .last = known_end_ - 1});
+  }
+  nacked_through_ = std::max(nacked_through_, known_end_);
+  return nacks;
+}
+
+std::vector<std::vector<uint8_t>> MulticastReceiver::ReceiveAll() {
+  return std::exchange(released_, {});
+}
+
+}  // namespace blocktopus
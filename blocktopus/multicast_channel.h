@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "status.h"
+
+/// @file UDP multicast fan-out of a channel, with repair over TCP.
+///
+/// When dozens of subscribers on one LAN take the same high-rate channel,
+/// sending each its own copy over TCP multiplies the server's egress by the
+/// number of subscribers.  A `MulticastSender` instead batches the channel's
+/// payloads, in order, into numbered packets and multicasts each packet
+/// once.  Each subscriber's `MulticastReceiver` releases payloads strictly
+/// in packet order, and reports any gap in the numbering as a NACK, which
+/// the subscriber sends over its ordinary `Transport` connection.  The
+/// server answers it with `MulticastSender::Repair`, sending the retained
+/// packets back over the same connection, to be fed to
+/// `MulticastReceiver::OnRepair`.  The receiver thus sees exactly the
+/// payloads sent and in the same order, and the server's egress no longer
+/// grows with the subscriber count; only repairs do.
+///
+/// Which payloads a subscriber receives must not depend on when its first
+/// packet happened to arrive, so the server's reply to a subscription
+/// carries `MulticastSender::next_packet()`, and the receiver starts there
+/// by `MulticastReceiver::SkipTo`.  A subscriber that falls further behind
+/// than the sender retains cannot be repaired; the server's reply to such a
+/// NACK carries `MulticastSender::first_retained()` instead, and the
+/// receiver skips to that, losing the payloads in between (which it might
+/// recover some other way, e.g. from a latched value).
+///
+/// The sender should `Heartbeat` periodically, so that receivers notice the
+/// loss of the last packets before a lull.  Payloads too large for one
+/// packet belong on the unicast path.
+///
+/// Several channels, or a restarted server, may share a group and port, so
+/// every packet names its stream (see `MulticastStreamId`), and a receiver
+/// drops the packets of any stream but the one it was configured with.
+///
+/// A packet is a kind byte, a fixed64 stream id, a fixed64 packet number,
+/// and (for data packets) a sequence of varint-length-prefixed payloads.  A
+/// heartbeat's number is that of the next data packet.
+
+namespace blocktopus {
+
+/// @return the stream id of @p channel as multicast by the sender started
+/// at @p epoch (e.g. its start time), which is new at each restart.  The
+/// server's reply to a subscription carries it with `next_packet()`.
+uint64_t MulticastStreamId(std::string_view channel, uint64_t epoch);
+
+/// An inclusive range of packet numbers to be resent.
+struct MulticastNack {
+  uint64_t first;
+  uint64_t last;
+};
+
+/// Append the encoding of @p nack to @p out.
+void SerializeMulticastNack(const MulticastNack& nack,
+                            std::vector<uint8_t>* out);
+
+/// @return the NACK encoded in @p data, or `nullopt` if malformed.
+std::optional<MulticastNack> ParseMulticastNack(std::span<const uint8_t> data);
+
+class MulticastSender final {
+ public:
+  struct Config {
+    std::string group_addr = "239.255.42.1";
+    uint16_t port = 30304;
+    /// The address of the interface to send from.
+    std::string interface_addr = "127.0.0.1";
+    int ttl = 1;
+    /// The largest packet sent.
+    size_t max_packet_size = 1400;
+    /// How many recent packets are kept for repair.
+    size_t retained_packets = 4096;
+    /// The stream this sender's packets belong to.
+    uint64_t stream_id = 0;
+  };
+
+  /// Open the sending socket.  Throws if that fails.
+  explicit MulticastSender(const Config& config);
+  MulticastSender(MulticastSender&& other);
+  ~MulticastSender();
+
+  MulticastSender(const MulticastSender&) = delete;
+  MulticastSender& operator=(const MulticastSender&) = delete;
+
+  /// Add @p payload to the current packet, sending the packet first if it
+  /// would not fit.  Fails with `kProtocolError` if @p payload cannot fit
+  /// any packet.
+  Status Send(std::span<const uint8_t> payload);
+
+  /// Send the current packet, if it holds anything.  Call once per batch,
+  /// e.g. after routing each step's deliveries.
+  Status Flush();
+
+  /// Send a heartbeat announcing the next packet number.
+  Status Heartbeat();
+
+  /// Append the retained packets in @p nack to @p packets, for sending to
+  /// the subscriber that asked over its own connection.
+  ///
+  /// Fails with `kProtocolError` if any of them is no longer retained (or
+  /// was never sent); the subscriber must then skip to `first_retained()`.
+  Status Repair(const MulticastNack& nack,
+                std::vector<std::vector<uint8_t>>* packets) const;
+
+  /// @return the number of the next data packet.
+  uint64_t next_packet() const { return next_packet_; }
+
+  /// @return the number of the oldest packet still retained for repair.
+  uint64_t first_retained() const { return next_packet_ - retained_.size(); }
+
+ private:
+  Status SendPacket(std::span<const uint8_t> packet);
+
+  const Config config_;
+  int sock_fd_ = -1;
+  std::vector<uint8_t> packet_;
+  uint64_t next_packet_ = 0;
+  // The most recent packets, the first of which is numbered `next_packet_ -
+  // retained_.size()`.
+  std::deque<std::vector<uint8_t>> retained_;
+};
+
+class MulticastReceiver final {
+ public:
+  struct Config {
+    std::string group_addr = "239.255.42.1";
+    /// If zero, the OS picks one; see `port()`.
+    uint16_t port = 30304;
+    /// The address of the interface to receive on.
+    std::string interface_addr = "127.0.0.1";
+    /// The most out-of-order packets held while waiting for a gap to fill.
+    size_t max_held_packets = 4096;
+    /// The stream to receive; packets of others are dropped.
+    uint64_t stream_id = 0;
+  };
+
+  /// Open the socket and join the group.  Throws if that fails.
+  explicit MulticastReceiver(const Config& config);
+  MulticastReceiver(MulticastReceiver&& other);
+  ~MulticastReceiver();
+
+  MulticastReceiver(const MulticastReceiver&) = delete;
+  MulticastReceiver& operator=(const MulticastReceiver&) = delete;
+
+  /// Read every packet waiting on the socket.  Never blocks.
+  ///
+  /// @return OK, or `kProtocolError` if a packet was malformed (it is
+  /// discarded), or `kBackpressure` if so many packets are held behind a
+  /// gap that newer ones were dropped.
+  Status ProcessIO();
+
+  /// Accept a packet resent over the unicast connection.  As that
+  /// connection is reliable, a gap is reported by `TakeNacks` only once.
+  Status OnRepair(std::span<const uint8_t> packet);
+
+  /// Release payloads from packet @p first_packet onwards, discarding any
+  /// earlier ones not yet released.  Nothing is released before the first
+  /// call, which should pass the packet number in the server's reply to the
+  /// subscription; later calls resynchronize a receiver that the sender
+  /// can no longer repair (see `MulticastSender::first_retained`), after
+  /// which the packets still missing are reported again.  Never moves
+  /// backwards.
+  void SkipTo(uint64_t first_packet);
+
+  /// @return the gaps not reported before.  Packets before the first
+  /// `SkipTo` are never reported missing.
+  std::vector<MulticastNack> TakeNacks();
+
+  /// Take the payloads released so far, in order.
+  std::vector<std::vector<uint8_t>> ReceiveAll();
+
+  /// @return the port bound.
+  uint16_t port() const { return port_; }
+
+  /// @return the number of packets dropped as belonging to another stream.
+  uint64_t foreign_packets() const { return foreign_packets_; }
+
+ private:
+  Status Accept(std::span<const uint8_t> packet);
+
+  // Release the held packets that are next in order.
+  void Release();
+
+  const Config config_;
+  int sock_fd_ = -1;
+  uint16_t port_ = 0;
+  // Unset until the first `SkipTo`; until then packets are only held.
+  std::optional<uint64_t> next_packet_;
+  // The highest packet number known to exist, plus one.
+  uint64_t known_end_ = 0;
+  // Packets below this have been reported missing or received.
+  uint64_t nacked_through_ = 0;
+  std::map<uint64_t, std::vector<uint8_t>> held_;
+  std::vector<std::vector<uint8_t>> released_;
+  uint64_t foreign_packets_ = 0;
+  std::vector<uint8_t> receive_buffer_;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,81 @@
+#include "multiplexed_session.h"
+
+#include <limits>
+#include <utility>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+MultiplexedSession::MultiplexedSession(Transport&& transport,
+                                       const Config& config)
+    : config_(config), transport_(std::move(transport)) {}
+
+void MultiplexedSession::AppendFrame(ClientId client,
+                                     std::span<const uint8_t> frame,
+                                     std::vector<uint8_t>* out) {
+  PutVarint(client, out);
+  PutVarint(frame.size(), out);
+  out->insert(out->end(), frame.begin(), frame.end());
+}
+
+void MultiplexedSession::Send(ClientId client,
+                              std::span<const uint8_t> frame) {
+  ++frames_sent_;
+  if (frame.size() >= config_.max_batched_frame_bytes) {
+    // Keep order:  whatever was batched before this frame goes first.
+    Flush();
+    std::vector<uint8_t> alone;
+    AppendFrame(client, frame, &alone);
+    transport_.Send(std::move(alone));
+    ++datagrams_sent_;
+    return;
+  }
+  AppendFrame(client, frame, &batch_);
+  if (batch_.size() >= config_.max_batch_bytes) Flush();
+}
+
+void MultiplexedSession::Flush() {
+  if (batch_.empty()) return;
+  transport_.Send(std::exchange(batch_, {}));
+  ++datagrams_sent_;
+}
+
+Status MultiplexedSession::ProcessIO() {
+  Flush();
+  Status status = transport_.ProcessIO();
+  for (const auto& datagram : transport_.ReceiveAll()) {
+    ByteReader reader(std::span<const uint8_t>(datagram->data.data(),
+                                               datagram->payload_size));
+    while (!reader.done()) {
+      uint64_t client;
+      uint64_t size;
+      std::span<const uint8_t> frame;
+      if (!reader.GetVarint(&client) ||
+          client > std::numeric_limits<ClientId>::max() ||
+          !reader.GetVarint(&size) || !reader.GetBytes(size, &frame)) {
+        if (status) {
+          status = Status(StatusCode::kProtocolError,
+                          "MultiplexedSession[malformed datagram]");
+        }
+        break;
+      }
+      inbound_[static_cast<ClientId>(client)].emplace_back(frame.begin(),
+                                                           frame.end());
+    }
+  }
+  return status;
+}
+
+std::vector<std::vector<uint8_t>> MultiplexedSession::ReceiveAll(
+    ClientId client) {
+  std::vector<std::vector<uint8_t>> result;
+  auto it = inbound_.find(client);
+  if (it == inbound_.end()) return result;
+  result.assign(std::make_move_iterator(it->second.begin()),
+                std::make_move_iterator(it->second.end()));
+  inbound_.erase(it);
+  return result;
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <vector>
+
+#include "common.h"
+#include "status.h"
+#include "transport.h"
+
+/// @file Many logical clients over one `Transport`.
+///
+/// A process hosting many components would otherwise open one socket, and
+/// run one I/O loop, per component.  A `MultiplexedSession` lets them share
+/// a single connection:  each frame is tagged with the logical `ClientId`
+/// it belongs to, and small frames (the subscription, publication, and
+/// clear-to-advance control traffic that dominates by count) from all
+/// logical clients are coalesced into shared datagrams, so that one send
+/// system call carries many of them.  Large frames are sent in datagrams of
+/// their own, so that they do not hold up or bloat a batch; like every
+/// frame, they are still copied once, behind their tag, since a datagram is
+/// one contiguous buffer.
+///
+/// On the wire, each datagram is a sequence of frames, each encoded as a
+/// varint logical client id, a varint length, and that many bytes.  Both
+/// ends of the connection must use a `MultiplexedSession`.
+///
+/// Like `Transport`, a session is not thread-safe:  all calls must come
+/// from the one thread that runs its I/O loop.
+
+namespace blocktopus {
+
+class MultiplexedSession final {
+ public:
+  struct Config {
+    /// Batches are handed to the transport once they reach this size.
+    size_t max_batch_bytes = 16 << 10;
+    /// Frames at least this large are sent alone rather than batched.
+    size_t max_batched_frame_bytes = 1024;
+  };
+
+  /// Take over @p transport, which should be started (or startable) but
+  /// not otherwise in use.
+  MultiplexedSession(Transport&& transport, const Config& config);
+
+  MultiplexedSession(const MultiplexedSession&) = delete;
+  MultiplexedSession& operator=(const MultiplexedSession&) = delete;
+
+  /// Queue @p frame to be sent on behalf of logical client @p client.
+  /// Sending is deferred until the next `Flush` or `ProcessIO`.
+  void Send(ClientId client, std::span<const uint8_t> frame);
+
+  /// Hand any partly filled batch to the transport.
+  void Flush();
+
+  /// (BLOCKING) Flush, run one `Transport::ProcessIO`, and sort whatever
+  /// arrived into per-client queues.
+  ///
+  /// @return as `Transport::ProcessIO`, or `kProtocolError` if a received
+  /// datagram was malformed (in which case the rest of it is discarded).
+  Status ProcessIO();
+
+  /// Take every frame received for logical client @p client, in order.
+  std::vector<std::vector<uint8_t>> ReceiveAll(ClientId client);
+
+  /// @return the number of frames and of datagrams sent so far; their ratio
+  /// is the batching factor.
+  uint64_t frames_sent() const { return frames_sent_; }
+  uint64_t datagrams_sent() const { return datagrams_sent_; }
+
+  Transport& transport() { return transport_; }
+
+ private:
+  // Append @p client and @p frame to @p out in wire format.
+  static void AppendFrame(ClientId client, std::span<const uint8_t> frame,
+                          std::vector<uint8_t>* out);
+
+  const Config config_;
+  Transport transport_;
+  std::vector<uint8_t> batch_;
+  std::map<ClientId, std::deque<std::vector<uint8_t>>> inbound_;
+  uint64_t frames_sent_ = 0;
+  uint64_t datagrams_sent_ = 0;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,159 @@
+#include "payload_dedup.h"
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+enum FrameKind : uint8_t {
+  kInline = 0,
+  kStore = 1,
+  kReference = 2,
+};
+
+}  // namespace
+
+bool DedupLru::Touch(uint64_t hash) {
+  auto it = position_.find(hash);
+  if (it == position_.end()) return false;
+  order_.splice(order_.begin(), order_, it->second);
+  return true;
+}
+
+void DedupLru::Insert(uint64_t hash, size_t size,
+                      std::vector<uint64_t>* evicted) {
+  while (held_bytes_ + size > budget_bytes_) {
+    const Entry& oldest = order_.back();
+    evicted->push_back(oldest.hash);
+    held_bytes_ -= oldest.size;
+    position_.erase(oldest.hash);
+    order_.pop_back();
+  }
+  order_.push_front(Entry{.hash = hash, .size = size});
+  position_[hash] = order_.begin();
+  held_bytes_ += size;
+}
+
+void DedupLru::Clear(std::vector<uint64_t>* evicted) {
+  for (const Entry& entry : order_) evicted->push_back(entry.hash);
+  order_.clear();
+  position_.clear();
+  held_bytes_ = 0;
+}
+
+PayloadDedup::PayloadDedup(const PayloadDedupConfig& config)
+    : config_(config) {}
+
+void PayloadDedup::Encode(const Sequencer::Delivery& delivery,
+                          std::vector<uint8_t>* out) {
+  const std::vector<uint8_t>& payload = delivery.message->payload;
+  const auto send_inline = [&] {
+    out->push_back(kInline);
+    out->insert(out->end(), payload.begin(), payload.end());
+  };
+  if (payload.size() < config_.min_payload_size ||
+      payload.size() > config_.receiver_budget_bytes) {
+    send_inline();
+    return;
+  }
+  const uint64_t hash = HashOf(delivery.message);
+  auto content = contents_.find(hash);
+  if (content != contents_.end() &&
+      content->second.message != delivery.message &&
+      content->second.message->payload != payload) {
+    // A collision with a different payload; the hash is taken.
+    send_inline();
+    return;
+  }
+  DedupLru& lru = receivers_.try_emplace(delivery.recipient,
+                                         config_.receiver_budget_bytes)
+                      .first->second;
+  if (lru.Touch(hash)) {
+    out->push_back(kReference);
+    PutFixed64(hash, out);
+    saved_bytes_ += payload.size();
+    return;
+  }
+  if (content == contents_.end()) {
+    content = contents_.emplace(hash, Content{.message = delivery.message})
+                  .first;
+    stored_bytes_ += payload.size();
+  }
+  ++content->second.holders;
+  evicted_.clear();
+  lru.Insert(hash, payload.size(), &evicted_);
+  Release(evicted_);
+  out->push_back(kStore);
+  PutFixed64(hash, out);
+  out->insert(out->end(), payload.begin(), payload.end());
+}
+
+uint64_t PayloadDedup::HashOf(const std::shared_ptr<const Message>& message) {
+  if (message != last_hashed_) {
+    last_hashed_ = message;
+    last_hash_ = HashPayload(message->payload);
+    hashed_bytes_ += message->payload.size();
+  }
+  return last_hash_;
+}
+
+void PayloadDedup::RemoveReceiver(ClientId client) {
+  auto it = receivers_.find(client);
+  if (it == receivers_.end()) return;
+  evicted_.clear();
+  it->second.Clear(&evicted_);
+  receivers_.erase(it);
+  Release(evicted_);
+}
+
+void PayloadDedup::Release(const std::vector<uint64_t>& hashes) {
+  for (uint64_t hash : hashes) {
+    auto it = contents_.find(hash);
+    if (--it->second.holders > 0) continue;
+    stored_bytes_ -= it->second.message->payload.size();
+    contents_.erase(it);
+  }
+}
+
+PayloadDedupReceiver::PayloadDedupReceiver(const PayloadDedupConfig& config)
+    : lru_(config.receiver_budget_bytes) {}
+
+Status PayloadDedupReceiver::Decode(std::span<const uint8_t> frame,
+                                    std::vector<uint8_t>* payload) {
+  ByteReader reader(frame);
+  std::span<const uint8_t> kind;
+  uint64_t hash = 0;
+  if (!reader.GetBytes(1, &kind) ||
+      (kind[0] != kInline && !reader.GetFixed64(&hash))) {
+    return Status(StatusCode::kProtocolError, "DedupDecode[truncated]");
+  }
+  const std::span<const uint8_t> rest = frame.subspan(frame.size() -
+                                                      reader.remaining());
+  switch (kind[0]) {
+    case kInline:
+      payload->assign(rest.begin(), rest.end());
+      return Status::Ok();
+    case kStore: {
+      if (rest.size() > lru_.budget_bytes() || payloads_.contains(hash)) {
+        return Status(StatusCode::kProtocolError, "DedupDecode[bad store]");
+      }
+      evicted_.clear();
+      lru_.Insert(hash, rest.size(), &evicted_);
+      for (uint64_t evicted : evicted_) payloads_.erase(evicted);
+      std::vector<uint8_t>& held = payloads_[hash];
+      held.assign(rest.begin(), rest.end());
+      *payload = held;
+      return Status::Ok();
+    }
+    case kReference:
+      if (!rest.empty() || !lru_.Touch(hash)) {
+        return Status(StatusCode::kProtocolError, "DedupDecode[bad reference]");
+      }
+      *payload = payloads_[hash];
+      return Status::Ok();
+  }
+  return Status(StatusCode::kProtocolError, "DedupDecode[unknown kind]");
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "sequencer.h"
+#include "status.h"
+
+/// @file Content-addressed deduplication of payloads.
+///
+/// Ensembles and repeated episodes often publish byte-identical payloads
+/// (the same static scene, the same initial sensor frames).  A server can
+/// send each receiver such a payload once, and thereafter only a short
+/// reference to it by hash.
+///
+/// Each receiver keeps a `PayloadDedupReceiver` holding the payloads it has
+/// been told to keep, up to a byte budget.  The server's `PayloadDedup`
+/// mirrors every receiver's cache without holding a copy per receiver:  both
+/// ends apply the same `DedupLru` policy to the same sequence of frames, so
+/// they evict identically and the server always knows exactly what each
+/// receiver holds.  The server keeps one copy of each distinct payload held
+/// by any receiver, and compares bytes before sending a reference, so a hash
+/// collision costs a full send rather than a wrong payload.
+///
+/// A frame is a kind byte, then one of:  the payload (inline, not kept);
+/// a fixed64 hash then the payload (to be kept); or a fixed64 hash
+/// (reference to a kept payload).
+
+namespace blocktopus {
+
+struct PayloadDedupConfig {
+  /// Smaller payloads are always sent inline; a reference would save little.
+  size_t min_payload_size = 256;
+  /// The most payload bytes each receiver keeps.  Must be the same at both
+  /// ends.
+  size_t receiver_budget_bytes = 64 << 20;
+};
+
+/// Least-recently-used replacement over payload hashes, within a byte
+/// budget.  Shared by both ends so that they make identical choices.
+class DedupLru final {
+ public:
+  explicit DedupLru(size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+  /// @return whether @p hash is held, marking it most recently used if so.
+  bool Touch(uint64_t hash);
+
+  /// Hold @p hash (which must not be held, and whose @p size must fit the
+  /// budget) as most recently used, appending the hashes evicted to make
+  /// room to @p evicted.
+  void Insert(uint64_t hash, size_t size, std::vector<uint64_t>* evicted);
+
+  /// Drop everything, appending the hashes held to @p evicted.
+  void Clear(std::vector<uint64_t>* evicted);
+
+  size_t budget_bytes() const { return budget_bytes_; }
+  size_t held_bytes() const { return held_bytes_; }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    size_t size;
+  };
+
+  const size_t budget_bytes_;
+  size_t held_bytes_ = 0;
+  std::list<Entry> order_;  // Most recently used first.
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> position_;
+};
+
+/// The server's side:  encodes deliveries for every receiver.
+class PayloadDedup final {
+ public:
+  explicit PayloadDedup(const PayloadDedupConfig& config);
+
+  PayloadDedup(const PayloadDedup&) = delete;
+  PayloadDedup& operator=(const PayloadDedup&) = delete;
+
+  /// Append the frame carrying @p delivery's payload to its recipient to
+  /// @p out.  Frames for one recipient must reach it in the order encoded.
+  ///
+  /// A message's payload is hashed once however many recipients it is
+  /// encoded for, provided its deliveries are encoded consecutively (as a
+  /// `Sequencer::Step` lists them).
+  void Encode(const Sequencer::Delivery& delivery, std::vector<uint8_t>* out);
+
+  /// Forget @p client's cache, e.g. because it disconnected.
+  void RemoveReceiver(ClientId client);
+
+  /// @return the number and total size of the distinct payloads held.
+  size_t size() const { return contents_.size(); }
+  size_t stored_bytes() const { return stored_bytes_; }
+
+  /// @return the payload bytes sent as references rather than in full.
+  uint64_t saved_bytes() const { return saved_bytes_; }
+
+  /// @return the payload bytes hashed.
+  uint64_t hashed_bytes() const { return hashed_bytes_; }
+
+ private:
+  struct Content {
+    std::shared_ptr<const Message> message;
+    size_t holders = 0;
+  };
+
+  // Drop one holder of each of @p hashes.
+  void Release(const std::vector<uint64_t>& hashes);
+
+  // @return the hash of @p message's payload.
+  uint64_t HashOf(const std::shared_ptr<const Message>& message);
+
+  const PayloadDedupConfig config_;
+  std::map<ClientId, DedupLru> receivers_;
+  std::unordered_map<uint64_t, Content> contents_;
+  size_t stored_bytes_ = 0;
+  uint64_t saved_bytes_ = 0;
+  uint64_t hashed_bytes_ = 0;
+  std::vector<uint64_t> evicted_;
+  // The last message hashed, held so that its address cannot be reused.
+  std::shared_ptr<const Message> last_hashed_;
+  uint64_t last_hash_ = 0;
+};
+
+/// A receiver's side:  decodes the frames encoded for it.
+class PayloadDedupReceiver final {
+ public:
+  explicit PayloadDedupReceiver(const PayloadDedupConfig& config);
+
+  /// Decode @p frame into @p payload.  Fails with `kProtocolError` if the
+  /// frame is malformed or refers to a payload not held, which means the
+  /// two ends disagree about the cache.
+  Status Decode(std::span<const uint8_t> frame, std::vector<uint8_t>* payload);
+
+  /// @return the total size of the payloads held.
+  size_t held_bytes() const { return lru_.held_bytes(); }
+
+ private:
+  DedupLru lru_;
+  std::unordered_map<uint64_t, std::vector<uint8_t>> payloads_;
+  std::vector<uint64_t> evicted_;
+};
+
+}  // namespace blocktopus
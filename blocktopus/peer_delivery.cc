@@ -0,0 +1,150 @@
+#include "peer_delivery.h"
+
+#include <iterator>
+#include <set>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+Message MakeOrderingStub(const Message& message) {
+  Message stub{.sender = message.sender,
+               .channel = message.channel,
+               .send_seq = message.send_seq,
+               .receive_seq = message.receive_seq};
+  PutVarint(message.payload.size(), &stub.payload);
+  PutFixed64(HashPayload(message.payload), &stub.payload);
+  return stub;
+}
+
+std::optional<MessageHeader> ParseOrderingStub(const Message& stub) {
+  ByteReader reader(stub.payload);
+  uint64_t size;
+  uint64_t hash;
+  if (!reader.GetVarint(&size) || !reader.GetFixed64(&hash) ||
+      !reader.done()) {
+    return std::nullopt;
+  }
+  return MessageHeader{.sender = stub.sender,
+                       .channel = stub.channel,
+                       .send_seq = stub.send_seq,
+                       .receive_seq = stub.receive_seq,
+                       .payload_size = size,
+                       .payload_hash = hash};
+}
+
+PayloadGate::Key PayloadGate::KeyOf(const MessageHeader& header) {
+  return Key(header.receive_seq, header.sender, header.send_seq,
+             header.channel, header.payload_hash, header.payload_size);
+}
+
+void PayloadGate::OnHeader(const MessageHeader& header) {
+  headers_.push_back(header);
+}
+
+PayloadGate::Payloads::iterator PayloadGate::Erase(
+    Payloads::const_iterator it) {
+  buffered_bytes_ -= it->second.payload.size();
+  return payloads_.erase(it);
+}
+
+void PayloadGate::OnPayload(Message&& message) {
+  MessageHeader header = HeaderOf(message);
+  header.payload_hash = HashPayload(message.payload);
+  const Key key = KeyOf(header);
+  if (granted_.has_value() && message.receive_seq <= *granted_) {
+    // Its header, if there is one, has already arrived.
+    bool wanted = false;
+    for (const MessageHeader& queued : headers_) {
+      if (KeyOf(queued) == key) wanted = true;
+    }
+    if (!wanted) return;
+  }
+  buffered_bytes_ += message.payload.size();
+  payloads_.emplace(key, std::move(message));
+  // Over budget:  give up the payloads that will be needed last (possibly
+  // this one).  Their messages then fail when their turn comes.  The one
+  // needed next stays however large, or nothing could ever be released.
+  const auto next = headers_.empty() ? payloads_.cbegin()
+                                     : FindPayload(headers_.front());
+  while (buffered_bytes_ > config_.max_buffered_bytes) {
+    auto victim = std::prev(payloads_.cend());
+    if (victim == next) {
+      if (victim == payloads_.cbegin()) break;
+      victim = std::prev(victim);
+    }
+    Erase(victim);
+    ++evicted_;
+  }
+}
+
+void PayloadGate::OnGrant(Seq seq) {
+  granted_ = seq;
+  std::multiset<Key> wanted;
+  for (const MessageHeader& queued : headers_) {
+    if (queued.receive_seq <= seq) wanted.insert(KeyOf(queued));
+  }
+  for (auto it = payloads_.begin();
+       it != payloads_.end() && std::get<0>(it->first) <= seq;) {
+    auto match = wanted.find(it->first);
+    if (match == wanted.end()) {
+      it = Erase(it);
+    } else {
+      wanted.erase(match);
+      ++it;
+    }
+  }
+}
+
+PayloadGate::Payloads::const_iterator PayloadGate::FindPayload(
+    const MessageHeader& header) const {
+  const Key key = KeyOf(header);
+  auto exact = payloads_.find(key);
+  if (exact != payloads_.end()) return exact;
+  // Otherwise any payload for the same publication, which is then corrupt.
+  auto it = payloads_.lower_bound(Key(header.receive_seq, header.sender,
+                                      header.send_seq, header.channel, 0, 0));
+  if (it != payloads_.end() && std::get<0>(it->first) == header.receive_seq &&
+      std::get<1>(it->first) == header.sender &&
+      std::get<2>(it->first) == header.send_seq &&
+      std::get<3>(it->first) == header.channel) {
+    return it;
+  }
+  return payloads_.end();
+}
+
+bool PayloadGate::TimedOut() const {
+  return granted_.has_value() &&
+         *granted_ - headers_.front().receive_seq >=
+             config_.payload_timeout_seqs;
+}
+
+bool PayloadGate::ready() const {
+  return !headers_.empty() &&
+         (FindPayload(headers_.front()) != payloads_.end() || TimedOut());
+}
+
+Status PayloadGate::Pop(Message* message) {
+  if (headers_.empty()) {
+    return Status(StatusCode::kBackpressure, "Pop[no header]");
+  }
+  auto it = FindPayload(headers_.front());
+  if (it == payloads_.end()) {
+    if (!TimedOut()) {
+      return Status(StatusCode::kBackpressure, "Pop[payload not arrived]");
+    }
+    headers_.pop_front();
+    return Status(StatusCode::kProtocolError, "Pop[payload timed out]");
+  }
+  const bool matches = it->first == KeyOf(headers_.front());
+  headers_.pop_front();
+  if (!matches) {
+    Erase(it);
+    return Status(StatusCode::kProtocolError, "Pop[payload mismatch]");
+  }
+  buffered_bytes_ -= it->second.payload.size();
+  *message = std::move(payloads_.extract(it).mapped());
+  return Status::Ok();
+}
+
+}  // namespace blocktopus
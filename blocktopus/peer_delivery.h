@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "common.h"
+#include "status.h"
+
+/// @file Peer-to-peer payload delivery with server-ordered metadata.
+///
+/// A publisher of bulky data (e.g. camera frames) need not route its payload
+/// through the server.  Instead it publishes an *ordering stub* -- the
+/// message with its payload replaced by the payload's size and hash -- to the
+/// server, and sends the full message directly to each subscriber over its
+/// own `Transport` link.  The server orders stubs exactly as it would the
+/// full messages.
+///
+/// On the subscriber, a `PayloadGate` matches the ordered stubs with the
+/// payloads arriving from peers, and releases full messages to the
+/// application strictly in the server's order, each only once its payload
+/// has arrived and been verified against the stub.  The application thus
+/// sees exactly what it would have had the payloads come via the server.
+/// A payload that has not arrived once the server's grants are well past its
+/// message fails that message rather than blocking every later one, and
+/// payloads buffered ahead of their headers are bounded in total size.
+/// Both depend only on what the gate is given, never on the wall clock, so
+/// a replay releases exactly what the original run did.
+///
+/// This file provides only the two ends of the protocol.  Deciding which
+/// subscribers a publisher must send each payload to (subscriber discovery)
+/// and keeping a `Transport` to each of them (fan-out) are left to the
+/// application.
+
+namespace blocktopus {
+
+/// @return the stub to publish to the server in place of @p message.
+Message MakeOrderingStub(const Message& message);
+
+/// @return the header (including `payload_hash`) described by @p stub, or
+/// `nullopt` if @p stub is not a well-formed ordering stub.
+std::optional<MessageHeader> ParseOrderingStub(const Message& stub);
+
+/// Releases peer-delivered payloads in the order set by the server.
+class PayloadGate final {
+ public:
+  struct Config {
+    /// A message whose payload has not arrived by the time a grant (see
+    /// `OnGrant`) reaches this far past its `receive_seq` is failed, so
+    /// that a lost payload cannot block the ones after it.
+    Seq payload_timeout_seqs = 1000;
+    /// The most payload bytes held before their headers are released; past
+    /// this, the payloads needed furthest in the future are discarded, but
+    /// never the one needed next.
+    size_t max_buffered_bytes = 64 << 20;
+  };
+
+  PayloadGate() : PayloadGate(Config()) {}
+  explicit PayloadGate(const Config& config) : config_(config) {}
+
+  PayloadGate(const PayloadGate&) = delete;
+  PayloadGate& operator=(const PayloadGate&) = delete;
+
+  /// Accept the next header in server order.
+  void OnHeader(const MessageHeader& header);
+
+  /// Accept a full message sent directly by its publisher.  Messages that
+  /// no header can any longer ask for (see `OnGrant`) are discarded.
+  void OnPayload(Message&& message);
+
+  /// Record that the server has granted @p seq, and so has already sent
+  /// every header with `receive_seq <= seq`; payloads matching none of them
+  /// are discarded.  This is also what times out missing payloads.
+  void OnGrant(Seq seq);
+
+  /// @return whether `Pop` will return a message (or an error).
+  bool ready() const;
+
+  /// Release the next message in server order into @p message.
+  ///
+  /// Fails with `kProtocolError` (dropping that message) if its payload
+  /// does not match its header or did not arrive within
+  /// `payload_timeout_seqs`, and with `kBackpressure` if its payload has not
+  /// arrived yet.
+  Status Pop(Message* message);
+
+  /// @return the number of payloads held that are not yet releasable.
+  size_t buffered() const { return payloads_.size(); }
+
+  /// @return the total size of those payloads.
+  size_t buffered_bytes() const { return buffered_bytes_; }
+
+  /// @return the number of payloads discarded to stay within
+  /// `max_buffered_bytes`.
+  uint64_t evicted() const { return evicted_; }
+
+ private:
+  // Payloads are matched to headers on everything the stub carries.
+  using Key = std::tuple<Seq, ClientId, Seq, std::string, uint64_t, size_t>;
+  using Payloads = std::multimap<Key, Message>;
+  static Key KeyOf(const MessageHeader& header);
+
+  // @return the payload for @p header:  one matching it exactly if there is
+  // one, else one for the same publication but with the wrong contents.
+  Payloads::const_iterator FindPayload(const MessageHeader& header) const;
+
+  // @return whether the next header's payload has timed out.
+  bool TimedOut() const;
+
+  // Discard the payload at @p it.
+  Payloads::iterator Erase(Payloads::const_iterator it);
+
+  const Config config_;
+  std::deque<MessageHeader> headers_;
+  Payloads payloads_;
+  size_t buffered_bytes_ = 0;
+  uint64_t evicted_ = 0;
+  std::optional<Seq> granted_;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,69 @@
+#include "rendezvous.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace blocktopus {
+
+RendezvousStore::RendezvousStore(const RendezvousStore::Config& config)
+    : config_(config) {
+  if (config_.max_chunk_size == 0) {
+    // No `Pull` of a non-empty payload could ever complete.
+    throw std::invalid_argument("RendezvousStore needs a max_chunk_size");
+  }
+}
+
+std::optional<RendezvousStore::Descriptor> RendezvousStore::Offer(
+    const Sequencer::Delivery& delivery) {
+  const std::shared_ptr<const Message>& message = delivery.message;
+  if (message->payload.size() < config_.min_payload_size) return std::nullopt;
+  auto [known, inserted] = handle_of_.try_emplace(message.get(), next_handle_);
+  if (inserted) {
+    entries_[next_handle_++] = Entry{.message = message};
+    stored_bytes_ += message->payload.size();
+  }
+  entries_[known->second].pullers.insert(delivery.recipient);
+  return Descriptor{.header = HeaderOf(*message), .handle = known->second};
+}
+
+Status RendezvousStore::Pull(ClientId client, RendezvousHandle handle,
+                             size_t offset, Chunk* chunk) {
+  auto it = entries_.find(handle);
+  if (it == entries_.end() || !it->second.pullers.contains(client)) {
+    return Status(StatusCode::kProtocolError, "Pull[not offered]");
+  }
+  const std::vector<uint8_t>& payload = it->second.message->payload;
+  // An empty payload is pulled as one empty chunk at offset 0.
+  if (offset >= payload.size() && !(offset == 0 && payload.empty())) {
+    return Status(StatusCode::kProtocolError, "Pull[offset out of range]");
+  }
+  const size_t length = std::min(config_.max_chunk_size,
+                                 payload.size() - offset);
+  chunk->owner = it->second.message;
+  chunk->bytes = std::span<const uint8_t>(payload).subspan(offset, length);
+  if (offset + length == payload.size()) RemovePuller(it, client);
+  return Status::Ok();
+}
+
+void RendezvousStore::Release(ClientId client, RendezvousHandle handle) {
+  auto it = entries_.find(handle);
+  if (it != entries_.end()) RemovePuller(it, client);
+}
+
+void RendezvousStore::ReleaseClient(ClientId client) {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    RemovePuller(it++, client);
+  }
+}
+
+void RendezvousStore::RemovePuller(
+    std::map<RendezvousHandle, Entry>::iterator it, ClientId client) {
+  Entry& entry = it->second;
+  entry.pullers.erase(client);
+  if (!entry.pullers.empty()) return;
+  stored_bytes_ -= entry.message->payload.size();
+  handle_of_.erase(entry.message.get());
+  entries_.erase(it);
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "sequencer.h"
+#include "status.h"
+
+/// @file Pull-based delivery of large payloads.
+///
+/// Pushing a multi-megabyte payload to every subscriber as soon as it is
+/// final copies it into every subscriber's send queue at once, so that the
+/// server's memory grows with the number of slow subscribers.  Instead, the
+/// server can send each subscriber only a small `Descriptor` -- in order,
+/// like any other delivery -- and let the subscriber pull the payload in
+/// chunks when it is ready.  The store keeps one copy of each payload, shared
+/// by all of its pending pullers, and frees it when the last of them has
+/// pulled it all or gone away.
+
+namespace blocktopus {
+
+/// Names one payload held by a `RendezvousStore`.
+using RendezvousHandle = uint64_t;
+
+class RendezvousStore final {
+ public:
+  struct Config {
+    /// Payloads smaller than this are delivered in full as usual.
+    size_t min_payload_size = 1 << 20;
+    /// The most bytes returned by one `Pull`.  Must be positive.
+    size_t max_chunk_size = 256 << 10;
+  };
+
+  /// What is delivered in place of a large message.
+  struct Descriptor {
+    MessageHeader header;
+    RendezvousHandle handle;
+  };
+
+  /// Part of a payload.  `bytes` remain valid for as long as `owner` is
+  /// held, even if the store has since let go of the payload.
+  struct Chunk {
+    std::shared_ptr<const Message> owner;
+    std::span<const uint8_t> bytes;
+  };
+
+  RendezvousStore() : RendezvousStore(Config()) {}
+  /// Throws if @p config is invalid.
+  explicit RendezvousStore(const Config& config);
+
+  RendezvousStore(const RendezvousStore&) = delete;
+  RendezvousStore& operator=(const RendezvousStore&) = delete;
+
+  /// If @p delivery's payload is large, keep it for its recipient to pull,
+  /// and return the descriptor to deliver instead; otherwise return
+  /// `nullopt` (and @p delivery should be sent as is).
+  ///
+  /// All deliveries of one message share one stored copy and one handle.
+  std::optional<Descriptor> Offer(const Sequencer::Delivery& delivery);
+
+  /// Return up to `max_chunk_size` bytes of the payload of @p handle,
+  /// starting at @p offset, to @p client (which must have been offered
+  /// it).  Pulling the final byte completes @p client's pull; an empty
+  /// payload is pulled by one empty chunk at offset 0.
+  Status Pull(ClientId client, RendezvousHandle handle, size_t offset,
+              Chunk* chunk);
+
+  /// Abandon @p client's pull of @p handle.
+  void Release(ClientId client, RendezvousHandle handle);
+
+  /// Abandon every pull by @p client, e.g. because it disconnected.
+  void ReleaseClient(ClientId client);
+
+  /// @return the number of payloads held.
+  size_t size() const { return entries_.size(); }
+
+  /// @return the total size of the payloads held.
+  size_t stored_bytes() const { return stored_bytes_; }
+
+ private:
+  struct Entry {
+    std::shared_ptr<const Message> message;
+    std::set<ClientId> pullers;
+  };
+
+  // Drop @p client from the entry at @p it, and the entry if it was the
+  // last puller.
+  void RemovePuller(std::map<RendezvousHandle, Entry>::iterator it,
+                    ClientId client);
+
+  const Config config_;
+  RendezvousHandle next_handle_ = 1;
+  std::map<RendezvousHandle, Entry> entries_;
+  std::unordered_map<const Message*, RendezvousHandle> handle_of_;
+  size_t stored_bytes_ = 0;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,377 @@
+#include "sequencer.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace blocktopus {
+
+Sequencer::Sequencer(const Sequencer::Config& config)
+    : config_(config) {}
+
+bool Sequencer::LaterThan(const Pending& a, const Pending& b) {
+  if (a.receive_seq != b.receive_seq) return a.receive_seq > b.receive_seq;
+  if (a.sender != b.sender) return a.sender > b.sender;
+  return a.publish_index > b.publish_index;
+}
+
+Sequencer::ClientState* Sequencer::FindClient(ClientId client) {
+  auto it = clients_.find(client);
+  if (it == clients_.end()) return nullptr;
+  ClientState& state = it->second;
+  if (state.generation != generation_) {
+    // First touch since a Reset:  the client restarts at the reset point.
+    state = ClientState{.generation = generation_, .clear = reset_start_};
+  }
+  return &state;
+}
+
+bool Sequencer::Refresh(Subscription* subscription) const {
+  if (subscription->generation == generation_) return true;
+  if (subscription->generation < subscriptions_valid_since_) return false;
+  // Carried over a Reset that kept subscriptions.  Subscriptions that had
+  // already been ended stay ended.
+  if (subscription->until.has_value()) return false;
+  subscription->generation = generation_;
+  subscription->from = reset_start_;
+  return true;
+}
+
+Status Sequencer::AddClient(ClientId client, Seq start,
+                            Seq* effective_start) {
+  if (FindClient(client) != nullptr || observers_.contains(client)) {
+    return Status(StatusCode::kProtocolError, "AddClient[duplicate]");
+  }
+  const Seq clear = std::max(start, bound_);
+  clients_[client] = ClientState{.generation = generation_, .clear = clear};
+  if (effective_start != nullptr) *effective_start = clear;
+  return Status::Ok();
+}
+
+Status Sequencer::AddObserver(ClientId client, const ObserverConfig& config) {
+  if (FindClient(client) != nullptr || observers_.contains(client)) {
+    return Status(StatusCode::kProtocolError, "AddObserver[duplicate]");
+  }
+  observers_[client] = ObserverState{.config = config};
+  return Status::Ok();
+}
+
+void Sequencer::AcknowledgeObserver(ClientId client, size_t count) {
+  auto it = observers_.find(client);
+  if (it == observers_.end()) return;
+  it->second.backlog -= std::min(count, it->second.backlog);
+}
+
+uint64_t Sequencer::ObserverDropped(ClientId client) const {
+  auto it = observers_.find(client);
+  return it == observers_.end() ? 0 : it->second.dropped;
+}
+
+void Sequencer::RemoveClient(ClientId client) {
+  clients_.erase(client);
+  observers_.erase(client);
+  for (auto& [channel, list] : subscriptions_) {
+    std::erase_if(list, [client](const Subscription& subscription) {
+      return subscription.client == client;
+    });
+  }
+}
+
+Status Sequencer::Subscribe(ClientId client,
+                            const std::optional<std::string>& channel,
+                            Seq seq, Seq* effective) {
+  if (FindClient(client) == nullptr && !observers_.contains(client)) {
+    return Status(StatusCode::kProtocolError, "Subscribe[unknown client]");
+  }
+  *effective = std::max(seq, bound_);
+  subscriptions_[channel].push_back(Subscription{
+    .generation = generation_, .client = client, .from = *effective});
+  if (!channel.has_value() ? !config_.latched_channels.empty()
+                           : config_.latched_channels.contains(*channel)) {
+    latches_.emplace(*effective, Latch{.client = client, .channel = channel});
+  }
+  return Status::Ok();
+}
+
+Status Sequencer::Unsubscribe(ClientId client,
+                              const std::optional<std::string>& channel,
+                              Seq seq, Seq* effective) {
+  auto it = subscriptions_.find(channel);
+  if (it != subscriptions_.end()) {
+    for (Subscription& subscription : it->second) {
+      if (subscription.client == client && Refresh(&subscription) &&
+          !subscription.until.has_value()) {
+        *effective = std::max(seq, bound_);
+        subscription.until = *effective;
+        return Status::Ok();
+      }
+    }
+  }
+  return Status(StatusCode::kProtocolError, "Unsubscribe[not subscribed]");
+}
+
+Status Sequencer::Publish(Message&& message,
+                          std::shared_ptr<const Message>* published) {
+  ClientState* state = FindClient(message.sender);
+  if (state == nullptr) {
+    return Status(StatusCode::kProtocolError, "Publish[unknown client]");
+  }
+  if (message.send_seq < state->clear) {
+    return Status(StatusCode::kProtocolError, "Publish[send_seq < clear]");
+  }
+  if (message.receive_seq <= message.send_seq) {
+    return Status(StatusCode::kProtocolError,
+                  "Publish[receive_seq <= send_seq]");
+  }
+  if (const std::optional<Seq> limit = publish_limit();
+      limit.has_value() && message.send_seq > *limit) {
+    // The sender still promises not to send below `send_seq`, and in
+    // particular not below the limit.  Recording that much lets the bound
+    // move even when the refused sender is the one holding it back.
+    state->clear = std::max(state->clear, *limit);
+    return Status(StatusCode::kBackpressure, "Publish[beyond skew window]");
+  }
+  state->clear = message.send_seq;
+  pending_.push_back(Pending{
+    .generation = generation_,
+    .receive_seq = message.receive_seq,
+    .sender = message.sender,
+    .publish_index = state->publish_count++,
+    .message = std::make_shared<const Message>(std::move(message))});
+  if (published != nullptr) *published = pending_.back().message;
+  std::push_heap(pending_.begin(), pending_.end(), LaterThan);
+  ++live_pending_;
+  return Status::Ok();
+}
+
+Status Sequencer::Relay(std::shared_ptr<const Message> message,
+                        std::optional<uint64_t> publish_index) {
+  if (message->receive_seq <= message->send_seq) {
+    return Status(StatusCode::kProtocolError,
+                  "Relay[receive_seq <= send_seq]");
+  }
+  if (message->receive_seq <= bound_) {
+    return Status(StatusCode::kProtocolError, "Relay[already final]");
+  }
+  pending_.push_back(Pending{
+    .generation = generation_,
+    .receive_seq = message->receive_seq,
+    .sender = message->sender,
+    .publish_index =
+        publish_index.has_value() ? *publish_index : relay_count_++,
+    .message = std::move(message)});
+  std::push_heap(pending_.begin(), pending_.end(), LaterThan);
+  ++live_pending_;
+  return Status::Ok();
+}
+
+Status Sequencer::SetPeerClear(size_t peer, Seq clear) {
+  auto [it, inserted] = peer_clears_.try_emplace(peer, clear);
+  if (!inserted) {
+    if (clear < it->second) {
+      return Status(StatusCode::kProtocolError,
+                    "SetPeerClear[went backwards]");
+    }
+    it->second = clear;
+  }
+  return Status::Ok();
+}
+
+std::optional<Seq> Sequencer::local_clear() const {
+  std::optional<Seq> result;
+  for (const auto& [client, state] : clients_) {
+    const Seq clear =
+        state.generation == generation_ ? state.clear : reset_start_;
+    result = std::min(result.value_or(clear), clear);
+  }
+  return result;
+}
+
+Status Sequencer::ClearToAdvance(ClientId client, Seq clear_until) {
+  ClientState* state = FindClient(client);
+  if (state == nullptr) {
+    return Status(StatusCode::kProtocolError,
+                  "ClearToAdvance[unknown client]");
+  }
+  if (clear_until < state->clear) {
+    return Status(StatusCode::kProtocolError,
+                  "ClearToAdvance[went backwards]");
+  }
+  state->clear = clear_until;
+  return Status::Ok();
+}
+
+bool Sequencer::AdmitToObserver(ObserverState* state) {
+  const ObserverConfig& config = state->config;
+  bool admit = state->backlog < config.max_backlog;
+  if (!admit && config.overflow == ObserverOverflow::kSample) {
+    // Sampling still sheds load, so it too gives up at twice the limit.
+    admit = state->backlog < 2 * config.max_backlog &&
+            ++state->skipped >= std::max<uint32_t>(config.sample_every, 1);
+  }
+  if (!admit) {
+    ++state->dropped;
+    return false;
+  }
+  state->skipped = 0;
+  ++state->backlog;
+  return true;
+}
+
+void Sequencer::Route(const std::shared_ptr<const Message>& message,
+                      std::vector<Delivery>* out,
+                      std::vector<Delivery>* observer_out) {
+  std::vector<ClientId> recipients;
+  for (const auto& channel : {std::optional<std::string>(message->channel),
+                              std::optional<std::string>()}) {
+    auto it = subscriptions_.find(channel);
+    if (it == subscriptions_.end()) continue;
+    for (Subscription& subscription : it->second) {
+      if (!Refresh(&subscription)) continue;
+      if (message->receive_seq > subscription.from &&
+          (!subscription.until.has_value() ||
+           message->receive_seq <= *subscription.until)) {
+        recipients.push_back(subscription.client);
+      }
+    }
+  }
+  // A client subscribed both to the channel and to everything still gets
+  // one copy; and recipients are served in a deterministic order.
+  std::sort(recipients.begin(), recipients.end());
+  recipients.erase(std::unique(recipients.begin(), recipients.end()),
+                   recipients.end());
+  for (ClientId recipient : recipients) {
+    Deliver(recipient, message, /* latched = */ false, out, observer_out);
+  }
+  if (config_.latched_channels.contains(message->channel)) {
+    latest_[message->channel] = message;
+  }
+}
+
+void Sequencer::Deliver(ClientId recipient,
+                        const std::shared_ptr<const Message>& message,
+                        bool latched, std::vector<Delivery>* out,
+                        std::vector<Delivery>* observer_out) {
+  const Delivery delivery{
+    .recipient = recipient, .message = message, .latched = latched};
+  auto observer = observers_.find(recipient);
+  if (observer == observers_.end()) {
+    out->push_back(delivery);
+  } else if (AdmitToObserver(&observer->second)) {
+    observer_out->push_back(delivery);
+  }
+}
+
+void Sequencer::ResolveLatches(Seq through, std::vector<Delivery>* out,
+                               std::vector<Delivery>* observer_out) {
+  // Everything up to `through` has been routed, so `latest_` is exactly the
+  // latest as of each latch being resolved.
+  while (!latches_.empty() && latches_.begin()->first <= through) {
+    const Latch latch = std::move(latches_.begin()->second);
+    latches_.erase(latches_.begin());
+    if (!clients_.contains(latch.client) &&
+        !observers_.contains(latch.client)) {
+      continue;
+    }
+    if (latch.channel.has_value()) {
+      auto it = latest_.find(*latch.channel);
+      if (it != latest_.end()) {
+        Deliver(latch.client, it->second, /* latched = */ true, out,
+                observer_out);
+      }
+    } else {
+      for (const auto& [channel, message] : latest_) {
+        Deliver(latch.client, message, /* latched = */ true, out,
+                observer_out);
+      }
+    }
+  }
+}
+
+std::optional<Seq> Sequencer::MinimumClear() {
+  if (clients_.empty() && peer_clears_.empty()) return std::nullopt;
+  Seq result = std::numeric_limits<Seq>::max();
+  for (auto& [client, state] : clients_) {
+    result = std::min(result, FindClient(client)->clear);
+  }
+  for (const auto& [peer, clear] : peer_clears_) {
+    result = std::min(result, clear);
+  }
+  return result;
+}
+
+void Sequencer::AdvanceTo(std::optional<Seq> bound,
+                          std::vector<Delivery>* out,
+                          std::vector<Delivery>* observer_out) {
+  // With no clients at all, nothing can ever be published again, so
+  // everything pending is final.
+  Seq finality = std::numeric_limits<Seq>::max();
+  if (bound.has_value()) {
+    bound_ = *bound;
+    finality = bound_;
+  }
+
+  while (!pending_.empty() &&
+         (pending_.front().generation != generation_ ||
+          pending_.front().receive_seq <= finality)) {
+    std::pop_heap(pending_.begin(), pending_.end(), LaterThan);
+    Pending entry = std::move(pending_.back());
+    pending_.pop_back();
+    if (entry.generation != generation_) continue;  // From before a Reset.
+    --live_pending_;
+    ResolveLatches(entry.receive_seq - 1, out, observer_out);
+    Route(entry.message, out, observer_out);
+  }
+  ResolveLatches(finality, out, observer_out);
+  Compact();
+}
+
+void Sequencer::AppendGrants(std::vector<Grant>* out) {
+  if (!GrantDue()) return;
+  for (const auto& [client, state] : clients_) {
+    out->push_back(Grant{.client = client, .seq = bound_,
+                         .publish_limit = publish_limit()});
+  }
+  MarkGranted();
+}
+
+void Sequencer::DropEndedSubscriptions() {
+  // Ended subscriptions that can match no further message are dropped.
+  for (auto& [channel, list] : subscriptions_) {
+    std::erase_if(list, [this](Subscription& subscription) {
+      return !Refresh(&subscription) ||
+             (subscription.until.has_value() && *subscription.until <= bound_);
+    });
+  }
+}
+
+Sequencer::Output Sequencer::Step() {
+  Output result;
+  AdvanceTo(MinimumClear(), &result.deliveries,
+            &result.observer_deliveries);
+  AppendGrants(&result.grants);
+  DropEndedSubscriptions();
+  return result;
+}
+
+void Sequencer::Compact() {
+  // Messages discarded by a Reset stay in the heap until they reach the
+  // top; once they are the majority, reclaim them in one pass.
+  if (pending_.size() <= 2 * live_pending_ + 64) return;
+  std::erase_if(pending_, [this](const Pending& entry) {
+    return entry.generation != generation_;
+  });
+  std::make_heap(pending_.begin(), pending_.end(), LaterThan);
+}
+
+void Sequencer::Reset(Seq start, bool keep_subscriptions) {
+  ++generation_;
+  if (!keep_subscriptions) subscriptions_valid_since_ = generation_;
+  reset_start_ = start;
+  bound_ = start;
+  last_granted_ = std::nullopt;
+  live_pending_ = 0;
+  latest_.clear();
+  latches_.clear();
+}
+
+}  // namespace blocktopus
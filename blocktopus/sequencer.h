@@ -0,0 +1,332 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "status.h"
+
+/// @file The deterministic ordering core of the server.
+///
+/// This is the lock-time algorithm described in `target_api.h` and the
+/// README, with all networking stripped away:  the server feeds it the
+/// subscriptions, publications, and clear-to-advance promises its clients
+/// send, and periodically calls `Step` to learn which messages are now
+/// final, in what order to deliver them to whom, and how far each client
+/// may advance.
+///
+/// Each client promises (by `ClearToAdvance`, or implicitly by `Publish`)
+/// never again to send with a sequence number below its *clear* sequence
+/// number.  Since every message's `receive_seq` exceeds its `send_seq`, no
+/// message yet to be published can have a `receive_seq` at or below the
+/// *bound* -- the minimum clear sequence number over all clients -- and so
+/// every pending message at or below the bound is final.  Final messages
+/// are delivered in (receive_seq, sender, publication order) order, which
+/// depends only on what the clients sent and not on when it arrived.
+///
+/// *Observers* (loggers, visualizers, monitors) subscribe but never publish.
+/// They take no part in the bound, receive final messages without holding
+/// anything back, and when they fall behind lose messages rather than slow
+/// the simulation.
+
+namespace blocktopus {
+
+class Ensemble;
+
+class Sequencer final {
+ public:
+  struct Config {
+    /// If set, publications with `send_seq` more than this far ahead of the
+    /// bound are refused with `kBackpressure` until the bound catches up.
+    /// This caps how much the fastest client can make the server buffer
+    /// while waiting on the slowest, without changing delivery order.
+    std::optional<Seq> max_skew;
+
+    /// Channels whose latest message is kept for late subscribers.  A
+    /// subscription to one of these (or to every channel) that takes effect
+    /// at sequence number `e` is first sent the last message on the channel
+    /// with `receive_seq <= e`, if any, so that publishers of state that
+    /// rarely changes need not republish it for late joiners.
+    std::set<std::string> latched_channels;
+  };
+
+  /// What to do with messages for an observer that has fallen behind.
+  enum class ObserverOverflow {
+    kDrop,    ///< Drop every message until it catches up.
+    kSample,  ///< Deliver only every `sample_every`th message.
+  };
+
+  struct ObserverConfig {
+    /// An observer is behind once this many deliveries to it are
+    /// unacknowledged (see `AcknowledgeObserver`).
+    size_t max_backlog = 1024;
+    ObserverOverflow overflow = ObserverOverflow::kDrop;
+    uint32_t sample_every = 16;
+  };
+
+  /// One message to be sent to one client.  Fan-out shares the message.
+  struct Delivery {
+    ClientId recipient;
+    std::shared_ptr<const Message> message;
+    /// Whether this is a latched message (see `Config::latched_channels`)
+    /// sent because a subscription started after it.
+    bool latched = false;
+  };
+
+  /// Permission for a client to advance:  every message it will ever
+  /// receive with `receive_seq <= seq` has now been delivered to it.
+  struct Grant {
+    ClientId client;
+    Seq seq;
+    /// The highest `send_seq` that will currently be accepted, if
+    /// `Config::max_skew` is set; clients should not publish beyond it.
+    std::optional<Seq> publish_limit;
+  };
+
+  /// The result of a `Step`.  Deliveries are in delivery order.
+  struct Output {
+    std::vector<Delivery> deliveries;
+    std::vector<Grant> grants;
+    /// Deliveries to observers, which may be sent after (and at lower
+    /// priority than) everything else.
+    std::vector<Delivery> observer_deliveries;
+  };
+
+  explicit Sequencer(const Config& config = {});
+
+  Sequencer(const Sequencer&) = delete;
+  Sequencer& operator=(const Sequencer&) = delete;
+
+  /// Register @p client, which promises not to send below @p start.
+  ///
+  /// A client that joins after the bound has passed @p start starts at the
+  /// bound instead; the start actually used is returned via
+  /// @p effective_start if it is not null.  Errors (e.g. a duplicate id)
+  /// are reported as `kProtocolError`.
+  Status AddClient(ClientId client, Seq start,
+                   Seq* effective_start = nullptr);
+
+  /// Register @p client as an observer:  it may subscribe, but may not
+  /// publish or advance, and is never waited for.
+  Status AddObserver(ClientId client, const ObserverConfig& config);
+  Status AddObserver(ClientId client) {
+    return AddObserver(client, ObserverConfig());
+  }
+
+  /// Record that @p count deliveries to observer @p client have been sent
+  /// (e.g. written to its socket), and so no longer count as its backlog.
+  void AcknowledgeObserver(ClientId client, size_t count);
+
+  /// @return the number of messages withheld from observer @p client
+  /// because it was behind.
+  uint64_t ObserverDropped(ClientId client) const;
+
+  /// Forget @p client (or observer) and its subscriptions; it no longer
+  /// holds back the bound.  Messages it already published are still
+  /// delivered.
+  void RemoveClient(ClientId client);
+
+  /// Subscribe @p client to @p channel (or every channel if `nullopt`)
+  /// from @p seq onwards.
+  ///
+  /// @return (via @p effective) the sequence number after which delivery
+  /// is guaranteed, which is later than @p seq if the bound already passed
+  /// it.
+  Status Subscribe(ClientId client, const std::optional<std::string>& channel,
+                   Seq seq, Seq* effective);
+
+  /// End a subscription made by `Subscribe`; messages received at or
+  /// before the returned @p effective sequence number are still delivered.
+  Status Unsubscribe(ClientId client,
+                     const std::optional<std::string>& channel,
+                     Seq seq, Seq* effective);
+
+  /// Accept @p message for ordering.  Implies
+  /// `ClearToAdvance(message.sender, message.send_seq)`.
+  ///
+  /// If @p message is beyond the skew window (see `Config::max_skew`), it
+  /// is left unconsumed and `kBackpressure` is returned; the caller should
+  /// stop reading from the sender and retry after a `Step` has advanced the
+  /// bound.  The refusal still implies
+  /// `ClearToAdvance(message.sender, *publish_limit())`, so that the bound
+  /// can advance if the sender is the one holding it back.  Otherwise
+  /// @p published, if not null, receives the message as shared with its
+  /// deliveries (e.g. to `Relay` it elsewhere).
+  Status Publish(Message&& message,
+                 std::shared_ptr<const Message>* published = nullptr);
+
+  /// Accept @p message, published to a *peer* sequencer (one ordering other
+  /// clients of the same universe, e.g. on another core), for delivery to
+  /// subscribers here.  Unlike `Publish` it implies no promise by its
+  /// sender, who need not be a client here.  The peer's clear (see
+  /// `SetPeerClear`) must not pass the message's `send_seq` until it has
+  /// been relayed, or it may already be final here (`kProtocolError`).
+  ///
+  /// Messages of one sender with the same `receive_seq` are delivered in
+  /// the order relayed, unless @p publish_index (the message's index among
+  /// its sender's publications) is given to order them instead.
+  Status Relay(std::shared_ptr<const Message> message,
+               std::optional<uint64_t> publish_index = std::nullopt);
+
+  /// Hold the bound at or below @p clear on behalf of peer sequencer
+  /// @p peer, i.e. the minimum clear of that peer's clients.  A peer's
+  /// clear may not go backwards.
+  Status SetPeerClear(size_t peer, Seq clear);
+
+  /// @return the minimum clear over this sequencer's own clients (ignoring
+  /// peers), or `nullopt` if it has none.
+  std::optional<Seq> local_clear() const;
+
+  /// @return the highest `send_seq` that `Publish` will currently accept.
+  std::optional<Seq> publish_limit() const {
+    if (!config_.max_skew.has_value()) return std::nullopt;
+    return bound_ + *config_.max_skew;
+  }
+
+  /// Record @p client's promise not to send below @p clear_until.
+  Status ClearToAdvance(ClientId client, Seq clear_until);
+
+  /// Release every message made final since the last call, and grant every
+  /// client the new bound if it has moved.
+  Output Step();
+
+  /// Rewind the universe to sequence number @p start (e.g. between RL
+  /// episodes) without disturbing client connections.
+  ///
+  /// Every client is treated as having just been added at @p start, and all
+  /// pending messages are discarded.  Subscriptions are kept if
+  /// @p keep_subscriptions, and otherwise dropped.
+  ///
+  /// This is O(1) in the number of pending messages and clients:  state is
+  /// stamped with the generation in which it was written, and state from an
+  /// earlier generation is treated as absent when next encountered (and
+  /// reclaimed in bulk once it dominates the queue).
+  void Reset(Seq start = 0, bool keep_subscriptions = true);
+
+  /// @return the number of `Reset`s so far.
+  uint64_t generation() const { return generation_; }
+
+  /// @return the current bound (as of the last `Step`).
+  Seq bound() const { return bound_; }
+
+  /// @return the number of messages published but not yet delivered in the
+  /// current generation.
+  size_t pending_size() const { return live_pending_; }
+
+ private:
+  struct ClientState {
+    uint64_t generation = 0;
+    Seq clear = 0;
+    uint64_t publish_count = 0;
+  };
+
+  struct ObserverState {
+    ObserverConfig config;
+    size_t backlog = 0;
+    uint64_t skipped = 0;  // Consecutive messages skipped while sampling.
+    uint64_t dropped = 0;
+  };
+
+  struct Subscription {
+    uint64_t generation;
+    ClientId client;
+    Seq from;  // Deliver messages with receive_seq > from ...
+    std::optional<Seq> until;  // ... and <= until, if set.
+  };
+
+  // Subscriptions are bucketed by channel; `nullopt` is the wildcard.
+  using SubscriptionList = std::vector<Subscription>;
+
+  // A latched message owed to a new subscription, as of `at`.
+  struct Latch {
+    ClientId client;
+    std::optional<std::string> channel;
+  };
+
+  struct Pending {
+    uint64_t generation;
+    Seq receive_seq;
+    ClientId sender;
+    uint64_t publish_index;
+    std::shared_ptr<const Message> message;
+  };
+
+  // Let an ensemble of lockstep sequencers share one bound computation.
+  friend class Ensemble;
+
+  // The pending heap is a min-heap on delivery order.
+  static bool LaterThan(const Pending& a, const Pending& b);
+
+  // The pieces of `Step`:
+
+  // @return the minimum clear over all clients, or `nullopt` if there are
+  // no clients (in which case everything pending is final).
+  std::optional<Seq> MinimumClear();
+
+  // Advance the bound to @p bound (see `MinimumClear`) and route every
+  // message thereby made final into @p out (or @p observer_out).
+  void AdvanceTo(std::optional<Seq> bound, std::vector<Delivery>* out,
+                 std::vector<Delivery>* observer_out);
+
+  // Whether the clients have not yet been granted the current bound.
+  bool GrantDue() const {
+    return !last_granted_.has_value() || *last_granted_ != bound_;
+  }
+  void AppendGrants(std::vector<Grant>* out);
+  void MarkGranted() { last_granted_ = bound_; }
+
+  void DropEndedSubscriptions();
+
+  ClientState* FindClient(ClientId client);
+
+  // @return whether @p subscription survives into the current generation,
+  // first updating it if it was carried over a `Reset`.
+  bool Refresh(Subscription* subscription) const;
+  void Route(const std::shared_ptr<const Message>& message,
+             std::vector<Delivery>* out, std::vector<Delivery>* observer_out);
+  void Deliver(ClientId recipient,
+               const std::shared_ptr<const Message>& message, bool latched,
+               std::vector<Delivery>* out,
+               std::vector<Delivery>* observer_out);
+
+  // Send every latched message owed as of @p through or earlier.
+  void ResolveLatches(Seq through, std::vector<Delivery>* out,
+                      std::vector<Delivery>* observer_out);
+
+  // @return whether observer @p state should be sent another message, and
+  // if so count it against its backlog.
+  static bool AdmitToObserver(ObserverState* state);
+  void Compact();
+
+  const Config config_;
+  uint64_t generation_ = 0;
+  // Subscriptions made before this generation were dropped by a `Reset`.
+  uint64_t subscriptions_valid_since_ = 0;
+  Seq reset_start_ = 0;
+  Seq bound_ = 0;
+  std::optional<Seq> last_granted_;
+
+  std::map<ClientId, ClientState> clients_;
+  std::map<ClientId, ObserverState> observers_;
+  std::map<std::optional<std::string>, SubscriptionList> subscriptions_;
+
+  std::vector<Pending> pending_;
+  size_t live_pending_ = 0;
+
+  std::map<size_t, Seq> peer_clears_;
+  // Orders relayed messages not given a publish index; those of one sender
+  // all arrive from the same peer, in their publication order.
+  uint64_t relay_count_ = 0;
+
+  // The latest delivered message on each latched channel, and the latched
+  // messages owed to new subscriptions, by when they are owed.
+  std::map<std::string, std::shared_ptr<const Message>> latest_;
+  std::multimap<Seq, Latch> latches_;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,372 @@
+#include "server_pipeline.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <utility>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+enum OutboundItem : uint8_t {
+  kDelivery = 0,
+  kGrant = 1,
+  kPublishLimit = 2,
+};
+
+using Kind = ServerPipeline::Request::Kind;
+
+}  // namespace
+
+void ServerPipeline::EncodeRequest(const Request& request,
+                                   std::vector<uint8_t>* out) {
+  out->push_back(static_cast<uint8_t>(request.kind));
+  switch (request.kind) {
+    case Kind::kJoin:
+    case Kind::kClearToAdvance:
+      PutZigzag(request.seq, out);
+      break;
+    case Kind::kLeave:
+      break;
+    case Kind::kSubscribe:
+    case Kind::kUnsubscribe:
+      out->push_back(request.channel.has_value());
+      if (request.channel.has_value()) PutString(*request.channel, out);
+      PutZigzag(request.seq, out);
+      break;
+    case Kind::kPublish:
+      SerializeMessage(request.message, out);
+      break;
+  }
+}
+
+void ServerPipeline::EncodeOutbound(const Outbound& outbound,
+                                    std::vector<uint8_t>* out) {
+  for (const auto& message : outbound.messages) {
+    out->push_back(kDelivery);
+    SerializeMessage(*message, out);
+  }
+  if (outbound.grant.has_value()) {
+    out->push_back(kGrant);
+    PutZigzag(*outbound.grant, out);
+  }
+  if (outbound.publish_limit.has_value()) {
+    out->push_back(kPublishLimit);
+    PutZigzag(*outbound.publish_limit, out);
+  }
+}
+
+bool ServerPipeline::ParseOutbound(std::span<const uint8_t> frame,
+                                   std::vector<Message>* messages,
+                                   std::optional<Seq>* grant,
+                                   std::optional<Seq>* publish_limit) {
+  ByteReader reader(frame);
+  while (!reader.done()) {
+    std::span<const uint8_t> item;
+    if (!reader.GetBytes(1, &item)) return false;
+    if (item[0] == kDelivery) {
+      std::optional<Message> message = DeserializeMessage(&reader);
+      if (!message.has_value()) return false;
+      messages->push_back(std::move(*message));
+    } else if (item[0] == kGrant) {
+      Seq seq;
+      if (!reader.GetZigzag(&seq)) return false;
+      *grant = seq;
+    } else if (item[0] == kPublishLimit) {
+      Seq seq;
+      if (!reader.GetZigzag(&seq)) return false;
+      if (publish_limit != nullptr) *publish_limit = seq;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+ServerPipeline::ServerPipeline(const Config& config)
+    : config_(config), sequencer_(config.sequencer_config) {
+  const size_t num_io = std::max<size_t>(config_.num_io_threads, 1);
+  const size_t num_routers = std::max<size_t>(config_.num_routers, 1);
+  for (size_t io = 0; io < num_io; ++io) {
+    io_.push_back(std::make_unique<IoState>(config_.ring_capacity,
+                                            config_.ingest_config));
+  }
+  parking_backlog_.resize(num_io);
+  for (size_t router = 0; router < num_routers; ++router) {
+    auto state = std::make_unique<RouterState>(config_.ring_capacity);
+    for (size_t io = 0; io < num_io; ++io) {
+      state->batches.push_back(
+          std::make_unique<SpscRing<Outbound>>(config_.ring_capacity));
+    }
+    state->backlog.resize(num_io);
+    routers_.push_back(std::move(state));
+  }
+  handed_to_.assign(num_routers, true);
+}
+
+Status ServerPipeline::Decode(size_t io, ClientId client,
+                              std::span<const uint8_t> frame) {
+  UpdateParked(io_[io].get());
+  if (io_[io]->parked.contains(client)) {
+    return Status(StatusCode::kBackpressure, "Decode[client parked]");
+  }
+  const Status malformed(StatusCode::kProtocolError,
+                         "Decode[malformed request]");
+  ByteReader reader(frame);
+  std::span<const uint8_t> kind;
+  if (!reader.GetBytes(1, &kind) ||
+      kind[0] > static_cast<uint8_t>(Kind::kPublish)) {
+    return malformed;
+  }
+  Request request{.kind = static_cast<Kind>(kind[0]), .client = client};
+  bool ok = true;
+  switch (request.kind) {
+    case Kind::kJoin:
+    case Kind::kClearToAdvance:
+      ok = reader.GetZigzag(&request.seq);
+      break;
+    case Kind::kLeave:
+      break;
+    case Kind::kSubscribe:
+    case Kind::kUnsubscribe: {
+      std::span<const uint8_t> has_channel;
+      ok = reader.GetBytes(1, &has_channel) && has_channel[0] <= 1;
+      if (ok && has_channel[0] == 1) {
+        ok = reader.GetString(&request.channel.emplace());
+      }
+      ok = ok && reader.GetZigzag(&request.seq);
+      break;
+    }
+    case Kind::kPublish: {
+      std::optional<Message> message = DeserializeMessage(&reader);
+      ok = message.has_value();
+      if (ok) {
+        request.message = std::move(*message);
+        // A client publishes only as itself.
+        request.message.sender = client;
+      }
+      break;
+    }
+  }
+  if (!ok || !reader.done()) return malformed;
+  if (!io_[io]->requests.TryPush(std::move(request))) {
+    return Status(StatusCode::kBackpressure, "Decode[ordering stage behind]");
+  }
+  return Status::Ok();
+}
+
+Status ServerPipeline::Enqueue(size_t io, ClientId client,
+                               std::vector<uint8_t>&& frame) {
+  return io_[io]->ingest.Enqueue(client, std::move(frame));
+}
+
+bool ServerPipeline::DecodeQueued(
+    size_t io,
+    const std::function<void(ClientId, const Status&)>& malformed) {
+  IoState& state = *io_[io];
+  UpdateParked(&state);
+  // Only this thread pushes, so the room can only grow meanwhile, and no
+  // frame is taken from its queue only to be pushed back.
+  const size_t room = state.requests.capacity() - state.requests.size();
+  bool busy = false;
+  state.ingest.Serve(SIZE_MAX, room,
+                     [&](ClientId client, std::vector<uint8_t>&& frame) {
+                       busy = true;
+                       const Status status = Decode(io, client, frame);
+                       if (!status) malformed(client, status);
+                     });
+  return busy;
+}
+
+Status ServerPipeline::Apply(Request& request) {
+  Seq effective;
+  switch (request.kind) {
+    case Kind::kJoin:
+      return sequencer_.AddClient(request.client, request.seq);
+    case Kind::kLeave:
+      sequencer_.RemoveClient(request.client);
+      return Status::Ok();
+    case Kind::kSubscribe:
+      return sequencer_.Subscribe(request.client, request.channel,
+                                  request.seq, &effective);
+    case Kind::kUnsubscribe:
+      return sequencer_.Unsubscribe(request.client, request.channel,
+                                    request.seq, &effective);
+    case Kind::kClearToAdvance:
+      return sequencer_.ClearToAdvance(request.client, request.seq);
+    case Kind::kPublish:
+      return sequencer_.Publish(std::move(request.message));
+  }
+  return Status::Ok();
+}
+
+bool ServerPipeline::HandOff() {
+  bool all = true;
+  for (size_t router = 0; router < routers_.size(); ++router) {
+    if (handed_to_[router]) continue;
+    StepOutput output = unrouted_;
+    handed_to_[router] = routers_[router]->steps.TryPush(std::move(output));
+    all = all && handed_to_[router];
+  }
+  return all;
+}
+
+void ServerPipeline::Reject(const Status& status) {
+  ++rejected_requests_;
+  if (config_.error_channel != nullptr) config_.error_channel->Post(status);
+}
+
+void ServerPipeline::ApplyOrPark(Request&& request) {
+  auto parked = parked_.find(request.client);
+  if (parked != parked_.end()) {
+    // Behind the client's refused publication.
+    parked->second.push_back(std::move(request));
+    return;
+  }
+  const Status status = Apply(request);
+  if (status.code() == StatusCode::kBackpressure) {
+    // A publication beyond the skew window; the rest of this client's
+    // requests wait behind it, but no one else's do.
+    NotifyParking(request.client, true);
+    parked_[request.client].push_back(std::move(request));
+  } else if (!status) {
+    Reject(status);
+  }
+}
+
+bool ServerPipeline::RetryParked() {
+  bool applied = false;
+  for (auto it = parked_.begin(); it != parked_.end();) {
+    std::deque<Request>& requests = it->second;
+    while (!requests.empty()) {
+      const Status status = Apply(requests.front());
+      if (status.code() == StatusCode::kBackpressure) break;
+      if (!status) Reject(status);
+      requests.pop_front();
+      applied = true;
+    }
+    if (requests.empty()) {
+      NotifyParking(it->first, false);
+      it = parked_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return applied;
+}
+
+void ServerPipeline::NotifyParking(ClientId client, bool parked) {
+  parking_backlog_[IoThreadOf(client)].push_back(
+      Parking{.client = client, .parked = parked});
+}
+
+void ServerPipeline::FlushParking() {
+  for (size_t io = 0; io < io_.size(); ++io) {
+    std::deque<Parking>& backlog = parking_backlog_[io];
+    while (!backlog.empty() &&
+           io_[io]->parking.TryPush(std::move(backlog.front()))) {
+      backlog.pop_front();
+    }
+  }
+}
+
+void ServerPipeline::UpdateParked(IoState* state) {
+  Parking change;
+  while (state->parking.TryPop(&change)) {
+    if (change.parked) {
+      state->parked.insert(change.client);
+      state->ingest.Pause(change.client);
+    } else {
+      state->parked.erase(change.client);
+      state->ingest.Resume(change.client);
+    }
+  }
+}
+
+bool ServerPipeline::Order() {
+  // Never step past output the routers have yet to take.
+  if (!HandOff()) return true;
+  bool busy = RetryParked();
+  for (const auto& io : io_) {
+    // At most a ring's worth per thread, so that no thread starves others.
+    for (size_t n = 0; n < config_.ring_capacity; ++n) {
+      Request* request = io->requests.Front();
+      if (request == nullptr) break;
+      busy = true;
+      ApplyOrPark(std::move(*request));
+      io->requests.PopFront();
+    }
+  }
+  FlushParking();
+  auto output = std::make_shared<Sequencer::Output>(sequencer_.Step());
+  if (output->deliveries.empty() && output->grants.empty()) return busy;
+  unrouted_ = std::move(output);
+  handed_to_.assign(routers_.size(), false);
+  HandOff();
+  return true;
+}
+
+bool ServerPipeline::FlushBacklog(RouterState* state) {
+  bool empty = true;
+  for (size_t io = 0; io < state->backlog.size(); ++io) {
+    std::deque<Outbound>& backlog = state->backlog[io];
+    while (!backlog.empty() &&
+           state->batches[io]->TryPush(std::move(backlog.front()))) {
+      backlog.pop_front();
+    }
+    empty = empty && backlog.empty();
+  }
+  return empty;
+}
+
+bool ServerPipeline::Route(size_t router) {
+  RouterState& state = *routers_[router];
+  if (!FlushBacklog(&state)) return true;
+  StepOutput output;
+  if (!state.steps.TryPop(&output)) return false;
+  // Batch by recipient, in order of first delivery.
+  std::map<ClientId, size_t> index_of;
+  std::vector<Outbound> batches;
+  const auto batch_for = [&](ClientId recipient) -> Outbound& {
+    auto [it, inserted] = index_of.try_emplace(recipient, batches.size());
+    if (inserted) batches.push_back(Outbound{.recipient = recipient});
+    return batches[it->second];
+  };
+  for (const Sequencer::Delivery& delivery : output->deliveries) {
+    if (RouterOf(delivery.recipient) != router) continue;
+    batch_for(delivery.recipient).messages.push_back(delivery.message);
+  }
+  for (const Sequencer::Grant& grant : output->grants) {
+    if (RouterOf(grant.client) != router) continue;
+    Outbound& batch = batch_for(grant.client);
+    batch.grant = grant.seq;
+    batch.publish_limit = grant.publish_limit;
+  }
+  for (Outbound& batch : batches) {
+    state.backlog[IoThreadOf(batch.recipient)].push_back(std::move(batch));
+  }
+  FlushBacklog(&state);
+  return true;
+}
+
+bool ServerPipeline::Encode(
+    size_t io,
+    const std::function<void(ClientId, std::vector<uint8_t>&&)>& send) {
+  bool busy = false;
+  for (const auto& router : routers_) {
+    SpscRing<Outbound>& ring = *router->batches[io];
+    Outbound batch;
+    while (ring.TryPop(&batch)) {
+      busy = true;
+      std::vector<uint8_t> frame;
+      EncodeOutbound(batch, &frame);
+      send(batch.recipient, std::move(frame));
+    }
+  }
+  return busy;
+}
+
+}  // namespace blocktopus
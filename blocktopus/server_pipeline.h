@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "fair_scheduler.h"
+#include "sequencer.h"
+#include "spsc_ring.h"
+#include "status.h"
+
+/// @file The server engine as a pipeline of stages on separate threads.
+///
+/// Ordering is inherently sequential, so the thread that runs the
+/// `Sequencer` should do nothing else.  A `ServerPipeline` splits the rest
+/// of the server's work off into stages connected by `SpscRing`s:
+///
+///  1. *Decode*, on each I/O thread:  parse request frames from the
+///     clients that thread serves.  Frames queued by `Enqueue` are decoded
+///     in deficit-round-robin order across clients (see
+///     `DeficitRoundRobin`), and only as fast as the ordering stage takes
+///     them, so that one client's burst cannot fill the ring to the
+///     ordering stage ahead of another's `ClearToAdvance`.
+///  2. *Order*, on one thread:  apply requests to the `Sequencer` and
+///     `Step` it.
+///  3. *Route*, on each router thread:  sort the step's deliveries and
+///     grants into one batch per recipient, for the recipients that router
+///     owns, and hand each batch to the recipient's I/O thread.
+///  4. *Encode*, on each I/O thread:  serialize each batch into a frame
+///     and send it.
+///
+/// Encoded frames are handed straight to their recipient's own connection,
+/// so no client's frames wait behind another's on egress, and egress needs
+/// no scheduler.
+///
+/// Each step's output is shared among the routers, not copied, and each
+/// recipient is owned by exactly one router and one I/O thread, so each
+/// client's frames stay in order.  When a ring fills, the stage feeding it
+/// holds its work and retries on its next call, and backpressure reaches
+/// `Decode` as `kBackpressure`.
+///
+/// A publication the sequencer refuses for being beyond the skew window
+/// (see `Sequencer::Config::max_skew`) is parked, with that client's later
+/// requests queued behind it, and retried on each `Order`; other clients'
+/// requests are still applied, so the one that holds back the bound can
+/// still advance it.  The ordering stage tells the client's I/O thread,
+/// which then decodes nothing more from that client until it is unparked:
+/// `DecodeQueued` leaves its frames queued and `Decode` pushes back.
+/// Clients learn the limit to publish within from each grant.
+///
+/// Like `Transport`, this provides the functions each thread loops over and
+/// spawns no threads.  Each stage function must only ever be called from
+/// its one thread.
+
+namespace blocktopus {
+
+class ServerPipeline final {
+ public:
+  struct Config {
+    size_t num_io_threads = 1;
+    size_t num_routers = 1;
+    Sequencer::Config sequencer_config;
+    /// The capacity of each ring between stages.
+    size_t ring_capacity = 1024;
+    /// How each I/O thread shares decoding among its clients.
+    DeficitRoundRobin::Config ingest_config;
+    /// If set, requests that the sequencer refuses are posted here.
+    std::shared_ptr<ErrorChannel> error_channel = nullptr;
+  };
+
+  /// A client's request, as decoded from its frame.
+  struct Request {
+    enum class Kind : uint8_t {
+      kJoin = 0,
+      kLeave = 1,
+      kSubscribe = 2,
+      kUnsubscribe = 3,
+      kClearToAdvance = 4,
+      kPublish = 5,
+    };
+    Kind kind = Kind::kLeave;
+    ClientId client = 0;
+    /// The start, subscription point, or clear, as the kind requires.
+    Seq seq = 0;
+    /// (Un)subscriptions only; `nullopt` is every channel.
+    std::optional<std::string> channel;
+    /// Publications only.
+    Message message;
+  };
+
+  /// What one client is sent after one step.
+  struct Outbound {
+    ClientId recipient = 0;
+    std::vector<std::shared_ptr<const Message>> messages;
+    std::optional<Seq> grant;
+    /// As `Sequencer::Grant::publish_limit`, sent with a grant.
+    std::optional<Seq> publish_limit;
+  };
+
+  /// Append the frame encoding @p request (less its client, which is
+  /// implied by the connection) to @p out.
+  static void EncodeRequest(const Request& request, std::vector<uint8_t>* out);
+
+  /// Append the frame encoding @p outbound to @p out.
+  static void EncodeOutbound(const Outbound& outbound,
+                             std::vector<uint8_t>* out);
+
+  /// Decode a frame made by `EncodeOutbound` (e.g. on the client).
+  /// @return false if @p frame is malformed.
+  static bool ParseOutbound(std::span<const uint8_t> frame,
+                            std::vector<Message>* messages,
+                            std::optional<Seq>* grant,
+                            std::optional<Seq>* publish_limit = nullptr);
+
+  explicit ServerPipeline(const Config& config);
+
+  ServerPipeline(const ServerPipeline&) = delete;
+  ServerPipeline& operator=(const ServerPipeline&) = delete;
+
+  /// @return the I/O thread that must serve @p client.
+  size_t IoThreadOf(ClientId client) const { return client % io_.size(); }
+
+  /// (I/O THREAD @p io) Decode request @p frame from @p client and pass it
+  /// to the ordering stage.
+  ///
+  /// @return `kProtocolError` if @p frame is malformed, or
+  /// `kBackpressure` (with nothing consumed) if the ordering stage is
+  /// behind or has parked @p client.
+  Status Decode(size_t io, ClientId client, std::span<const uint8_t> frame);
+
+  /// (I/O THREAD @p io) Queue request @p frame, read from @p client, for
+  /// `DecodeQueued`.
+  ///
+  /// @return `kBackpressure` (with nothing consumed) if @p client already
+  /// has too much queued; stop reading from it until some is decoded.
+  Status Enqueue(size_t io, ClientId client, std::vector<uint8_t>&& frame);
+
+  /// (I/O THREAD @p io) Decode the frames queued by `Enqueue`, fairly
+  /// among the clients not parked, for as many as the ordering stage has
+  /// room for.  Each
+  /// malformed frame's client and error are passed to @p malformed.
+  /// @return whether there was anything to do.
+  bool DecodeQueued(
+      size_t io,
+      const std::function<void(ClientId, const Status&)>& malformed);
+
+  /// (ORDERING THREAD) Apply the decoded requests and step.
+  /// @return whether there was anything to do.
+  bool Order();
+
+  /// (ROUTER THREAD @p router) Route the next step's output.
+  /// @return whether there was anything to do.
+  bool Route(size_t router);
+
+  /// (I/O THREAD @p io) Encode every batch routed to this thread's clients
+  /// and pass each frame to @p send.
+  /// @return whether there was anything to do.
+  bool Encode(size_t io,
+              const std::function<void(ClientId, std::vector<uint8_t>&&)>&
+                  send);
+
+  /// (ORDERING THREAD) @return the number of requests the sequencer
+  /// refused.
+  uint64_t rejected_requests() const { return rejected_requests_; }
+
+ private:
+  using StepOutput = std::shared_ptr<const Sequencer::Output>;
+
+  // That the ordering stage has parked or unparked a client.
+  struct Parking {
+    ClientId client = 0;
+    bool parked = false;
+  };
+
+  struct IoState {
+    DeficitRoundRobin ingest;    // Enqueue -> Decode.
+    SpscRing<Request> requests;  // Decode -> Order.
+    SpscRing<Parking> parking;   // Order -> Decode.
+    // The clients parked, as of the last `Parking` taken.
+    std::set<ClientId> parked;
+    IoState(size_t capacity, const DeficitRoundRobin::Config& ingest_config)
+        : ingest(ingest_config), requests(capacity), parking(capacity) {}
+  };
+
+  struct RouterState {
+    SpscRing<StepOutput> steps;  // Order -> Route.
+    // Route -> Encode, one ring per I/O thread, with the batches that did
+    // not yet fit.
+    std::vector<std::unique_ptr<SpscRing<Outbound>>> batches;
+    std::vector<std::deque<Outbound>> backlog;
+    explicit RouterState(size_t capacity) : steps(capacity) {}
+  };
+
+  size_t RouterOf(ClientId client) const { return client % routers_.size(); }
+
+  // (ORDERING THREAD) Apply @p request; `kBackpressure` leaves it unused.
+  Status Apply(Request& request);
+
+  // (ORDERING THREAD) Apply @p request, or park it if its client already
+  // has requests parked or the sequencer pushes back.
+  void ApplyOrPark(Request&& request);
+
+  // (ORDERING THREAD) Retry the parked requests.
+  // @return whether any were applied.
+  bool RetryParked();
+
+  // (ORDERING THREAD) Count a refused request and post @p status.
+  void Reject(const Status& status);
+
+  // (ORDERING THREAD) Tell @p client's I/O thread that it is @p parked.
+  void NotifyParking(ClientId client, bool parked);
+
+  // (ORDERING THREAD) Move what fits from `parking_backlog_` to the rings.
+  void FlushParking();
+
+  // (I/O THREAD) Take in the parking changes for @p state's clients.
+  static void UpdateParked(IoState* state);
+
+  // (ORDERING THREAD) Hand `unrouted_` to every router not yet given it.
+  // @return whether all have it.
+  bool HandOff();
+
+  // (ROUTER THREAD) Move what fits from @p state's backlog to the rings.
+  // @return whether the backlog is empty.
+  static bool FlushBacklog(RouterState* state);
+
+  const Config config_;
+  std::vector<std::unique_ptr<IoState>> io_;
+  std::vector<std::unique_ptr<RouterState>> routers_;
+
+  // Ordering stage state.
+  Sequencer sequencer_;
+  StepOutput unrouted_;
+  std::vector<bool> handed_to_;
+  uint64_t rejected_requests_ = 0;
+  // The requests of clients whose publication was refused, oldest (the
+  // refused one) first.
+  std::map<ClientId, std::deque<Request>> parked_;
+  // Per I/O thread, the parking changes that did not yet fit its ring.
+  std::vector<std::deque<Parking>> parking_backlog_;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,209 @@
+#include "sharded_sequencer.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace blocktopus {
+
+Shard::Shard(size_t index, const Sequencer::Config& config)
+    : index_(index), sequencer_(config),
+      latched_channels_(config.latched_channels) {}
+
+Status Shard::AddClient(ClientId client, Seq start, Seq* effective_start) {
+  // Other shards may already have advanced as far as this one announced.
+  return sequencer_.AddClient(client, std::max(start, announced_.value_or(0)),
+                              effective_start);
+}
+
+Status Shard::Subscribe(ClientId client,
+                        const std::optional<std::string>& channel, Seq seq,
+                        Seq* effective) {
+  const Status status = sequencer_.Subscribe(client, channel, seq, effective);
+  if (!status || interests_.contains(std::nullopt) ||
+      interests_.contains(channel) ||
+      (channel.has_value() && latched_channels_.contains(*channel))) {
+    return status;
+  }
+  // The bound is held until every peer has sent what it kept on the
+  // channel, none of which is final here yet.
+  interests_.insert(channel);
+  for (size_t peer = 0; peer < outbound_.size(); ++peer) {
+    if (outbound_[peer] == nullptr) continue;
+    Send(peer, Envelope{.kind = Envelope::Kind::kInterest,
+                        .bound = sequencer_.bound(), .channel = channel});
+    ++unanswered_;
+  }
+  return status;
+}
+
+bool Shard::Wants(size_t peer, const std::string& channel) const {
+  return latched_channels_.contains(channel) ||
+         peer_interests_[peer].contains(std::nullopt) ||
+         peer_interests_[peer].contains(channel);
+}
+
+bool Shard::HasRoom(size_t peer) const {
+  const Ring* ring = outbound_[peer];
+  return queued_[peer].empty() && ring->size() < ring->capacity();
+}
+
+void Shard::Send(size_t peer, Envelope&& envelope) {
+  if (queued_[peer].empty() && outbound_[peer]->TryPush(std::move(envelope))) {
+    return;
+  }
+  queued_[peer].push_back(std::move(envelope));
+}
+
+Status Shard::Publish(Message&& message) {
+  // Check first, so that the message is not published here only.
+  for (size_t peer = 0; peer < outbound_.size(); ++peer) {
+    if (outbound_[peer] != nullptr && Wants(peer, message.channel) &&
+        !HasRoom(peer)) {
+      return Status(StatusCode::kBackpressure, "Publish[shard ring full]");
+    }
+  }
+  const ClientId sender = message.sender;
+  std::shared_ptr<const Message> published;
+  const Status status = sequencer_.Publish(std::move(message), &published);
+  if (!status) return status;
+  const uint64_t publish_index = publish_counts_[sender]++;
+  for (size_t peer = 0; peer < outbound_.size(); ++peer) {
+    if (outbound_[peer] == nullptr) continue;
+    Envelope envelope{.kind = Envelope::Kind::kMessage, .message = published,
+                      .publish_index = publish_index};
+    if (Wants(peer, published->channel)) {
+      Send(peer, std::move(envelope));
+    } else {
+      withheld_[peer].push_back(std::move(envelope));
+    }
+  }
+  return Status::Ok();
+}
+
+void Shard::OnInterest(size_t peer, const Envelope& interest) {
+  peer_interests_[peer].insert(interest.channel);
+  Forget(peer, interest.bound);
+  std::vector<Envelope> still_withheld;
+  for (Envelope& envelope : withheld_[peer]) {
+    if (Wants(peer, envelope.message->channel)) {
+      Send(peer, std::move(envelope));
+    } else {
+      still_withheld.push_back(std::move(envelope));
+    }
+  }
+  withheld_[peer] = std::move(still_withheld);
+  Send(peer, Envelope{.kind = Envelope::Kind::kInterestAnswered});
+}
+
+void Shard::Forget(size_t peer, Seq bound) {
+  std::erase_if(withheld_[peer], [bound](const Envelope& envelope) {
+    return envelope.message->receive_seq <= bound;
+  });
+}
+
+std::optional<Seq> Shard::ClearToAnnounce() const {
+  std::optional<Seq> clear = sequencer_.local_clear();
+  if (!clear.has_value()) {
+    // With no clients of its own, a shard holds nothing back beyond what
+    // the others do.
+    for (size_t peer = 0; peer < peer_clears_.size(); ++peer) {
+      if (peer == index_) continue;
+      clear = std::min(clear.value_or(peer_clears_[peer]), peer_clears_[peer]);
+    }
+  }
+  if (!clear.has_value() || (announced_.has_value() && *clear <= *announced_)) {
+    return std::nullopt;
+  }
+  return clear;
+}
+
+Sequencer::Output Shard::Step(Status* status) {
+  for (size_t peer = 0; peer < outbound_.size(); ++peer) {
+    std::deque<Envelope>& queued = queued_[peer];
+    while (!queued.empty() && outbound_[peer]->TryPush(
+                                  std::move(queued.front()))) {
+      queued.pop_front();
+    }
+  }
+  Status result = Status::Ok();
+  for (size_t peer = 0; peer < inbound_.size(); ++peer) {
+    Ring* ring = inbound_[peer];
+    if (ring == nullptr) continue;
+    Envelope envelope;
+    while (ring->TryPop(&envelope)) {
+      Status relayed = Status::Ok();
+      switch (envelope.kind) {
+        case Envelope::Kind::kMessage:
+          relayed = sequencer_.Relay(std::move(envelope.message),
+                                     envelope.publish_index);
+          break;
+        case Envelope::Kind::kClear:
+          peer_clears_[peer] = envelope.clear;
+          relayed = sequencer_.SetPeerClear(peer, envelope.clear);
+          Forget(peer, envelope.bound);
+          break;
+        case Envelope::Kind::kInterest:
+          OnInterest(peer, envelope);
+          break;
+        case Envelope::Kind::kInterestAnswered:
+          if (unanswered_ == 0) {
+            relayed = Status(StatusCode::kProtocolError,
+                             "Step[unexpected answer]");
+          } else {
+            --unanswered_;
+          }
+          break;
+      }
+      if (result && !relayed) result = relayed;
+    }
+  }
+  if (const std::optional<Seq> clear = ClearToAnnounce(); clear.has_value()) {
+    // All or nothing; a full ring only delays the announcement.
+    bool room = true;
+    for (size_t peer = 0; peer < outbound_.size(); ++peer) {
+      if (outbound_[peer] != nullptr && !HasRoom(peer)) room = false;
+    }
+    if (room) {
+      for (size_t peer = 0; peer < outbound_.size(); ++peer) {
+        if (outbound_[peer] == nullptr) continue;
+        Send(peer, Envelope{.kind = Envelope::Kind::kClear, .clear = *clear,
+                            .bound = sequencer_.bound()});
+      }
+      announced_ = clear;
+    }
+  }
+  if (status != nullptr) *status = result;
+  if (unanswered_ > 0) return Sequencer::Output();
+  return sequencer_.Step();
+}
+
+ShardedSequencer::ShardedSequencer(const Config& config) {
+  const size_t n = std::max<size_t>(config.num_shards, 1);
+  for (size_t i = 0; i < n; ++i) {
+    shards_.emplace_back(new Shard(i, config.sequencer_config));
+  }
+  rings_.resize(n * n);
+  for (size_t from = 0; from < n; ++from) {
+    for (size_t to = 0; to < n; ++to) {
+      if (from != to) {
+        rings_[from * n + to] =
+            std::make_unique<Shard::Ring>(config.ring_capacity);
+      }
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    Shard& shard = *shards_[i];
+    shard.peer_clears_.assign(n, 0);
+    shard.peer_interests_.resize(n);
+    shard.withheld_.resize(n);
+    shard.queued_.resize(n);
+    for (size_t peer = 0; peer < n; ++peer) {
+      shard.outbound_.push_back(rings_[i * n + peer].get());
+      shard.inbound_.push_back(rings_[peer * n + i].get());
+      // Until a peer announces, its clients may send from the start.
+      if (peer != i) shard.sequencer_.SetPeerClear(peer, 0);
+    }
+  }
+}
+
+}  // namespace blocktopus
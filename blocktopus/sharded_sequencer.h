@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "sequencer.h"
+#include "spsc_ring.h"
+#include "status.h"
+
+/// @file A universe's ordering split across cores, sharing nothing.
+///
+/// One `Sequencer` for a whole universe is one lock (or one thread) that
+/// every connection contends for.  A `ShardedSequencer` instead splits the
+/// universe into shards, one per core, each owning a subset of the clients
+/// -- their connections, publications, subscriptions and clears -- with its
+/// own `Sequencer`.  The shards share no mutable state and take no locks.
+/// They communicate only through one `SpscRing` per ordered pair of shards,
+/// which carries:
+///
+///  * every message published on a shard, to be `Sequencer::Relay`ed to
+///    each other shard with a subscriber to its channel (the message is
+///    shared, not copied);
+///  * *interest*:  the channels (or every channel) the shard's clients have
+///    subscribed to, so that other shards know where to relay; and
+///  * *clear updates*:  the minimum clear of the shard's clients, which each
+///    other shard holds its bound to (`Sequencer::SetPeerClear`).
+///
+/// A shard announces a clear only after relaying every message published
+/// below it to every shard interested in it, and the rings are FIFO, so no
+/// shard's bound passes a message still in flight to it.  Messages a shard
+/// has not relayed to a peer are kept until that peer's bound passes them.
+/// When a shard first takes an interest in a channel, each peer relays
+/// whatever it kept on that channel, and the shard's `Step` delivers
+/// nothing (holding its bound) until every peer has answered.  Every shard
+/// therefore delivers exactly what a single sequencer would, in the same
+/// order.
+///
+/// Interest is never withdrawn:  unsubscribing (or removing the last
+/// subscriber) does not stop relaying, as messages up to the unsubscription
+/// are still owed.  Messages on latched channels go to every shard, so
+/// that each has the latest value for its late subscribers.
+///
+/// Each `Shard` must be driven by exactly one thread, and keep stepping while
+/// any other does:  what it sends may be waiting for room in a ring.  Client
+/// ids are owned by shard `client % num_shards`.  `Sequencer::Reset` has no
+/// sharded counterpart.
+
+namespace blocktopus {
+
+class ShardedSequencer;
+
+/// One shard of a `ShardedSequencer`.  Its methods mirror `Sequencer`'s,
+/// for the clients it owns.
+class Shard final {
+ public:
+  Shard(const Shard&) = delete;
+  Shard& operator=(const Shard&) = delete;
+
+  size_t index() const { return index_; }
+
+  /// As `Sequencer::AddClient`.  A client starts no earlier than the clear
+  /// this shard has already announced.
+  Status AddClient(ClientId client, Seq start, Seq* effective_start = nullptr);
+  Status AddObserver(ClientId client) {
+    return sequencer_.AddObserver(client);
+  }
+  void RemoveClient(ClientId client) { sequencer_.RemoveClient(client); }
+
+  /// As `Sequencer::Subscribe`.  The first subscription on this shard to a
+  /// channel (or to every channel) is announced to the other shards, and
+  /// `Step` delivers nothing until they have all answered.
+  Status Subscribe(ClientId client, const std::optional<std::string>& channel,
+                   Seq seq, Seq* effective);
+  Status Unsubscribe(ClientId client,
+                     const std::optional<std::string>& channel, Seq seq,
+                     Seq* effective) {
+    return sequencer_.Unsubscribe(client, channel, seq, effective);
+  }
+  Status ClearToAdvance(ClientId client, Seq clear_until) {
+    return sequencer_.ClearToAdvance(client, clear_until);
+  }
+
+  /// As `Sequencer::Publish`, and queue the message for every other shard
+  /// interested in its channel.  Also fails with `kBackpressure`, leaving
+  /// @p message unconsumed, if the ring to such a shard is full.
+  Status Publish(Message&& message);
+
+  /// Take in what the other shards have sent, announce this shard's clear,
+  /// and step its sequencer.  Deliveries and grants are to this shard's
+  /// clients only.
+  ///
+  /// @return (via @p status) `kProtocolError` if another shard broke the
+  /// relay protocol; the output is still valid.
+  Sequencer::Output Step(Status* status = nullptr);
+
+  Seq bound() const { return sequencer_.bound(); }
+
+ private:
+  friend class ShardedSequencer;
+
+  // What one shard sends another.
+  struct Envelope {
+    enum class Kind { kMessage, kClear, kInterest, kInterestAnswered };
+    Kind kind = Kind::kMessage;
+    // A message, and its index among its sender's publications.
+    std::shared_ptr<const Message> message;
+    uint64_t publish_index = 0;
+    // The sender's clear.
+    Seq clear = 0;
+    // The sender's bound, at or below which it needs no more messages.
+    Seq bound = 0;
+    // The channel (or every channel, if `nullopt`) of an interest.
+    std::optional<std::string> channel;
+  };
+  using Ring = SpscRing<Envelope>;
+  using ChannelSet = std::set<std::optional<std::string>, std::less<>>;
+
+  Shard(size_t index, const Sequencer::Config& config);
+
+  // @return the clear to announce, if any.
+  std::optional<Seq> ClearToAnnounce() const;
+
+  // Whether @p peer is to be sent messages on @p channel.
+  bool Wants(size_t peer, const std::string& channel) const;
+
+  // Whether @p peer's ring has room and nothing is queued for it.
+  bool HasRoom(size_t peer) const;
+
+  // Send @p envelope to @p peer after any queued before it.
+  void Send(size_t peer, Envelope&& envelope);
+
+  // Act on @p peer's @p interest in a channel.
+  void OnInterest(size_t peer, const Envelope& interest);
+
+  // Drop the messages kept for @p peer that are final there by @p bound.
+  void Forget(size_t peer, Seq bound);
+
+  const size_t index_;
+  Sequencer sequencer_;
+  const std::set<std::string> latched_channels_;
+  // Indexed by peer shard; null at this shard's own index.
+  std::vector<Ring*> outbound_;
+  std::vector<Ring*> inbound_;
+  std::optional<Seq> announced_;
+  // The latest clear announced by each peer.
+  std::vector<Seq> peer_clears_;
+
+  // The channels this shard has announced an interest in, and how many
+  // peers have yet to answer.
+  ChannelSet interests_;
+  size_t unanswered_ = 0;
+  // Per peer:  the channels it is interested in, the messages published
+  // here but not sent to it (in publication order), and the envelopes
+  // waiting for room in its ring.
+  std::vector<ChannelSet> peer_interests_;
+  std::vector<std::vector<Envelope>> withheld_;
+  std::vector<std::deque<Envelope>> queued_;
+  std::map<ClientId, uint64_t> publish_counts_;
+};
+
+class ShardedSequencer final {
+ public:
+  struct Config {
+    size_t num_shards = 1;
+    Sequencer::Config sequencer_config;
+    /// The capacity of each ring between two shards.
+    size_t ring_capacity = 4096;
+  };
+
+  explicit ShardedSequencer(const Config& config);
+
+  ShardedSequencer(const ShardedSequencer&) = delete;
+  ShardedSequencer& operator=(const ShardedSequencer&) = delete;
+
+  size_t num_shards() const { return shards_.size(); }
+
+  /// @return the index of the shard that owns @p client.
+  size_t ShardOf(ClientId client) const { return client % shards_.size(); }
+
+  Shard& shard(size_t index) { return *shards_[index]; }
+
+ private:
+  std::vector<std::unique_ptr<Shard>> shards_;
+  // rings_[from * num_shards + to]; null on the diagonal.
+  std::vector<std::unique_ptr<Shard::Ring>> rings_;
+};
+
+}  // namespace blocktopus
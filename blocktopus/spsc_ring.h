@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/// @file A bounded lock-free single-producer single-consumer queue.
+
+namespace blocktopus {
+
+/// A fixed-capacity FIFO that one thread pushes to and one (other) thread
+/// pops from, with no locks and no allocation after construction.
+///
+/// Neither end ever blocks:  `TryPush` fails if the ring is full and
+/// `TryPop` fails if it is empty, and it is up to the caller to decide
+/// whether to drop, retry, or back off.
+///
+/// @tparam T must be default-constructible and move-assignable.
+template <typename T>
+class SpscRing final {
+ public:
+  /// @param capacity is rounded up to a power of two.
+  explicit SpscRing(size_t capacity)
+      : slots_(std::bit_ceil(std::max<size_t>(capacity, 2))),
+        mask_(slots_.size() - 1) {}
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  /// (PRODUCER ONLY) @return false, leaving @p value untouched, if full.
+  bool TryPush(T&& value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == slots_.size()) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == slots_.size()) return false;
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// (CONSUMER ONLY) @return false, leaving @p value untouched, if empty.
+  bool TryPop(T* value) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return false;
+    }
+    *value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// (CONSUMER ONLY) @return the oldest element without removing it, or
+  /// nullptr if empty.
+  T* Front() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return nullptr;
+    }
+    return &slots_[head & mask_];
+  }
+
+  /// (CONSUMER ONLY) Remove the oldest element, which must exist (e.g. as
+  /// just returned by `Front`).
+  void PopFront() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    slots_[head & mask_] = T();
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  /// @return the number of elements; exact only when called from one of
+  /// the two ends while the other is idle.
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return slots_.size(); }
+
+ private:
+  std::vector<T> slots_;
+  const size_t mask_;
+
+  // Each index, and the other end's cached copy of it, lives on its own
+  // cache line so that the two threads do not false-share.
+  alignas(64) std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  alignas(64) std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+};
+
+}  // namespace blocktopus
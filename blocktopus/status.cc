@@ -0,0 +1,68 @@
+#include "status.h"
+
+#include "fmt/core.h"
+
+#include <cerrno>
+#include <cstring>
+
+namespace blocktopus {
+
+const char* StatusCodeName(StatusCode code) {
+  switch (code) {
+    case StatusCode::kOk: return "OK";
+    case StatusCode::kClosed: return "CLOSED";
+    case StatusCode::kConnectionReset: return "CONNECTION_RESET";
+    case StatusCode::kIoError: return "IO_ERROR";
+    case StatusCode::kProtocolError: return "PROTOCOL_ERROR";
+    case StatusCode::kBackpressure: return "BACKPRESSURE";
+  }
+  return "UNKNOWN";
+}
+
+Status Status::FromErrno(const char* what, int errno_value) {
+  switch (errno_value) {
+    case ECONNRESET:
+    case EPIPE:
+    case ECONNABORTED:
+    case ENOTCONN:
+      return Status(StatusCode::kConnectionReset, what, errno_value);
+    default:
+      return Status(StatusCode::kIoError, what, errno_value);
+  }
+}
+
+std::string Status::ToString() const {
+  if (system_errno_ == 0) {
+    return fmt::format("{}[{}]", StatusCodeName(code_), what_);
+  }
+  return fmt::format("{}[{} => {}]: {}", StatusCodeName(code_), what_,
+                     system_errno_, strerror(system_errno_));
+}
+
+void ErrorChannel::Post(const Status& status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ == ring_.size()) {
+    ++dropped_;
+    return;
+  }
+  ring_[(head_ + size_) % ring_.size()] = status;
+  ++size_;
+}
+
+std::vector<Status> ErrorChannel::Drain() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Status> result;
+  result.reserve(size_);
+  for (; size_ > 0; --size_) {
+    result.push_back(ring_[head_]);
+    head_ = (head_ + 1) % ring_.size();
+  }
+  return result;
+}
+
+size_t ErrorChannel::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+}  // namespace blocktopus
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// @file Lightweight error reporting for code on the I/O hot path.
+///
+/// Setup operations (binding, connecting, accepting) throw on failure, since
+/// there is nothing sensible to do but stop.  Once a connection is up,
+/// however, errors such as a peer resetting its connection are routine --
+/// RL episode churn produces them constantly -- and must cost no more than a
+/// return value:  no exception unwinding, no allocation, and no terminal I/O
+/// on the thread that hit them.  Such errors are returned as a `Status` and
+/// may additionally be posted to an `ErrorChannel` for some other thread to
+/// log or act upon.
+
+namespace blocktopus {
+
+enum class StatusCode : int {
+  kOk = 0,
+  /// The remote end closed the connection in an orderly way.
+  kClosed = 1,
+  /// The remote end reset the connection (ECONNRESET, EPIPE, ...).
+  kConnectionReset = 2,
+  /// Any other system call failure; see `Status::system_errno()`.
+  kIoError = 3,
+  /// The remote end sent data that violate the protocol.
+  kProtocolError = 4,
+  /// The operation cannot be accepted yet and should be retried later; its
+  /// arguments were not consumed.
+  kBackpressure = 5,
+};
+
+/// @return a short constant name for @p code.
+const char* StatusCodeName(StatusCode code);
+
+/// The result of an operation that can fail in routine ways.
+///
+/// A `Status` is a few words of plain data; `what` must point to a string
+/// with static storage duration (typically a literal naming the failed
+/// operation) so that creating a `Status` never allocates.  The human
+/// readable form is only built on demand by `ToString`.
+class Status final {
+ public:
+  /// A successful status.
+  Status() = default;
+
+  Status(StatusCode code, const char* what, int system_errno = 0)
+      : code_(code), what_(what), system_errno_(system_errno) {}
+
+  static Status Ok() { return Status(); }
+
+  /// @return a status classifying the failure of @p what with @p errno_value.
+  static Status FromErrno(const char* what, int errno_value);
+
+  bool ok() const { return code_ == StatusCode::kOk; }
+  explicit operator bool() const { return ok(); }
+
+  StatusCode code() const { return code_; }
+  const char* what() const { return what_; }
+  int system_errno() const { return system_errno_; }
+
+  /// (ALLOCATES) A human-readable description, for logging.
+  std::string ToString() const;
+
+ private:
+  StatusCode code_ = StatusCode::kOk;
+  const char* what_ = "";
+  int system_errno_ = 0;
+};
+
+/// A bounded, thread-safe queue of errors, for reporting errors from I/O
+/// threads to whichever thread is responsible for logging or recovery.
+///
+/// Posting never allocates (the queue is a ring allocated up front) and
+/// never blocks on anything but a short critical section; if the queue is
+/// full the status is dropped and counted instead.
+class ErrorChannel final {
+ public:
+  explicit ErrorChannel(size_t capacity = 1024) : ring_(capacity) {}
+
+  ErrorChannel(const ErrorChannel&) = delete;
+  ErrorChannel& operator=(const ErrorChannel&) = delete;
+
+  void Post(const Status& status);
+
+  /// @return (and remove) every status posted since the last call.
+  std::vector<Status> Drain();
+
+  /// @return the number of statuses dropped because the queue was full.
+  size_t dropped() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<Status> ring_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+  size_t dropped_ = 0;
+};
+
+}  // namespace blocktopus
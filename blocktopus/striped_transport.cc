@@ -0,0 +1,160 @@
+#include "striped_transport.h"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#include "encoding.h"
+
+namespace blocktopus {
+
+namespace {
+
+enum DatagramKind : uint8_t {
+  kWhole = 0,
+  kFragment = 1,
+};
+
+}  // namespace
+
+StripedTransport::StripedTransport(std::vector<Transport>&& streams,
+                                   const Config& config)
+    : config_(config), streams_(std::move(streams)) {
+  if (config_.fragment_size == 0) {
+    throw std::invalid_argument("StripedTransport needs a fragment_size");
+  }
+  if (streams_.empty()) {
+    throw std::invalid_argument("StripedTransport needs a stream");
+  }
+  io_wait_timeout_ms_ = streams_[0].config().io_wait_timeout_ms;
+  for (const Transport& stream : streams_) {
+    io_wait_timeout_ms_ =
+        std::min(io_wait_timeout_ms_, stream.config().io_wait_timeout_ms);
+  }
+  poll_fds_.resize(streams_.size());
+}
+
+void StripedTransport::Send(std::span<const uint8_t> datagram) {
+  if (datagram.size() < config_.min_striped_size) {
+    std::vector<uint8_t> whole;
+    whole.reserve(datagram.size() + 1);
+    whole.push_back(kWhole);
+    whole.insert(whole.end(), datagram.begin(), datagram.end());
+    streams_[0].Send(std::move(whole));
+    return;
+  }
+  const uint64_t message = next_message_sent_++;
+  const size_t num_bulk = std::max<size_t>(streams_.size() - 1, 1);
+  // An empty datagram still takes its message number, so it is sent as one
+  // empty fragment.
+  for (size_t offset = 0; offset < datagram.size() || offset == 0;
+       offset += config_.fragment_size) {
+    const auto bytes = datagram.subspan(
+        offset, std::min(config_.fragment_size, datagram.size() - offset));
+    std::vector<uint8_t> fragment;
+    fragment.reserve(bytes.size() + 32);
+    fragment.push_back(kFragment);
+    PutVarint(message, &fragment);
+    PutVarint(datagram.size(), &fragment);
+    PutVarint(offset, &fragment);
+    fragment.insert(fragment.end(), bytes.begin(), bytes.end());
+    streams_[streams_.size() - num_bulk + next_stream_].Send(
+        std::move(fragment));
+    next_stream_ = (next_stream_ + 1) % num_bulk;
+  }
+}
+
+Status StripedTransport::ProcessIO() {
+  Status result = Status::Ok();
+  bool made_progress = false;
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    bool stream_progress = false;
+    Status status = streams_[i].TryProcessIO(&stream_progress, &poll_fds_[i]);
+    made_progress |= stream_progress;
+    for (const auto& datagram : streams_[i].ReceiveAll()) {
+      Status accepted = Accept(std::span<const uint8_t>(
+          datagram->data.data(), datagram->payload_size));
+      if (status && !accepted) status = std::move(accepted);
+    }
+    if (result && !status) result = std::move(status);
+  }
+  // As `Transport::ProcessIO`, but on every stream at once.
+  if (result && !made_progress &&
+      poll(poll_fds_.data(), poll_fds_.size(), io_wait_timeout_ms_) < 0 &&
+      errno != EINTR) {
+    result = Status::FromErrno("poll", errno);
+  }
+  return result;
+}
+
+Status StripedTransport::Accept(std::span<const uint8_t> datagram) {
+  const Status malformed(StatusCode::kProtocolError,
+                         "StripedTransport[malformed datagram]");
+  if (datagram.empty()) return malformed;
+  if (datagram[0] == kWhole) {
+    control_received_.emplace_back(datagram.begin() + 1, datagram.end());
+    return Status::Ok();
+  }
+  ByteReader reader(datagram.subspan(1));
+  uint64_t message;
+  uint64_t size;
+  uint64_t offset;
+  if (datagram[0] != kFragment || !reader.GetVarint(&message) ||
+      !reader.GetVarint(&size) || !reader.GetVarint(&offset) ||
+      message < next_message_delivered_ ||
+      message - next_message_delivered_ >= config_.max_open_datagrams ||
+      size > config_.max_datagram_size || offset > size ||
+      reader.remaining() > size - offset ||
+      (reader.remaining() == 0 && size != 0)) {
+    return malformed;
+  }
+  const auto bytes = datagram.subspan(datagram.size() - reader.remaining());
+  auto [it, inserted] = assemblies_.try_emplace(message);
+  Assembly& assembly = it->second;
+  if (inserted) assembly.size = size;
+  if (assembly.size != size) return malformed;
+  // Count each byte once:  a fragment may not overlap (or repeat) another.
+  auto next = assembly.fragments.lower_bound(offset);
+  if ((next != assembly.fragments.end() &&
+       next->first < offset + std::max<size_t>(bytes.size(), 1)) ||
+      (next != assembly.fragments.begin() &&
+       std::prev(next)->first + std::prev(next)->second.size() > offset)) {
+    return malformed;
+  }
+  assembly.fragments.emplace_hint(next, offset,
+                                  std::vector<uint8_t>(bytes.begin(),
+                                                       bytes.end()));
+  assembly.bytes_received += bytes.size();
+  return Status::Ok();
+}
+
+std::vector<std::vector<uint8_t>> StripedTransport::ReceiveAll() {
+  std::vector<std::vector<uint8_t>> result(
+      std::make_move_iterator(control_received_.begin()),
+      std::make_move_iterator(control_received_.end()));
+  control_received_.clear();
+  for (auto it = assemblies_.begin();
+       it != assemblies_.end() && it->first == next_message_delivered_ &&
+       it->second.bytes_received == it->second.size;
+       it = assemblies_.erase(it)) {
+    auto& fragments = it->second.fragments;
+    if (fragments.size() == 1) {
+      result.push_back(std::move(fragments.begin()->second));
+    } else {
+      std::vector<uint8_t> data;
+      data.reserve(it->second.size);
+      for (const auto& [offset, bytes] : fragments) {
+        data.insert(data.end(), bytes.begin(), bytes.end());
+      }
+      result.push_back(std::move(data));
+    }
+    ++next_message_delivered_;
+  }
+  return result;
+}
+
+}  // namespace blocktopus
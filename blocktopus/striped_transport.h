@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <vector>
+
+#include "status.h"
+#include "transport.h"
+
+/// @file One logical connection over several `Transport`s.
+///
+/// A single TCP connection caps a client's throughput well below what a
+/// fast link can carry, and couples everything sent on it:  a control
+/// datagram queued behind a gigabyte of sensor data waits for all of it.
+/// A `StripedTransport` spreads one logical connection over several
+/// streams.  The first carries only small (control) datagrams; large
+/// datagrams are cut into fragments dealt round-robin across the others,
+/// and reassembled at the far end.
+///
+/// Small datagrams arrive in the order sent, as do large datagrams, but a
+/// small datagram may overtake a large one sent before it; that is the
+/// point.  Callers that need an order across the two (e.g. a control frame
+/// describing a bulk one) must carry it in the datagrams themselves, as the
+/// sequence numbers of the protocol already do.
+///
+/// On the wire each datagram starts with a kind byte.  A whole datagram
+/// follows it as is; a fragment carries varint bulk message number, total
+/// size, and offset, then its bytes.  An empty striped datagram is sent as
+/// one empty fragment.  The receiver holds only the fragments that have
+/// arrived, and refuses fragments that overlap one another or belong to a
+/// message too far ahead of the next one due.  Both ends must use a
+/// `StripedTransport` with the same number of streams, connected in the
+/// same order.  Like `Transport`, it is not thread-safe.
+
+namespace blocktopus {
+
+class StripedTransport final {
+ public:
+  struct Config {
+    /// Datagrams at least this large are striped across the bulk streams.
+    size_t min_striped_size = 64 << 10;
+    /// The size of each fragment of a striped datagram.  Must be positive.
+    size_t fragment_size = 64 << 10;
+    /// Larger striped datagrams are refused on receipt.
+    size_t max_datagram_size = 1 << 30;
+    /// Fragments of striped datagrams this many or more after the next one
+    /// due are refused on receipt.  Must exceed how far the bulk streams
+    /// can drift apart.
+    size_t max_open_datagrams = 4096;
+  };
+
+  /// Take over @p streams, which should be started (or startable) but not
+  /// otherwise in use.  `streams[0]` carries control datagrams and the rest
+  /// carry bulk; given only one stream, it carries both.  Throws if
+  /// @p config is invalid.
+  StripedTransport(std::vector<Transport>&& streams, const Config& config);
+
+  StripedTransport(const StripedTransport&) = delete;
+  StripedTransport& operator=(const StripedTransport&) = delete;
+
+  /// Queue @p datagram to be sent.  Sending is deferred until the next
+  /// `ProcessIO`.
+  void Send(std::span<const uint8_t> datagram);
+
+  /// (BLOCKING) Run one pass of sends and receives on every stream and
+  /// reassemble whatever arrived.  If no stream could move a byte, waits
+  /// on all of them at once, for up to the shortest of their
+  /// `io_wait_timeout_ms`, rather than on each in turn.
+  ///
+  /// @return OK, or the first failure of any stream, or `kProtocolError` if
+  /// a received datagram was malformed.
+  Status ProcessIO();
+
+  /// Take every datagram received and reassembled:  control datagrams
+  /// first, then bulk ones, each in the order sent.
+  std::vector<std::vector<uint8_t>> ReceiveAll();
+
+  size_t num_streams() const { return streams_.size(); }
+  Transport& stream(size_t i) { return streams_[i]; }
+
+ private:
+  // A striped datagram being reassembled.
+  struct Assembly {
+    size_t size = 0;
+    // The fragments received, by offset.  They never overlap.
+    std::map<uint64_t, std::vector<uint8_t>> fragments;
+    size_t bytes_received = 0;
+  };
+
+  // Accept one datagram received on any stream.
+  Status Accept(std::span<const uint8_t> datagram);
+
+  const Config config_;
+  std::vector<Transport> streams_;
+  int io_wait_timeout_ms_ = 0;
+  // What each stream is waiting for, refilled by every `ProcessIO`.
+  std::vector<struct pollfd> poll_fds_;
+  // The next bulk stream to send a fragment on.
+  size_t next_stream_ = 0;
+  uint64_t next_message_sent_ = 0;
+  uint64_t next_message_delivered_ = 0;
+  std::map<uint64_t, Assembly> assemblies_;
+  std::deque<std::vector<uint8_t>> control_received_;
+};
+
+}  // namespace blocktopus
@@ -0,0 +1,67 @@
+#include "blocktopus/delta_codec.h"
+
+#include <random>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+TEST(DeltaCodec, SlowlyChangingPayloadsShrinkAndRoundTrip) {
+  DeltaEncoder encoder({.keyframe_interval = 16});
+  DeltaDecoder decoder;
+  std::vector<uint8_t> grid(10000, 0);
+  std::mt19937 random(7);
+  for (int frame = 0; frame < 100; ++frame) {
+    for (int change = 0; change < 5; ++change) {
+      grid[random() % grid.size()] = random();
+    }
+    if (frame == 50) grid.resize(9000);
+    if (frame == 70) grid.resize(12000, 3);
+    std::vector<uint8_t> encoded;
+    encoder.Encode(grid, &encoded);
+    std::vector<uint8_t> decoded;
+    ASSERT_TRUE(decoder.Decode(encoded, &decoded));
+    ASSERT_EQ(decoded, grid) << "frame " << frame;
+  }
+  // Keyframes every 16 frames dominate; the rest cost a few dozen bytes.
+  EXPECT_LT(encoder.encoded_bytes() * 5, encoder.payload_bytes());
+}
+
+TEST(DeltaCodec, KeyframesAreScheduledByCountAndWhenCheaper) {
+  DeltaEncoder encoder({.keyframe_interval = 3});
+  std::vector<uint8_t> payload(100, 1);
+  std::vector<int> kinds;
+  for (int frame = 0; frame < 6; ++frame) {
+    std::vector<uint8_t> encoded;
+    encoder.Encode(payload, &encoded);
+    kinds.push_back(encoded[0]);
+  }
+  EXPECT_EQ(kinds, (std::vector<int>{0, 1, 1, 0, 1, 1}));
+
+  // A payload with nothing in common is sent whole.
+  std::vector<uint8_t> encoded;
+  encoder.Encode(std::vector<uint8_t>(100, 2), &encoded);
+  EXPECT_EQ(encoded[0], 0);
+  EXPECT_EQ(encoded.size(), 101);
+}
+
+TEST(DeltaCodec, DecoderRejectsDeltasWithoutAKeyframe) {
+  DeltaEncoder encoder({});
+  std::vector<uint8_t> first, second;
+  encoder.Encode(std::vector<uint8_t>(50, 1), &first);
+  encoder.Encode(std::vector<uint8_t>(50, 1), &second);
+  DeltaDecoder decoder;
+  std::vector<uint8_t> payload;
+  EXPECT_EQ(decoder.Decode(second, &payload).code(),
+            StatusCode::kProtocolError);
+  ASSERT_TRUE(decoder.Decode(first, &payload));
+  ASSERT_TRUE(decoder.Decode(second, &payload));
+  EXPECT_EQ(payload, std::vector<uint8_t>(50, 1));
+  second.push_back(9);  // A truncated run.
+  EXPECT_FALSE(decoder.Decode(second, &payload));
+  EXPECT_FALSE(decoder.Decode({}, &payload));
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,88 @@
+#include "blocktopus/dictionary_compression.h"
+
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+std::vector<uint8_t> MakeRecord(std::mt19937* random) {
+  const std::string text =
+      "{\"frame\":\"base_link\",\"x\":" + std::to_string((*random)() % 1000) +
+      ",\"y\":" + std::to_string((*random)() % 1000) +
+      ",\"theta\":" + std::to_string((*random)() % 360) +
+      ",\"covariance_valid\":true,\"status\":\"TRACKING\"}";
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+TEST(DictionaryCompression, SmallRecordsShrinkOnceTrained) {
+  ChannelCompressor compressor({.training_samples = 32});
+  ChannelDecompressor decompressor;
+  std::mt19937 random(3);
+  std::vector<uint8_t> payload;
+  for (int i = 0; i < 200; ++i) {
+    const std::vector<uint8_t> record = MakeRecord(&random);
+    std::vector<uint8_t> frame;
+    compressor.Compress(record, &frame);
+    EXPECT_EQ(compressor.dictionary() != nullptr, i >= 31);
+    if (i == 31) decompressor.AddDictionary(compressor.dictionary());
+    ASSERT_TRUE(decompressor.Decompress(frame, &payload));
+    ASSERT_EQ(payload, record);
+    if (i > 31) {
+      EXPECT_LT(frame.size() * 2, record.size());
+    }
+  }
+  EXPECT_LT(compressor.encoded_bytes(), compressor.payload_bytes());
+}
+
+TEST(DictionaryCompression, LargeAndUnrelatedPayloadsAreSentRaw) {
+  ChannelCompressor compressor({.max_payload_size = 100,
+                                .training_samples = 4});
+  const std::vector<uint8_t> sample(50, 'a');
+  std::vector<uint8_t> frame;
+  for (int i = 0; i < 4; ++i) compressor.Compress(sample, &frame);
+  ASSERT_NE(compressor.dictionary(), nullptr);
+
+  frame.clear();
+  compressor.Compress(std::vector<uint8_t>(101, 'a'), &frame);
+  EXPECT_EQ(frame.size(), 102);
+  frame.clear();
+  std::mt19937 random(5);
+  std::vector<uint8_t> noise(100);
+  for (uint8_t& byte : noise) byte = random();
+  compressor.Compress(noise, &frame);
+  EXPECT_EQ(frame.size(), 101);
+  EXPECT_EQ(frame[0], 0);
+}
+
+TEST(DictionaryCompression, DecompressorRequiresTheDictionary) {
+  ChannelCompressor compressor({.training_samples = 4});
+  std::mt19937 random(7);
+  std::vector<uint8_t> frame;
+  for (int i = 0; i < 4; ++i) compressor.Compress(MakeRecord(&random), &frame);
+  frame.clear();
+  compressor.Compress(MakeRecord(&random), &frame);
+  ASSERT_EQ(frame[0], 1);
+
+  ChannelDecompressor decompressor;
+  std::vector<uint8_t> payload;
+  EXPECT_EQ(decompressor.Decompress(frame, &payload).code(),
+            StatusCode::kProtocolError);
+  decompressor.AddDictionary(compressor.dictionary());
+  ASSERT_TRUE(decompressor.Decompress(frame, &payload));
+  frame.pop_back();
+  EXPECT_FALSE(decompressor.Decompress(frame, &payload));
+
+  // A decompressor expects nothing larger than its compressor compresses.
+  frame.clear();
+  compressor.Compress(MakeRecord(&random), &frame);
+  ChannelDecompressor small({.max_payload_size = 10});
+  small.AddDictionary(compressor.dictionary());
+  EXPECT_EQ(small.Decompress(frame, &payload).code(),
+            StatusCode::kProtocolError);
+}
+
+}  // namespace
+}  // namespace blocktopus
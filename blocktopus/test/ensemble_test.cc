@@ -0,0 +1,122 @@
+#include "blocktopus/ensemble.h"
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/test/test_messages.h"
+
+namespace blocktopus {
+namespace {
+
+Ensemble MakeEnsemble(size_t universes) {
+  return Ensemble(Ensemble::Config{.num_universes = universes});
+}
+
+TEST(Ensemble, LockstepSharesGrantsAndKeepsPayloadsApart) {
+  Ensemble ensemble({.num_universes = 3});
+  ASSERT_TRUE(ensemble.AddClient(1, 0));
+  ASSERT_TRUE(ensemble.AddClient(2, 0));
+  Seq effective;
+  ASSERT_TRUE(ensemble.Subscribe(2, "a", 0, &effective));
+
+  for (size_t u = 0; u < 3; ++u) {
+    ASSERT_TRUE(ensemble.Publish(
+        u, MakeMessage(1, "a", 0, 5, {static_cast<uint8_t>(u)})));
+    ASSERT_TRUE(ensemble.ClearToAdvance(u, 1, 10));
+    ASSERT_TRUE(ensemble.ClearToAdvance(u, 2, 10));
+  }
+  EXPECT_TRUE(ensemble.lockstep());
+  const Ensemble::Output output = ensemble.Step();
+  EXPECT_TRUE(output.lockstep);
+  ASSERT_EQ(output.shared_grants.size(), 2);
+  EXPECT_EQ(output.shared_grants[0].seq, 10);
+  EXPECT_TRUE(output.grants.empty());
+  for (size_t u = 0; u < 3; ++u) {
+    EXPECT_EQ(ensemble.bound(u), 10);
+    ASSERT_EQ(output.deliveries[u].size(), 1);
+    EXPECT_EQ(output.deliveries[u][0].recipient, 2);
+    EXPECT_EQ(output.deliveries[u][0].message->payload[0], u);
+  }
+  // Nothing moved, so nothing to grant.
+  EXPECT_TRUE(ensemble.Step().shared_grants.empty());
+}
+
+TEST(Ensemble, DivergentUniversesGetTheirOwnBounds) {
+  Ensemble ensemble({.num_universes = 2});
+  ASSERT_TRUE(ensemble.AddClient(1, 0));
+  ASSERT_TRUE(ensemble.AddClient(2, 0));
+  ASSERT_TRUE(ensemble.ClearToAdvance(0, 1, 10));
+  ASSERT_TRUE(ensemble.ClearToAdvance(0, 2, 10));
+  ASSERT_TRUE(ensemble.ClearToAdvance(1, 1, 4));
+  ASSERT_TRUE(ensemble.ClearToAdvance(1, 2, 10));
+  EXPECT_FALSE(ensemble.lockstep());
+  Ensemble::Output output = ensemble.Step();
+  EXPECT_FALSE(output.lockstep);
+  EXPECT_EQ(ensemble.bound(0), 10);
+  EXPECT_EQ(ensemble.bound(1), 4);
+  ASSERT_EQ(output.grants.size(), 2);
+  EXPECT_EQ(output.grants[1][0].seq, 4);
+
+  // Universe 1 catches up; the shared grant covers the universe that had
+  // not yet been granted 10 even though universe 0 had.
+  ASSERT_TRUE(ensemble.ClearToAdvance(1, 1, 10));
+  EXPECT_TRUE(ensemble.lockstep());
+  output = ensemble.Step();
+  ASSERT_EQ(output.shared_grants.size(), 2);
+  EXPECT_EQ(output.shared_grants[0].seq, 10);
+  EXPECT_EQ(ensemble.bound(1), 10);
+}
+
+TEST(Ensemble, RefusedPublicationsStillAdvanceTheirUniverse) {
+  Ensemble ensemble({.num_universes = 2,
+                     .sequencer_config = {.max_skew = 5}});
+  ASSERT_TRUE(ensemble.AddClient(1, 0));
+  ASSERT_TRUE(ensemble.AddClient(2, 0));
+  for (size_t u = 0; u < 2; ++u) {
+    ASSERT_TRUE(ensemble.ClearToAdvance(u, 2, 100));
+  }
+  // Each refusal moves universe 0's bound up to the limit, until the
+  // publication fits.
+  int refusals = 0;
+  Status status;
+  while ((status = ensemble.Publish(0, MakeMessage(1, "a", 12, 13)))
+             .code() == StatusCode::kBackpressure &&
+         refusals < 10) {
+    ++refusals;
+    ensemble.Step();
+  }
+  EXPECT_TRUE(status);
+  EXPECT_EQ(refusals, 2);
+  EXPECT_EQ(ensemble.bound(0), 10);
+  EXPECT_EQ(ensemble.bound(1), 0);
+}
+
+TEST(Ensemble, TopologyChangesAndResetApplyToAllUniverses) {
+  Ensemble ensemble = MakeEnsemble(2);
+  ASSERT_TRUE(ensemble.AddClient(1, 0));
+  ASSERT_TRUE(ensemble.AddClient(2, 0));
+  ASSERT_TRUE(ensemble.AddClient(3, 0));
+  EXPECT_EQ(ensemble.AddClient(2, 0).code(), StatusCode::kProtocolError);
+  ASSERT_TRUE(ensemble.ClearToAdvance(1, 1, 3));
+  EXPECT_FALSE(ensemble.lockstep());
+
+  // Removing the only divergent client restores lockstep.
+  ensemble.RemoveClient(1);
+  EXPECT_TRUE(ensemble.lockstep());
+  for (size_t u = 0; u < 2; ++u) {
+    ASSERT_TRUE(ensemble.ClearToAdvance(u, 2, 7));
+    ASSERT_TRUE(ensemble.ClearToAdvance(u, 3, 8));
+  }
+  ensemble.Step();
+  EXPECT_EQ(ensemble.bound(0), 7);
+  EXPECT_EQ(ensemble.bound(1), 7);
+
+  ASSERT_TRUE(ensemble.ClearToAdvance(0, 3, 20));
+  ensemble.Reset(0);
+  EXPECT_TRUE(ensemble.lockstep());
+  EXPECT_EQ(ensemble.bound(0), 0);
+  ASSERT_TRUE(ensemble.Publish(1, MakeMessage(2, "a", 0, 2)));
+  EXPECT_FALSE(ensemble.Publish(2, MakeMessage(2, "a", 0, 2)));
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,106 @@
+#include "blocktopus/fair_scheduler.h"
+
+#include <map>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+std::vector<uint8_t> Frame(size_t size, uint8_t tag = 0) {
+  return std::vector<uint8_t>(size, tag);
+}
+
+TEST(DeficitRoundRobin, BurstsDoNotStarveControlFrames) {
+  DeficitRoundRobin scheduler({.quantum_bytes = 16 << 10});
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(scheduler.Enqueue(1, Frame(10 << 10, i)));
+  }
+  ASSERT_TRUE(scheduler.Enqueue(2, Frame(20)));
+  std::vector<std::pair<ClientId, size_t>> served;
+  std::vector<uint8_t> tags;
+  const auto record = [&](ClientId client, std::vector<uint8_t>&& frame) {
+    served.emplace_back(client, frame.size());
+    if (client == 1) tags.push_back(frame[0]);
+  };
+  // Even with a small budget the control frame goes out in the first round.
+  scheduler.Serve(12 << 10, record);
+  ASSERT_GE(served.size(), 2);
+  EXPECT_EQ(served[0], std::make_pair(ClientId{1}, size_t{10 << 10}));
+  EXPECT_EQ(served[1], std::make_pair(ClientId{2}, size_t{20}));
+
+  // Client 1's frames are still served in order.
+  scheduler.Serve(SIZE_MAX, record);
+  ASSERT_EQ(tags.size(), 100);
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(tags[i], i);
+  EXPECT_EQ(scheduler.queued_bytes(), 0);
+}
+
+TEST(DeficitRoundRobin, SharesBytesNotFramesAndCapsFramesPerTurn) {
+  DeficitRoundRobin scheduler({.quantum_bytes = 1000,
+                               .max_frames_per_turn = 4});
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(scheduler.Enqueue(1, Frame(100)));
+    ASSERT_TRUE(scheduler.Enqueue(2, Frame(1000)));
+    ASSERT_TRUE(scheduler.Enqueue(3, Frame(10)));
+  }
+  std::map<ClientId, size_t> bytes;
+  std::map<ClientId, size_t> frames;
+  std::vector<ClientId> order;
+  scheduler.Serve(100000, [&](ClientId client, std::vector<uint8_t>&& frame) {
+    bytes[client] += frame.size();
+    ++frames[client];
+    if (order.empty() || order.back() != client) order.push_back(client);
+  });
+  // Clients 1 and 2 are limited only by bytes, and client 3 by frames.
+  EXPECT_NEAR(static_cast<double>(bytes[1]) / bytes[2], 0.4, 0.05);
+  EXPECT_NEAR(static_cast<double>(frames[3]) / frames[1], 1.0, 0.05);
+  // Strict rotation.
+  for (size_t i = 3; i < order.size(); ++i) EXPECT_EQ(order[i], order[i - 3]);
+}
+
+TEST(DeficitRoundRobin, BackpressureRemovalAndOversizedFrames) {
+  DeficitRoundRobin scheduler({.quantum_bytes = 100, .max_queued_bytes = 250});
+  ASSERT_TRUE(scheduler.Enqueue(1, Frame(250)));  // Larger than a quantum.
+  std::vector<uint8_t> refused = Frame(10, 7);
+  EXPECT_EQ(scheduler.Enqueue(1, std::move(refused)).code(),
+            StatusCode::kBackpressure);
+  EXPECT_EQ(refused.size(), 10);
+
+  ASSERT_TRUE(scheduler.Enqueue(2, Frame(50)));
+  ASSERT_TRUE(scheduler.Enqueue(3, Frame(50)));
+  scheduler.RemoveClient(3);
+  EXPECT_EQ(scheduler.queued_bytes(), 300);
+
+  std::vector<ClientId> served;
+  scheduler.Serve(SIZE_MAX, [&](ClientId client, std::vector<uint8_t>&&) {
+    served.push_back(client);
+  });
+  // Client 1 saves up for three turns.
+  EXPECT_EQ(served, (std::vector<ClientId>{2, 1}));
+  EXPECT_EQ(scheduler.queued_bytes(1), 0);
+}
+
+TEST(DeficitRoundRobin, PausedClientsKeepTheirFrames) {
+  DeficitRoundRobin scheduler({.quantum_bytes = 100});
+  ASSERT_TRUE(scheduler.Enqueue(1, Frame(10)));
+  scheduler.Pause(1);
+  ASSERT_TRUE(scheduler.Enqueue(1, Frame(10)));
+  ASSERT_TRUE(scheduler.Enqueue(2, Frame(10)));
+  std::vector<ClientId> served;
+  const auto record = [&](ClientId client, std::vector<uint8_t>&&) {
+    served.push_back(client);
+  };
+  scheduler.Serve(SIZE_MAX, record);
+  EXPECT_EQ(served, (std::vector<ClientId>{2}));
+  EXPECT_EQ(scheduler.queued_bytes(1), 20);
+
+  scheduler.Resume(1);
+  scheduler.Serve(SIZE_MAX, record);
+  EXPECT_EQ(served, (std::vector<ClientId>{2, 1, 1}));
+  EXPECT_EQ(scheduler.queued_bytes(), 0);
+}
+
+}  // namespace
+}  // namespace blocktopus
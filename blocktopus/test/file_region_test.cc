@@ -0,0 +1,60 @@
+#include "blocktopus/file_region.h"
+
+#include <unistd.h>
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+std::string WriteTestFile(size_t size) {
+  const std::string path = ::testing::TempDir() + "/file_region_test." +
+                           std::to_string(getpid());
+  std::ofstream out(path, std::ios::binary);
+  for (size_t i = 0; i < size; ++i) out.put(static_cast<char>(i % 251));
+  return path;
+}
+
+TEST(FileRegion, RefRoundTrips) {
+  const FileRegionRef ref{.path = "/maps/site.bin", .offset = 4096,
+                          .length = 1 << 30};
+  std::vector<uint8_t> encoded;
+  SerializeFileRegionRef(ref, &encoded);
+  const std::optional<FileRegionRef> decoded = ParseFileRegionRef(encoded);
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_EQ(decoded->path, ref.path);
+  EXPECT_EQ(decoded->offset, ref.offset);
+  EXPECT_EQ(decoded->length, ref.length);
+  encoded.pop_back();
+  EXPECT_FALSE(ParseFileRegionRef(encoded).has_value());
+}
+
+TEST(FileRegion, MapsAnUnalignedRegion) {
+  const std::string path = WriteTestFile(20000);
+  const auto region =
+      FileRegion::Open({.path = path, .offset = 5000, .length = 10000});
+  const MappedFileRegion mapped = region->Map();
+  ASSERT_EQ(mapped.bytes().size(), 10000);
+  for (size_t i = 0; i < mapped.bytes().size(); ++i) {
+    ASSERT_EQ(mapped.bytes()[i], (5000 + i) % 251);
+  }
+  unlink(path.c_str());
+}
+
+TEST(FileRegion, OpenRejectsMissingFilesAndBadRanges) {
+  const std::string path = WriteTestFile(100);
+  EXPECT_THROW(FileRegion::Open({.path = path, .offset = 50, .length = 51}),
+               std::runtime_error);
+  // A range whose end wraps around is out of range too.
+  EXPECT_THROW(FileRegion::Open({.path = path, .offset = 50,
+                                 .length = UINT64_MAX - 10}),
+               std::runtime_error);
+  EXPECT_THROW(FileRegion::Open({.path = path + ".missing", .length = 1}),
+               std::runtime_error);
+  unlink(path.c_str());
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,106 @@
+#include "blocktopus/latest_value_channel.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+std::string UniqueName(const std::string& what) {
+  return "/blocktopus_test." + what + "." + std::to_string(getpid());
+}
+
+std::vector<uint8_t> Value(Seq seq, size_t size) {
+  return std::vector<uint8_t>(size, static_cast<uint8_t>(seq));
+}
+
+TEST(LatestValueChannel, ReadsTheVersionValidAtTheReadersSeq) {
+  const std::string name = UniqueName("versions");
+  LatestValueChannel writer =
+      LatestValueChannel::Create({.name = name, .slot_count = 4,
+                                  .max_value_size = 16});
+  LatestValueChannel reader = LatestValueChannel::Open(name);
+  LatestValueChannel::Unlink(name);
+  EXPECT_EQ(reader.slot_count(), 4);
+
+  ASSERT_TRUE(writer.Write(10, Value(10, 3)));
+  ASSERT_TRUE(writer.Write(20, Value(20, 5)));
+  ASSERT_TRUE(writer.Write(30, Value(30, 7)));
+  EXPECT_FALSE(writer.Write(30, Value(30, 1)));
+  EXPECT_FALSE(writer.Write(40, Value(40, 17)));
+
+  std::vector<uint8_t> value;
+  Seq version;
+  // Nothing is visible until the server says so.
+  EXPECT_EQ(reader.Read(25, &value, &version).code(),
+            StatusCode::kBackpressure);
+  writer.SetVisibleThrough(25);
+  ASSERT_TRUE(reader.Read(25, &value, &version));
+  EXPECT_EQ(version, 20);
+  EXPECT_EQ(value, Value(20, 5));
+  ASSERT_TRUE(reader.Read(10, &value, &version));
+  EXPECT_EQ(version, 10);
+  EXPECT_EQ(reader.Read(9, &value, &version).code(),
+            StatusCode::kProtocolError);
+  // Version 30 exists but is not yet visible at 25.
+  EXPECT_EQ(reader.Read(30, &value, &version).code(),
+            StatusCode::kBackpressure);
+
+  // Old versions are overwritten once the ring wraps.
+  for (Seq seq = 40; seq <= 70; seq += 10) {
+    ASSERT_TRUE(writer.Write(seq, Value(seq, 2)));
+  }
+  writer.SetVisibleThrough(100);
+  EXPECT_EQ(reader.Read(25, &value, &version).code(),
+            StatusCode::kProtocolError);
+  ASSERT_TRUE(reader.Read(100, &value, &version));
+  EXPECT_EQ(version, 70);
+
+  // Versions at or below the visible mark would race with readers there.
+  EXPECT_EQ(writer.Write(100, Value(100, 1)).code(),
+            StatusCode::kProtocolError);
+  ASSERT_TRUE(writer.Write(101, Value(101, 1)));
+}
+
+TEST(LatestValueChannel, ConcurrentReadsAreNeverTorn) {
+  const std::string name = UniqueName("torn");
+  LatestValueChannel writer =
+      LatestValueChannel::Create({.name = name, .slot_count = 2,
+                                  .max_value_size = 4096});
+  LatestValueChannel reader = LatestValueChannel::Open(name);
+  LatestValueChannel::Unlink(name);
+  ASSERT_TRUE(writer.Write(0, Value(0, 4096)));
+  writer.SetVisibleThrough(0);
+
+  std::atomic<bool> done = false;
+  std::thread writing([&]() {
+    for (Seq seq = 1; seq < 20000; ++seq) {
+      ASSERT_TRUE(writer.Write(seq, Value(seq, 1 + seq % 4096)));
+      writer.SetVisibleThrough(seq);
+    }
+    done = true;
+  });
+  std::vector<uint8_t> value;
+  Seq version;
+  while (!done) {
+    const Status status =
+        reader.Read(reader.visible_through(), &value, &version);
+    // The writer may lap the reader and overwrite the version it wants.
+    if (status.code() == StatusCode::kProtocolError) continue;
+    ASSERT_TRUE(status);
+    ASSERT_EQ(value, Value(version, version == 0 ? 4096 : 1 + version % 4096));
+  }
+  writing.join();
+}
+
+TEST(LatestValueChannel, OpeningAMissingChannelThrows) {
+  EXPECT_THROW(LatestValueChannel::Open(UniqueName("missing")),
+               std::runtime_error);
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,84 @@
+#include "blocktopus/launcher.h"
+
+#include <signal.h>
+
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+// A component that echoes everything back down its inherited socket.
+const std::vector<std::string> kEchoComponent = {
+  "/bin/sh", "-c",
+  "exec cat <&\"$BLOCKTOPUS_TRANSPORT_FD\" >&\"$BLOCKTOPUS_TRANSPORT_FD\""};
+
+TEST(Launcher, EchoOverInheritedSocket) {
+  LaunchedComponent component = LaunchComponent(kEchoComponent, {});
+  EXPECT_GT(component.pid, 0);
+  std::string data = "ping";
+  component.transport.Send(std::vector<uint8_t>(data.begin(), data.end()));
+  std::vector<std::unique_ptr<Transport::RxBuffer>> received;
+  for (int i = 0; i < 10000 && received.empty(); ++i) {
+    ASSERT_TRUE(component.transport.ProcessIO());
+    received = component.transport.ReceiveAll();
+  }
+  ASSERT_EQ(received.size(), 1);
+  EXPECT_EQ(std::string(received[0]->data.begin(), received[0]->data.end()),
+            data);
+
+  // Closing our end gives the component EOF, and it exits cleanly.
+  const pid_t pid = component.pid;
+  { Transport closing = std::move(component.transport); }
+  EXPECT_EQ(AwaitComponentExit(pid), 0);
+}
+
+TEST(Launcher, ManyComponents) {
+  std::vector<LaunchedComponent> components;
+  for (int i = 0; i < 8; ++i) {
+    components.push_back(LaunchComponent(kEchoComponent, {}));
+  }
+  for (size_t i = 0; i < components.size(); ++i) {
+    components[i].transport.Send({static_cast<uint8_t>(i)});
+  }
+  for (size_t i = 0; i < components.size(); ++i) {
+    std::vector<std::unique_ptr<Transport::RxBuffer>> received;
+    while (received.empty()) {
+      ASSERT_TRUE(components[i].transport.ProcessIO());
+      received = components[i].transport.ReceiveAll();
+    }
+    ASSERT_EQ(received.size(), 1);
+    EXPECT_EQ(received[0]->data, std::vector<uint8_t>{static_cast<uint8_t>(i)});
+  }
+  std::vector<pid_t> pids;
+  for (LaunchedComponent& component : components) {
+    pids.push_back(component.pid);
+  }
+  components.clear();
+  for (pid_t pid : pids) EXPECT_EQ(AwaitComponentExit(pid), 0);
+}
+
+TEST(Launcher, ComponentHoldsOnlyItsOwnDescriptor) {
+  // Once the component closes its descriptor the socket must be closed,
+  // even though the component lives on.
+  LaunchedComponent component = LaunchComponent(
+      {"/bin/sh", "-c", "exec 3>&-; exec sleep 30"}, {});
+  Status status;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (status.ok() && std::chrono::steady_clock::now() < deadline) {
+    status = component.transport.ProcessIO();
+  }
+  EXPECT_EQ(status.code(), StatusCode::kClosed);
+  kill(component.pid, SIGKILL);
+  EXPECT_EQ(AwaitComponentExit(component.pid), 128 + SIGKILL);
+}
+
+TEST(Launcher, MissingProgramThrows) {
+  EXPECT_THROW(LaunchComponent({"/nonexistent/blocktopus/component"}, {}),
+               std::runtime_error);
+}
+
+}  // namespace
+}  // namespace blocktopus
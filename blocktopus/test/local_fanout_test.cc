@@ -0,0 +1,96 @@
+#include "blocktopus/local_fanout.h"
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/test/test_messages.h"
+
+namespace blocktopus {
+namespace {
+
+using Kind = LocalFanout::WireRequest::Kind;
+
+TEST(LocalFanout, OneWireSubscriptionServesEveryLocalSubscriber) {
+  LocalFanout fanout;
+  std::vector<LocalFanout::WireRequest> wire;
+  EXPECT_EQ(fanout.Subscribe(1, "camera", 0, &wire), 0);
+  EXPECT_EQ(fanout.Subscribe(2, "camera", 0, &wire), 0);
+  EXPECT_EQ(fanout.Subscribe(3, std::nullopt, 0, &wire), 0);
+  ASSERT_EQ(wire.size(), 2);
+  EXPECT_EQ(wire[0].kind, Kind::kSubscribe);
+  EXPECT_EQ(wire[0].channel, "camera");
+  EXPECT_EQ(wire[1].channel, std::nullopt);
+
+  const auto frame =
+      Share(MakeMessage(1, "camera", 4, 5, PatternPayload(1000)));
+  fanout.OnDelivery(frame);
+  for (LocalFanout::LocalId subscriber : {1, 2, 3}) {
+    const auto taken = fanout.Take(subscriber);
+    ASSERT_EQ(taken.size(), 1);
+    EXPECT_EQ(taken[0].get(), frame.get());  // Shared, not copied.
+  }
+  EXPECT_EQ(fanout.shared_deliveries(), 2);
+  EXPECT_TRUE(fanout.Take(1).empty());
+}
+
+TEST(LocalFanout, LateSubscribersStartAfterDeliveredMessages) {
+  LocalFanout fanout;
+  std::vector<LocalFanout::WireRequest> wire;
+  fanout.Subscribe(1, "camera", 0, &wire);
+  fanout.OnGrant(4);
+  fanout.OnDelivery(
+      Share(MakeMessage(1, "camera", 5, 6, PatternPayload(1000))));
+  // Message 6 has been fanned out already, so subscriber 2 cannot be
+  // promised it.
+  EXPECT_EQ(fanout.Subscribe(2, "camera", 4, &wire), 6);
+  fanout.OnDelivery(
+      Share(MakeMessage(1, "camera", 6, 7, PatternPayload(1000))));
+  EXPECT_EQ(fanout.Take(1).size(), 2);
+  ASSERT_EQ(fanout.Take(2).size(), 1);
+  EXPECT_EQ(fanout.Unsubscribe(1, "camera", 5, &wire), 7);
+}
+
+TEST(LocalFanout, EachSubscriberKeepsItsOwnWindow) {
+  LocalFanout fanout;
+  std::vector<LocalFanout::WireRequest> wire;
+  fanout.Subscribe(1, "camera", 0, &wire);
+  fanout.OnDelivery(
+      Share(MakeMessage(1, "camera", 2, 3, PatternPayload(1000))));
+  fanout.OnGrant(4);
+  // A late joiner starts after what the process has already been given.
+  EXPECT_EQ(fanout.Subscribe(2, "camera", 2, &wire), 4);
+  EXPECT_EQ(wire.size(), 1);
+  fanout.OnDelivery(
+      Share(MakeMessage(1, "camera", 5, 6, PatternPayload(1000))));
+  EXPECT_EQ(fanout.Take(1).size(), 2);
+  EXPECT_EQ(fanout.Take(2).size(), 1);
+
+  // Only the last local unsubscription reaches the wire, lasting as long
+  // as the longest local one.
+  EXPECT_EQ(fanout.Unsubscribe(2, "camera", 10, &wire), 10);
+  EXPECT_EQ(wire.size(), 1);
+  EXPECT_EQ(fanout.Unsubscribe(1, "camera", 8, &wire), 8);
+  ASSERT_EQ(wire.size(), 2);
+  EXPECT_EQ(wire[1].kind, Kind::kUnsubscribe);
+  EXPECT_EQ(wire[1].seq, 10);
+  EXPECT_FALSE(fanout.Unsubscribe(1, "camera", 8, &wire).has_value());
+
+  fanout.OnDelivery(
+      Share(MakeMessage(1, "camera", 8, 9, PatternPayload(1000))));
+  EXPECT_TRUE(fanout.Take(1).empty());
+  EXPECT_EQ(fanout.Take(2).size(), 1);
+}
+
+TEST(LocalFanout, WireReplyRaisesPendingStarts) {
+  LocalFanout fanout;
+  std::vector<LocalFanout::WireRequest> wire;
+  fanout.Subscribe(1, "map", 0, &wire);
+  fanout.Subscribe(2, "map", 0, &wire);
+  fanout.OnWireSubscribed("map", 7);
+  fanout.OnDelivery(Share(MakeMessage(1, "map", 5, 6, PatternPayload(1000))));
+  fanout.OnDelivery(Share(MakeMessage(1, "map", 7, 8, PatternPayload(1000))));
+  EXPECT_EQ(fanout.Take(1).size(), 1);
+  EXPECT_EQ(fanout.Take(2).size(), 1);
+}
+
+}  // namespace
+}  // namespace blocktopus
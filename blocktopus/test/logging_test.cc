@@ -0,0 +1,103 @@
+#include "blocktopus/logging.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+// Route the log to a temporary file for the duration of a test and return
+// what was written to it.
+class LogCapture {
+ public:
+  LogCapture() : file_(std::tmpfile()) { SetLogSink(file_); }
+  ~LogCapture() {
+    FlushLog();
+    SetLogSink(stderr);
+    FlushLog();
+    std::fclose(file_);
+  }
+
+  std::string Contents() {
+    FlushLog();
+    std::string result;
+    std::rewind(file_);
+    char buffer[4096];
+    size_t size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file_)) > 0) {
+      result.append(buffer, size);
+    }
+    return result;
+  }
+
+ private:
+  std::FILE* file_;
+};
+
+TEST(Logging, FormatsDeferredArguments) {
+  LogCapture capture;
+  std::string text = "hello";
+  LogInfo("{} {} {:.1f}", text, 42, 2.5);
+  text = "mutated after logging";
+  const std::string contents = capture.Contents();
+  EXPECT_NE(contents.find("hello 42 2.5"), std::string::npos) << contents;
+  EXPECT_NE(contents.find("[INFO "), std::string::npos) << contents;
+}
+
+TEST(Logging, CopiesCStrings) {
+  LogCapture capture;
+  char buffer[16];
+  std::strcpy(buffer, "original");
+  LogWarning("{}", static_cast<const char*>(buffer));
+  std::strcpy(buffer, "clobbered");
+  const std::string contents = capture.Contents();
+  EXPECT_NE(contents.find("original"), std::string::npos) << contents;
+}
+
+TEST(Logging, MinLevelFilters) {
+  LogCapture capture;
+  LogDebug("invisible");
+  SetMinLogLevel(LogLevel::kDebug);
+  LogDebug("visible");
+  SetMinLogLevel(LogLevel::kInfo);
+  const std::string contents = capture.Contents();
+  EXPECT_EQ(contents.find("invisible"), std::string::npos) << contents;
+  EXPECT_NE(contents.find("visible"), std::string::npos) << contents;
+}
+
+TEST(Logging, OversizedArgumentsFormatEagerly) {
+  LogCapture capture;
+  std::array<std::string, 20> many;
+  many.fill("x");
+  LogError("{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}",
+           many[0], many[1], many[2], many[3], many[4], many[5], many[6],
+           many[7], many[8], many[9], many[10], many[11], many[12], many[13],
+           many[14], many[15], many[16], many[17], many[18], many[19]);
+  const std::string contents = capture.Contents();
+  EXPECT_NE(contents.find(std::string(20, 'x')), std::string::npos)
+      << contents;
+}
+
+TEST(Logging, ManyThreads) {
+  LogCapture capture;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < 100; ++i) LogInfo("thread {} line {}", t, i);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  const std::string contents = capture.Contents();
+  for (int t = 0; t < 4; ++t) {
+    EXPECT_NE(contents.find(fmt::format("thread {} line 99", t)),
+              std::string::npos);
+  }
+}
+
+}  // namespace
+}  // namespace blocktopus
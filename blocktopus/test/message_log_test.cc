@@ -0,0 +1,154 @@
+#include "blocktopus/message_log.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+std::vector<Message> SampleMessages() {
+  std::vector<Message> result;
+  for (int i = 0; i < 100; ++i) {
+    result.push_back(Message{
+      .sender = static_cast<ClientId>(i % 3),
+      .channel = (i % 2) ? "camera" : "joints",
+      .send_seq = 10 * i,
+      .receive_seq = 10 * i + 5,
+      .payload = std::vector<uint8_t>(1000, static_cast<uint8_t>(i))});
+  }
+  return result;
+}
+
+std::string TempPath(const std::string& name) {
+  return testing::TempDir() + "/" + name;
+}
+
+TEST(MessageLog, RowLogRoundTrip) {
+  const std::string path = TempPath("row_round_trip.log");
+  const std::vector<Message> messages = SampleMessages();
+  {
+    MessageLogWriter writer(path);
+    for (const Message& message : messages) writer.Append(message);
+  }
+  const std::vector<Message> read = ReadMessageLog(path);
+  ASSERT_EQ(read.size(), messages.size());
+  for (size_t i = 0; i < read.size(); ++i) {
+    EXPECT_EQ(read[i].sender, messages[i].sender);
+    EXPECT_EQ(read[i].channel, messages[i].channel);
+    EXPECT_EQ(read[i].send_seq, messages[i].send_seq);
+    EXPECT_EQ(read[i].receive_seq, messages[i].receive_seq);
+    EXPECT_EQ(read[i].payload, messages[i].payload);
+  }
+}
+
+TEST(MessageLog, CompactRoundTrip) {
+  const std::string row_path = TempPath("compact_in.log");
+  const std::string columnar_path = TempPath("compact_out.log");
+  const std::vector<Message> messages = SampleMessages();
+  {
+    MessageLogWriter writer(row_path);
+    for (const Message& message : messages) writer.Append(message);
+  }
+  CompactLog(row_path, columnar_path);
+  EXPECT_LT(std::filesystem::file_size(columnar_path),
+            std::filesystem::file_size(row_path));
+
+  ColumnarLogReader reader(columnar_path);
+  ASSERT_EQ(reader.size(), messages.size());
+  const std::vector<Message> read = reader.ReadMessages();
+  ASSERT_EQ(read.size(), messages.size());
+  for (size_t i = 0; i < read.size(); ++i) {
+    EXPECT_EQ(read[i].sender, messages[i].sender);
+    EXPECT_EQ(read[i].channel, messages[i].channel);
+    EXPECT_EQ(read[i].send_seq, messages[i].send_seq);
+    EXPECT_EQ(read[i].receive_seq, messages[i].receive_seq);
+    EXPECT_EQ(read[i].payload, messages[i].payload);
+  }
+}
+
+TEST(MessageLog, HeaderScanSkipsPayloads) {
+  const std::string path = TempPath("header_scan.log");
+  const std::vector<Message> messages = SampleMessages();
+  WriteColumnarLog(messages, path);
+
+  ColumnarLogReader reader(path);
+  const std::vector<MessageHeader> headers = reader.ReadHeaders();
+  ASSERT_EQ(headers.size(), messages.size());
+  EXPECT_EQ(headers[7].channel, "camera");
+  EXPECT_EQ(headers[7].receive_seq, 75);
+  EXPECT_EQ(headers[7].payload_size, 1000);
+  // 100KB of payload are never touched.
+  EXPECT_LT(reader.bytes_read(), 2000);
+
+  ColumnarLogReader seq_reader(path);
+  const std::vector<Seq> send_seqs = seq_reader.ReadSendSeqs();
+  EXPECT_EQ(send_seqs.back(), 990);
+  EXPECT_LT(seq_reader.bytes_read(), 500);
+}
+
+TEST(MessageLog, CompactStreamsLargeLogs) {
+  const std::string row_path = TempPath("large_in.log");
+  const std::string columnar_path = TempPath("large_out.log");
+  // Several times the in-memory column buffer.
+  constexpr int kNumMessages = 5000;
+  {
+    MessageLogWriter writer(row_path);
+    for (int i = 0; i < kNumMessages; ++i) {
+      writer.Append(Message{
+        .sender = static_cast<ClientId>(i % 7),
+        .channel = "channel" + std::to_string(i % 5),
+        .send_seq = i,
+        .receive_seq = 2 * i,
+        .payload = std::vector<uint8_t>(1000, static_cast<uint8_t>(i))});
+    }
+  }
+  CompactLog(row_path, columnar_path);
+  // The scratch files are gone.
+  EXPECT_FALSE(std::filesystem::exists(columnar_path + ".payload"));
+
+  ColumnarLogReader reader(columnar_path);
+  const std::vector<Message> read = reader.ReadMessages();
+  ASSERT_EQ(read.size(), kNumMessages);
+  for (int i = 0; i < kNumMessages; ++i) {
+    EXPECT_EQ(read[i].sender, i % 7);
+    EXPECT_EQ(read[i].channel, "channel" + std::to_string(i % 5));
+    EXPECT_EQ(read[i].receive_seq, 2 * i);
+    EXPECT_EQ(read[i].payload,
+              std::vector<uint8_t>(1000, static_cast<uint8_t>(i)));
+  }
+}
+
+TEST(MessageLog, RejectsOversizedColumns) {
+  const std::string path = TempPath("oversized.log");
+  WriteColumnarLog(SampleMessages(), path);
+  // Claim a 2^56-byte payload column.
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    const int payload_size_offset = 4 + 1 + 8 + 16 * 5 + 8 + 7;
+    file.seekp(payload_size_offset);
+    file.put(1);
+  }
+  EXPECT_THROW(ColumnarLogReader reader(path), std::runtime_error);
+}
+
+TEST(MessageLog, RejectsNonColumnarFile) {
+  const std::string path = TempPath("not_columnar.log");
+  {
+    MessageLogWriter writer(path);
+    writer.Append(Message{.channel = "x"});
+  }
+  EXPECT_THROW(ColumnarLogReader reader(path), std::runtime_error);
+}
+
+TEST(MessageLog, WriteFailuresThrow) {
+  if (!std::filesystem::exists("/dev/full")) GTEST_SKIP() << "No /dev/full";
+  MessageLogWriter writer("/dev/full");
+  writer.Append(Message{.channel = "x", .payload = {1, 2, 3}});
+  EXPECT_THROW(writer.Flush(), std::runtime_error);
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,191 @@
+#include "blocktopus/multicast_channel.h"
+
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/encoding.h"
+
+namespace blocktopus {
+namespace {
+
+std::vector<uint8_t> Payload(int i) {
+  return std::vector<uint8_t>(100 + i % 7, static_cast<uint8_t>(i));
+}
+
+// A sender whose packets reach no receiver, so that tests decide which
+// arrive by handing them to `OnRepair`.
+MulticastSender UnheardSender(size_t retained_packets) {
+  return MulticastSender({.port = 9, .max_packet_size = 400,
+                          .retained_packets = retained_packets});
+}
+
+TEST(MulticastChannel, BatchedPayloadsArriveInOrderOverLoopback) {
+  std::optional<MulticastReceiver> receiver;
+  try {
+    receiver.emplace(MulticastReceiver::Config{.port = 0});
+  } catch (const std::runtime_error& e) {
+    GTEST_SKIP() << "No multicast here: " << e.what();
+  }
+  MulticastSender sender({.port = receiver->port()});
+  receiver->SkipTo(sender.next_packet());
+  for (int i = 0; i < 100; ++i) ASSERT_TRUE(sender.Send(Payload(i)));
+  ASSERT_TRUE(sender.Flush());
+  EXPECT_LT(sender.next_packet(), 20);  // About 13 payloads a packet.
+
+  std::vector<std::vector<uint8_t>> received;
+  for (int i = 0; i < 1000 && received.size() < 100; ++i) {
+    ASSERT_TRUE(receiver->ProcessIO());
+    for (auto& payload : receiver->ReceiveAll()) {
+      received.push_back(std::move(payload));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (received.empty()) GTEST_SKIP() << "Multicast loopback delivers nothing";
+  ASSERT_EQ(received.size(), 100);
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(received[i], Payload(i));
+  EXPECT_TRUE(receiver->TakeNacks().empty());
+}
+
+TEST(MulticastChannel, GapsAreNackedOnceAndRepaired) {
+  MulticastSender sender = UnheardSender(100);
+  MulticastReceiver receiver({.port = 0});
+  for (int i = 0; i < 40; ++i) ASSERT_TRUE(sender.Send(Payload(i)));
+  ASSERT_TRUE(sender.Flush());
+  ASSERT_EQ(sender.next_packet(), 14);
+  std::vector<std::vector<uint8_t>> packets;
+  ASSERT_TRUE(sender.Repair({.first = 0, .last = 13}, &packets));
+
+  receiver.SkipTo(0);
+  // Packets 3-5 and the last one are lost.
+  for (int i = 0; i < 13; ++i) {
+    if (i < 3 || i > 5) {
+      ASSERT_TRUE(receiver.OnRepair(packets[i]));
+    }
+  }
+  EXPECT_EQ(receiver.ReceiveAll().size(), 9);  // Packets 0-2.
+  // The heartbeat `sender.Heartbeat()` would have multicast.
+  std::vector<uint8_t> heartbeat{1};
+  PutFixed64(0, &heartbeat);
+  PutFixed64(14, &heartbeat);
+  ASSERT_TRUE(receiver.OnRepair(heartbeat));
+
+  const std::vector<MulticastNack> nacks = receiver.TakeNacks();
+  ASSERT_EQ(nacks.size(), 2);
+  EXPECT_EQ(nacks[0].first, 3);
+  EXPECT_EQ(nacks[0].last, 5);
+  EXPECT_EQ(nacks[1].first, 13);
+  EXPECT_EQ(nacks[1].last, 13);
+  EXPECT_TRUE(receiver.TakeNacks().empty());
+
+  for (const MulticastNack& nack : nacks) {
+    std::vector<uint8_t> wire;
+    SerializeMulticastNack(nack, &wire);
+    std::vector<std::vector<uint8_t>> repairs;
+    ASSERT_TRUE(sender.Repair(*ParseMulticastNack(wire), &repairs));
+    for (const auto& repair : repairs) ASSERT_TRUE(receiver.OnRepair(repair));
+  }
+  const auto rest = receiver.ReceiveAll();
+  ASSERT_EQ(rest.size(), 31);
+  for (int i = 0; i < 31; ++i) EXPECT_EQ(rest[i], Payload(i + 9));
+}
+
+TEST(MulticastChannel, RepairsBeyondRetentionAndMalformedPacketsFail) {
+  MulticastSender sender = UnheardSender(2);
+  for (int i = 0; i < 12; ++i) ASSERT_TRUE(sender.Send(Payload(i)));
+  ASSERT_TRUE(sender.Flush());
+  ASSERT_EQ(sender.next_packet(), 4);
+  std::vector<std::vector<uint8_t>> packets;
+  EXPECT_EQ(sender.Repair({.first = 1, .last = 2}, &packets).code(),
+            StatusCode::kProtocolError);
+  EXPECT_EQ(sender.Repair({.first = 3, .last = 4}, &packets).code(),
+            StatusCode::kProtocolError);
+  EXPECT_TRUE(sender.Repair({.first = 2, .last = 3}, &packets));
+  EXPECT_EQ(sender.Send(std::vector<uint8_t>(400)).code(),
+            StatusCode::kProtocolError);
+
+  MulticastReceiver receiver({.port = 0});
+  packets[0].push_back(50);  // A payload longer than what follows.
+  EXPECT_EQ(receiver.OnRepair(packets[0]).code(),
+            StatusCode::kProtocolError);
+  EXPECT_EQ(receiver.OnRepair(std::vector<uint8_t>{0, 1}).code(),
+            StatusCode::kProtocolError);
+  EXPECT_FALSE(ParseMulticastNack(std::vector<uint8_t>{5, 4}));
+}
+
+TEST(MulticastChannel, ReceiversStartAndResynchronizeWhereTold) {
+  MulticastSender sender = UnheardSender(3);
+  MulticastReceiver receiver({.port = 0});
+  for (int i = 0; i < 30; ++i) ASSERT_TRUE(sender.Send(Payload(i)));
+  ASSERT_TRUE(sender.Flush());
+  ASSERT_EQ(sender.next_packet(), 10);
+  std::vector<std::vector<uint8_t>> packets;
+  ASSERT_TRUE(sender.Repair({.first = 7, .last = 9}, &packets));
+
+  // Packet 8 arrives before the subscription reply says to start at 9.
+  ASSERT_TRUE(receiver.OnRepair(packets[1]));
+  EXPECT_TRUE(receiver.ReceiveAll().empty());
+  EXPECT_TRUE(receiver.TakeNacks().empty());
+  receiver.SkipTo(9);
+  ASSERT_TRUE(receiver.OnRepair(packets[2]));
+  auto received = receiver.ReceiveAll();
+  ASSERT_EQ(received.size(), 3);
+  EXPECT_EQ(received[0], Payload(27));
+
+  // Packets 10-14 are lost, and 10 and 11 are no longer retained.
+  for (int i = 30; i < 48; ++i) ASSERT_TRUE(sender.Send(Payload(i)));
+  ASSERT_TRUE(sender.Flush());
+  ASSERT_EQ(sender.next_packet(), 16);
+  packets.clear();
+  ASSERT_TRUE(sender.Repair({.first = 15, .last = 15}, &packets));
+  ASSERT_TRUE(receiver.OnRepair(packets[0]));
+  const std::vector<MulticastNack> nacks = receiver.TakeNacks();
+  ASSERT_EQ(nacks.size(), 1);
+  EXPECT_EQ(nacks[0].first, 10);
+  EXPECT_EQ(nacks[0].last, 14);
+  packets.clear();
+  EXPECT_EQ(sender.Repair(nacks[0], &packets).code(),
+            StatusCode::kProtocolError);
+
+  receiver.SkipTo(sender.first_retained());
+  const std::vector<MulticastNack> renacks = receiver.TakeNacks();
+  ASSERT_EQ(renacks.size(), 1);
+  EXPECT_EQ(renacks[0].first, 13);
+  EXPECT_EQ(renacks[0].last, 14);
+  ASSERT_TRUE(sender.Repair(renacks[0], &packets));
+  for (const auto& packet : packets) ASSERT_TRUE(receiver.OnRepair(packet));
+  received = receiver.ReceiveAll();
+  ASSERT_EQ(received.size(), 9);
+  for (int i = 0; i < 9; ++i) EXPECT_EQ(received[i], Payload(i + 39));
+}
+
+TEST(MulticastChannel, OtherStreamsAreDropped) {
+  const uint64_t stream = MulticastStreamId("camera", 1);
+  EXPECT_NE(stream, MulticastStreamId("lidar", 1));
+  EXPECT_NE(stream, MulticastStreamId("camera", 2));
+  MulticastSender sender({.port = 9, .stream_id = stream});
+  MulticastSender restarted({.port = 9,
+                             .stream_id = MulticastStreamId("camera", 2)});
+  MulticastReceiver receiver({.port = 0, .stream_id = stream});
+  receiver.SkipTo(0);
+  ASSERT_TRUE(sender.Send(Payload(1)));
+  ASSERT_TRUE(sender.Flush());
+  ASSERT_TRUE(restarted.Send(Payload(2)));
+  ASSERT_TRUE(restarted.Flush());
+  std::vector<std::vector<uint8_t>> packets;
+  ASSERT_TRUE(restarted.Repair({.first = 0, .last = 0}, &packets));
+  ASSERT_TRUE(sender.Repair({.first = 0, .last = 0}, &packets));
+
+  ASSERT_TRUE(receiver.OnRepair(packets[0]));
+  EXPECT_EQ(receiver.foreign_packets(), 1);
+  EXPECT_TRUE(receiver.ReceiveAll().empty());
+  ASSERT_TRUE(receiver.OnRepair(packets[1]));
+  EXPECT_EQ(receiver.ReceiveAll(),
+            (std::vector<std::vector<uint8_t>>{Payload(1)}));
+}
+
+}  // namespace
+}  // namespace blocktopus
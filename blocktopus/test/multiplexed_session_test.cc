@@ -0,0 +1,94 @@
+#include "blocktopus/multiplexed_session.h"
+
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+// Two sessions joined by a socketpair.
+struct SessionPair {
+  SessionPair(const MultiplexedSession::Config& config) {
+    int fds[2];
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    client.emplace(Transport::FromConnectedSocket(fds[0], {}), config);
+    server.emplace(
+        Transport::FromConnectedSocket(
+            fds[1], Transport::Config{.end = Transport::End::kServer}),
+        config);
+  }
+
+  std::optional<MultiplexedSession> client;
+  std::optional<MultiplexedSession> server;
+};
+
+std::vector<uint8_t> Bytes(const std::string& text) {
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+TEST(MultiplexedSession, DemultiplexesLogicalClientsInOrder) {
+  SessionPair pair({});
+  for (ClientId client = 1; client <= 50; ++client) {
+    pair.client->Send(client, Bytes("clear " + std::to_string(client)));
+    pair.client->Send(client, Bytes("publish " + std::to_string(client)));
+  }
+  ASSERT_TRUE(pair.client->ProcessIO());
+  // A hundred small frames from fifty clients shared one datagram.
+  EXPECT_EQ(pair.client->frames_sent(), 100);
+  EXPECT_EQ(pair.client->datagrams_sent(), 1);
+
+  std::vector<std::vector<uint8_t>> received;
+  while (received.empty()) {
+    ASSERT_TRUE(pair.server->ProcessIO());
+    received = pair.server->ReceiveAll(7);
+  }
+  EXPECT_EQ(received,
+            (std::vector<std::vector<uint8_t>>{Bytes("clear 7"),
+                                               Bytes("publish 7")}));
+  EXPECT_EQ(pair.server->ReceiveAll(50).size(), 2);
+  EXPECT_TRUE(pair.server->ReceiveAll(51).empty());
+}
+
+TEST(MultiplexedSession, LargeFramesTravelAloneAndInOrder) {
+  SessionPair pair({.max_batch_bytes = 64, .max_batched_frame_bytes = 32});
+  const std::vector<uint8_t> large(1000, 0xab);
+  pair.client->Send(1, Bytes("before"));
+  pair.client->Send(1, large);
+  pair.client->Send(1, Bytes("after"));
+  ASSERT_TRUE(pair.client->ProcessIO());
+  EXPECT_EQ(pair.client->datagrams_sent(), 3);
+
+  std::vector<std::vector<uint8_t>> received;
+  while (received.size() < 3) {
+    ASSERT_TRUE(pair.client->ProcessIO());
+    ASSERT_TRUE(pair.server->ProcessIO());
+    for (auto& frame : pair.server->ReceiveAll(1)) {
+      received.push_back(std::move(frame));
+    }
+  }
+  EXPECT_EQ(received,
+            (std::vector<std::vector<uint8_t>>{Bytes("before"), large,
+                                               Bytes("after")}));
+}
+
+TEST(MultiplexedSession, MalformedDatagramIsAProtocolError) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  Transport raw = Transport::FromConnectedSocket(fds[0], {});
+  MultiplexedSession session(
+      Transport::FromConnectedSocket(
+          fds[1], Transport::Config{.end = Transport::End::kServer}),
+      {});
+  // Claims a 100-byte frame but carries 2 bytes.
+  raw.Send({1, 100, 0, 0});
+  Status status;
+  while (status) {
+    ASSERT_TRUE(raw.ProcessIO());
+    status = session.ProcessIO();
+  }
+  EXPECT_EQ(status.code(), StatusCode::kProtocolError);
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,89 @@
+#include "blocktopus/payload_dedup.h"
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/test/test_messages.h"
+
+namespace blocktopus {
+namespace {
+
+TEST(PayloadDedup, RepeatedPayloadsAreSentByReference) {
+  const PayloadDedupConfig config{.min_payload_size = 100};
+  PayloadDedup server(config);
+  PayloadDedupReceiver receiver(config);
+  std::vector<uint8_t> payload;
+  for (int universe = 0; universe < 4; ++universe) {
+    // Identical bytes in distinct messages, as from separate universes.
+    const auto message = Share(
+        MakeMessage(1, "scene", 0, 1, std::vector<uint8_t>(1000, 7)));
+    std::vector<uint8_t> frame;
+    server.Encode({.recipient = 2, .message = message}, &frame);
+    EXPECT_EQ(frame.size(), universe == 0 ? 1009 : 9);
+    ASSERT_TRUE(receiver.Decode(frame, &payload));
+    EXPECT_EQ(payload, message->payload);
+  }
+  EXPECT_EQ(server.saved_bytes(), 3000);
+  EXPECT_EQ(server.size(), 1);
+
+  // Small payloads are not worth a reference.
+  std::vector<uint8_t> frame;
+  server.Encode({.recipient = 2,
+                 .message = Share(MakeMessage(
+                     1, "scene", 0, 1, std::vector<uint8_t>(99, 1)))},
+                &frame);
+  EXPECT_EQ(frame.size(), 100);
+  ASSERT_TRUE(receiver.Decode(frame, &payload));
+  EXPECT_EQ(payload, std::vector<uint8_t>(99, 1));
+}
+
+TEST(PayloadDedup, BothEndsEvictIdentically) {
+  const PayloadDedupConfig config{.min_payload_size = 1,
+                                  .receiver_budget_bytes = 300};
+  PayloadDedup server(config);
+  PayloadDedupReceiver receiver(config);
+  // Four distinct 100-byte payloads cycle through a 3-payload cache, with
+  // the first kept hot.
+  const std::vector<int> pattern{0, 1, 2, 0, 3, 0, 1, 2, 3, 0};
+  std::vector<uint8_t> payload;
+  for (int which : pattern) {
+    const auto message = Share(
+        MakeMessage(1, "scene", 0, 1, std::vector<uint8_t>(100, which)));
+    std::vector<uint8_t> frame;
+    server.Encode({.recipient = 2, .message = message}, &frame);
+    ASSERT_TRUE(receiver.Decode(frame, &payload));
+    EXPECT_EQ(payload, message->payload);
+  }
+  EXPECT_LE(receiver.held_bytes(), 300);
+  EXPECT_EQ(server.stored_bytes(), receiver.held_bytes());
+  EXPECT_EQ(server.saved_bytes(), 200);  // 0, while it stayed hot.
+}
+
+TEST(PayloadDedup, ReceiversAreTrackedSeparately) {
+  const PayloadDedupConfig config{.min_payload_size = 1};
+  PayloadDedup server(config);
+  const auto message =
+      Share(MakeMessage(1, "scene", 0, 1, std::vector<uint8_t>(100, 5)));
+  std::vector<uint8_t> to_2, to_3;
+  server.Encode({.recipient = 2, .message = message}, &to_2);
+  server.Encode({.recipient = 3, .message = message}, &to_3);
+  EXPECT_EQ(to_2, to_3);  // Each must be sent it once.
+  EXPECT_EQ(server.size(), 1);
+  EXPECT_EQ(server.hashed_bytes(), 100);  // But it was hashed only once.
+  server.RemoveReceiver(2);
+  EXPECT_EQ(server.size(), 1);
+  server.RemoveReceiver(3);
+  EXPECT_EQ(server.size(), 0);
+
+  // A receiver that missed the payload cannot resolve a reference to it.
+  std::vector<uint8_t> reference;
+  server.Encode({.recipient = 4, .message = message}, &reference);
+  reference.clear();
+  server.Encode({.recipient = 4, .message = message}, &reference);
+  PayloadDedupReceiver late(config);
+  std::vector<uint8_t> payload;
+  EXPECT_EQ(late.Decode(reference, &payload).code(),
+            StatusCode::kProtocolError);
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,126 @@
+#include "blocktopus/peer_delivery.h"
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/encoding.h"
+#include "blocktopus/test/test_messages.h"
+
+namespace blocktopus {
+namespace {
+
+MessageHeader StubHeader(const Message& message) {
+  return *ParseOrderingStub(MakeOrderingStub(message));
+}
+
+TEST(PeerDelivery, StubsCarrySizeAndHash) {
+  const Message message =
+      MakeMessage(1, "camera", 0, 5, PatternPayload(1001, 1));
+  const Message stub = MakeOrderingStub(message);
+  EXPECT_LT(stub.payload.size(), 16);
+  const std::optional<MessageHeader> header = ParseOrderingStub(stub);
+  ASSERT_TRUE(header.has_value());
+  EXPECT_EQ(header->payload_size, 1001);
+  EXPECT_EQ(header->payload_hash, HashPayload(message.payload));
+  EXPECT_EQ(header->receive_seq, 5);
+
+  Message other = message;
+  other.payload[1000] ^= 1;
+  EXPECT_NE(HashPayload(other.payload), header->payload_hash);
+  EXPECT_FALSE(ParseOrderingStub(message).has_value());
+}
+
+TEST(PeerDelivery, ReleasesInServerOrderOnlyOncePayloadsArrive) {
+  const Message a = MakeMessage(1, "camera", 0, 3, PatternPayload(100, 1));
+  const Message b = MakeMessage(2, "camera", 0, 4, PatternPayload(200, 2));
+  PayloadGate gate;
+  // Payloads arrive out of order, and ahead of the headers.
+  gate.OnPayload(Message(b));
+  gate.OnHeader(StubHeader(a));
+  gate.OnHeader(StubHeader(b));
+  EXPECT_FALSE(gate.ready());
+  Message released;
+  EXPECT_EQ(gate.Pop(&released).code(), StatusCode::kBackpressure);
+
+  gate.OnPayload(Message(a));
+  ASSERT_TRUE(gate.Pop(&released));
+  EXPECT_EQ(released.sender, 1);
+  EXPECT_EQ(released.payload, a.payload);
+  ASSERT_TRUE(gate.Pop(&released));
+  EXPECT_EQ(released.sender, 2);
+  EXPECT_EQ(gate.buffered(), 0);
+}
+
+TEST(PeerDelivery, CorruptAndUnwantedPayloadsAreRejected) {
+  const Message a = MakeMessage(1, "camera", 0, 3, PatternPayload(100, 1));
+  PayloadGate gate;
+  gate.OnHeader(StubHeader(a));
+  Message corrupt = a;
+  corrupt.payload[0] ^= 0xff;
+  gate.OnPayload(std::move(corrupt));
+  Message released;
+  EXPECT_EQ(gate.Pop(&released).code(), StatusCode::kProtocolError);
+
+  // A payload the server never ordered for us is dropped once a grant shows
+  // that its header is not coming.
+  gate.OnPayload(MakeMessage(2, "camera", 1, 8, PatternPayload(10, 2)));
+  EXPECT_EQ(gate.buffered(), 1);
+  gate.OnGrant(10);
+  EXPECT_EQ(gate.buffered(), 0);
+  gate.OnPayload(MakeMessage(2, "camera", 2, 9, PatternPayload(10, 2)));
+  EXPECT_EQ(gate.buffered(), 0);
+}
+
+TEST(PeerDelivery, ChannelsLostPayloadsAndBufferLimit) {
+  // The same metadata on two channels are two messages.
+  Message camera = MakeMessage(1, "camera", 0, 3, PatternPayload(100, 1));
+  Message lidar = camera;
+  lidar.channel = "lidar";
+  lidar.payload[0] ^= 1;
+  PayloadGate gate({.payload_timeout_seqs = 10, .max_buffered_bytes = 250});
+  gate.OnHeader(StubHeader(camera));
+  gate.OnHeader(StubHeader(lidar));
+  gate.OnPayload(Message(lidar));
+  Message released;
+  // Lidar's payload is not a corrupt camera payload.
+  EXPECT_EQ(gate.Pop(&released).code(), StatusCode::kBackpressure);
+  gate.OnPayload(Message(camera));
+  ASSERT_TRUE(gate.Pop(&released));
+  EXPECT_EQ(released.channel, "camera");
+  ASSERT_TRUE(gate.Pop(&released));
+  EXPECT_EQ(released.channel, "lidar");
+
+  // Past the buffer limit, the payload needed last is discarded; when its
+  // turn comes (and the grants move on) its message fails rather than
+  // blocking the next.
+  const Message a = MakeMessage(1, "camera", 1, 5, PatternPayload(100, 1));
+  const Message b = MakeMessage(1, "camera", 2, 6, PatternPayload(100, 1));
+  const Message c = MakeMessage(1, "camera", 3, 7, PatternPayload(100, 1));
+  gate.OnPayload(Message(c));
+  gate.OnPayload(Message(a));
+  gate.OnPayload(Message(b));
+  EXPECT_EQ(gate.evicted(), 1);
+  EXPECT_EQ(gate.buffered_bytes(), 200);
+  gate.OnHeader(StubHeader(a));
+  gate.OnHeader(StubHeader(b));
+  gate.OnHeader(StubHeader(c));
+  ASSERT_TRUE(gate.Pop(&released));
+  ASSERT_TRUE(gate.Pop(&released));
+  EXPECT_EQ(gate.Pop(&released).code(), StatusCode::kBackpressure);
+  gate.OnGrant(16);
+  EXPECT_FALSE(gate.ready());
+  gate.OnGrant(17);
+  EXPECT_TRUE(gate.ready());
+  EXPECT_EQ(gate.Pop(&released).code(), StatusCode::kProtocolError);
+  EXPECT_EQ(gate.buffered_bytes(), 0);
+
+  // A payload larger than the whole limit is still kept if it is next.
+  const Message d = MakeMessage(1, "camera", 4, 20, PatternPayload(1000, 1));
+  gate.OnHeader(StubHeader(d));
+  gate.OnPayload(Message(d));
+  EXPECT_EQ(gate.evicted(), 1);
+  ASSERT_TRUE(gate.Pop(&released));
+  EXPECT_EQ(released.payload, d.payload);
+}
+
+}  // namespace
+}  // namespace blocktopus
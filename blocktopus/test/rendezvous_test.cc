@@ -0,0 +1,86 @@
+#include "blocktopus/rendezvous.h"
+
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/test/test_messages.h"
+
+namespace blocktopus {
+namespace {
+
+// A delivered message with a @p payload_size byte payload.
+std::shared_ptr<const Message> Image(size_t payload_size) {
+  return Share(MakeMessage(1, "images", 0, 1, PatternPayload(payload_size)));
+}
+
+TEST(RendezvousStore, SmallPayloadsAreNotHeld) {
+  RendezvousStore store({.min_payload_size = 100});
+  EXPECT_FALSE(store.Offer({.recipient = 2, .message = Image(99)}));
+  EXPECT_EQ(store.size(), 0);
+}
+
+TEST(RendezvousStore, ChunksMustHoldSomething) {
+  EXPECT_THROW(RendezvousStore({.max_chunk_size = 0}), std::invalid_argument);
+}
+
+TEST(RendezvousStore, EmptyPayloadsCanBePulled) {
+  RendezvousStore store({.min_payload_size = 0, .max_chunk_size = 64});
+  const auto descriptor =
+      store.Offer({.recipient = 2, .message = Image(0)});
+  ASSERT_TRUE(descriptor.has_value());
+  RendezvousStore::Chunk chunk;
+  ASSERT_TRUE(store.Pull(2, descriptor->handle, 0, &chunk));
+  EXPECT_TRUE(chunk.bytes.empty());
+  EXPECT_EQ(store.size(), 0);
+}
+
+TEST(RendezvousStore, OneCopySharedUntilEveryPullCompletes) {
+  RendezvousStore store({.min_payload_size = 100, .max_chunk_size = 64});
+  const auto message = Image(100);
+  const auto to_2 = store.Offer({.recipient = 2, .message = message});
+  const auto to_3 = store.Offer({.recipient = 3, .message = message});
+  ASSERT_TRUE(to_2.has_value());
+  ASSERT_TRUE(to_3.has_value());
+  EXPECT_EQ(to_2->handle, to_3->handle);
+  EXPECT_EQ(to_2->header.payload_size, 100);
+  EXPECT_EQ(store.stored_bytes(), 100);
+
+  std::vector<uint8_t> pulled;
+  RendezvousStore::Chunk chunk;
+  while (pulled.size() < 100) {
+    ASSERT_TRUE(store.Pull(2, to_2->handle, pulled.size(), &chunk));
+    EXPECT_LE(chunk.bytes.size(), 64);
+    pulled.insert(pulled.end(), chunk.bytes.begin(), chunk.bytes.end());
+  }
+  EXPECT_EQ(pulled, message->payload);
+  // Client 2 is done; client 3 is not.
+  EXPECT_FALSE(store.Pull(2, to_2->handle, 0, &chunk));
+  EXPECT_EQ(store.size(), 1);
+
+  ASSERT_TRUE(store.Pull(3, to_3->handle, 64, &chunk));
+  EXPECT_EQ(store.size(), 0);
+  EXPECT_EQ(store.stored_bytes(), 0);
+  // The last chunk outlives the store's copy.
+  EXPECT_EQ(chunk.bytes.back(), message->payload.back());
+}
+
+TEST(RendezvousStore, ReleasedPullsFreeThePayload) {
+  RendezvousStore store({.min_payload_size = 10});
+  const auto first = store.Offer({.recipient = 2, .message = Image(10)});
+  const auto second =
+      store.Offer({.recipient = 2, .message = Image(20)});
+  store.Offer({.recipient = 3, .message = Image(30)});
+  EXPECT_EQ(store.size(), 3);
+  store.Release(2, first->handle);
+  EXPECT_EQ(store.size(), 2);
+  store.ReleaseClient(2);
+  EXPECT_EQ(store.size(), 1);
+  EXPECT_EQ(store.stored_bytes(), 30);
+  RendezvousStore::Chunk chunk;
+  EXPECT_EQ(store.Pull(2, second->handle, 0, &chunk).code(),
+            StatusCode::kProtocolError);
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,300 @@
+#include "blocktopus/sequencer.h"
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/test/test_messages.h"
+
+namespace blocktopus {
+namespace {
+
+// (recipient, sender, receive_seq) of each delivery, for easy comparison.
+using Summary = std::vector<std::tuple<ClientId, ClientId, Seq>>;
+Summary Summarize(const Sequencer::Output& output) {
+  Summary result;
+  for (const auto& delivery : output.deliveries) {
+    result.emplace_back(delivery.recipient, delivery.message->sender,
+                        delivery.message->receive_seq);
+  }
+  return result;
+}
+
+TEST(Sequencer, DeliversOnlyBelowBoundInOrder) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(2, "a", 0, &effective));
+  EXPECT_EQ(effective, 0);
+
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 0, 10)));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 1, 5)));
+  // Client 2 is still at 0, so nothing is final.
+  Sequencer::Output output = sequencer.Step();
+  EXPECT_TRUE(output.deliveries.empty());
+  ASSERT_EQ(output.grants.size(), 2);
+  EXPECT_EQ(output.grants[0].seq, 0);
+
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 7));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 8));
+  output = sequencer.Step();
+  EXPECT_EQ(sequencer.bound(), 7);
+  EXPECT_EQ(Summarize(output), (Summary{{2, 1, 5}}));
+  ASSERT_EQ(output.grants.size(), 2);
+  EXPECT_EQ(output.grants[1].client, 2);
+  EXPECT_EQ(output.grants[1].seq, 7);
+
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 20));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 20));
+  output = sequencer.Step();
+  EXPECT_EQ(Summarize(output), (Summary{{2, 1, 10}}));
+  EXPECT_EQ(sequencer.pending_size(), 0);
+}
+
+TEST(Sequencer, TieBreaksBySenderThenPublicationOrder) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  ASSERT_TRUE(sequencer.AddClient(3, 0));
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(3, std::nullopt, 0, &effective));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(2, "a", 0, 5)));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "b", 1, 5)));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 2, 5)));
+  for (ClientId client : {1, 2, 3}) {
+    ASSERT_TRUE(sequencer.ClearToAdvance(client, 5));
+  }
+  const Sequencer::Output output = sequencer.Step();
+  ASSERT_EQ(output.deliveries.size(), 3);
+  EXPECT_EQ(output.deliveries[0].message->send_seq, 1);
+  EXPECT_EQ(output.deliveries[1].message->send_seq, 2);
+  EXPECT_EQ(output.deliveries[2].message->sender, 2);
+}
+
+TEST(Sequencer, RejectsProtocolViolations) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(1, 10));
+  EXPECT_EQ(sequencer.AddClient(1, 10).code(), StatusCode::kProtocolError);
+  EXPECT_FALSE(sequencer.Publish(MakeMessage(1, "a", 5, 20)));
+  EXPECT_FALSE(sequencer.Publish(MakeMessage(1, "a", 15, 15)));
+  EXPECT_FALSE(sequencer.Publish(MakeMessage(9, "a", 15, 20)));
+  EXPECT_FALSE(sequencer.ClearToAdvance(1, 9));
+  Seq effective;
+  EXPECT_FALSE(sequencer.Unsubscribe(1, "a", 10, &effective));
+}
+
+TEST(Sequencer, LateSubscriptionAndUnsubscription) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 10));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 10));
+  sequencer.Step();
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(2, "a", 3, &effective));
+  EXPECT_EQ(effective, 10);
+
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 10, 12)));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 11, 14)));
+  ASSERT_TRUE(sequencer.Unsubscribe(2, "a", 13, &effective));
+  EXPECT_EQ(effective, 13);
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 20));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 20));
+  EXPECT_EQ(Summarize(sequencer.Step()), (Summary{{2, 1, 12}}));
+}
+
+TEST(Sequencer, ResetKeepsClientsAndOptionallySubscriptions) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(2, "a", 0, &effective));
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 100 + i, 200 + i)));
+  }
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 50));
+  sequencer.Step();
+  EXPECT_EQ(sequencer.pending_size(), 1000);
+
+  sequencer.Reset(0, /* keep_subscriptions = */ true);
+  EXPECT_EQ(sequencer.generation(), 1);
+  EXPECT_EQ(sequencer.pending_size(), 0);
+  EXPECT_EQ(sequencer.bound(), 0);
+
+  // Both clients are back at 0 (so client 1 may publish at 0 again), and
+  // client 2 is still subscribed.
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 0, 3)));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 1000));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 1000));
+  Sequencer::Output output = sequencer.Step();
+  EXPECT_EQ(Summarize(output), (Summary{{2, 1, 3}}));
+  EXPECT_EQ(output.grants.size(), 2);
+
+  sequencer.Reset(0, /* keep_subscriptions = */ false);
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 0, 3)));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 1000));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 1000));
+  EXPECT_TRUE(sequencer.Step().deliveries.empty());
+  EXPECT_FALSE(sequencer.Unsubscribe(2, "a", 1000, &effective));
+}
+
+TEST(Sequencer, ObserversNeverHoldBackTheBound) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddObserver(9));
+  EXPECT_FALSE(sequencer.AddClient(9, 0));
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(9, std::nullopt, 0, &effective));
+  EXPECT_FALSE(sequencer.ClearToAdvance(9, 5));
+  EXPECT_FALSE(sequencer.Publish(MakeMessage(9, "a", 0, 1)));
+
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 0, 3)));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 5));
+  const Sequencer::Output output = sequencer.Step();
+  EXPECT_EQ(sequencer.bound(), 5);
+  EXPECT_TRUE(output.deliveries.empty());
+  ASSERT_EQ(output.observer_deliveries.size(), 1);
+  EXPECT_EQ(output.observer_deliveries[0].recipient, 9);
+  // Observers are never granted anything.
+  ASSERT_EQ(output.grants.size(), 1);
+  EXPECT_EQ(output.grants[0].client, 1);
+}
+
+TEST(Sequencer, ObserversThatFallBehindDropOrSample) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddObserver(8, {.max_backlog = 4}));
+  ASSERT_TRUE(sequencer.AddObserver(
+      9, {.max_backlog = 4,
+          .overflow = Sequencer::ObserverOverflow::kSample,
+          .sample_every = 3}));
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(8, "a", 0, &effective));
+  ASSERT_TRUE(sequencer.Subscribe(9, "a", 0, &effective));
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", i, i + 1)));
+  }
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 100));
+  Sequencer::Output output = sequencer.Step();
+  // Client 1 is never slowed down by either observer.
+  EXPECT_EQ(sequencer.bound(), 100);
+  std::vector<Seq> to_8, to_9;
+  for (const auto& delivery : output.observer_deliveries) {
+    (delivery.recipient == 8 ? to_8 : to_9).push_back(
+        delivery.message->receive_seq);
+  }
+  EXPECT_EQ(to_8, (std::vector<Seq>{1, 2, 3, 4}));
+  EXPECT_EQ(to_9, (std::vector<Seq>{1, 2, 3, 4, 7, 10}));
+  EXPECT_EQ(sequencer.ObserverDropped(8), 6);
+  EXPECT_EQ(sequencer.ObserverDropped(9), 4);
+
+  // Once caught up, an observer receives everything again.
+  sequencer.AcknowledgeObserver(8, 4);
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 100, 101)));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 200));
+  output = sequencer.Step();
+  ASSERT_EQ(output.observer_deliveries.size(), 1);
+  EXPECT_EQ(output.observer_deliveries[0].recipient, 8);
+}
+
+TEST(Sequencer, SkewWindowAppliesBackpressure) {
+  Sequencer sequencer({.max_skew = 10});
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(2, "a", 0, &effective));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "a", 10, 11)));
+  Message ahead = MakeMessage(1, "a", 11, 12);
+  EXPECT_EQ(sequencer.Publish(std::move(ahead)).code(),
+            StatusCode::kBackpressure);
+  // The refused message was not consumed, so it can be retried as is.
+  EXPECT_EQ(ahead.payload.size(), 1);
+  EXPECT_EQ(sequencer.pending_size(), 1);
+
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 5));
+  const Sequencer::Output output = sequencer.Step();
+  ASSERT_EQ(output.grants.size(), 2);
+  EXPECT_EQ(output.grants[0].publish_limit, 15);
+  ASSERT_TRUE(sequencer.Publish(std::move(ahead)));
+}
+
+TEST(Sequencer, RefusedPublishStillAdvancesTheBound) {
+  Sequencer sequencer({.max_skew = 5});
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 100));
+  // Client 1 holds the bound at 0 and jumps ahead to 12.
+  Message ahead = MakeMessage(1, "a", 12, 13);
+  int refusals = 0;
+  Status status;
+  while ((status = sequencer.Publish(std::move(ahead))).code() ==
+         StatusCode::kBackpressure) {
+    ASSERT_LT(++refusals, 10);
+    sequencer.Step();
+  }
+  ASSERT_TRUE(status);
+  // Each refusal moved the bound up to the limit: 0 -> 5 -> 10.
+  EXPECT_EQ(refusals, 2);
+  EXPECT_EQ(sequencer.bound(), 10);
+}
+
+TEST(Sequencer, LateSubscribersGetTheLatchedLatestValue) {
+  Sequencer sequencer({.latched_channels = {"map"}});
+  ASSERT_TRUE(sequencer.AddClient(1, 0));
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "map", 0, 2)));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "map", 2, 4)));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "odometry", 4, 5)));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(1, "map", 6, 8)));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 5));
+  EXPECT_TRUE(sequencer.Step().deliveries.empty());
+
+  // Subscribing at 6 (while the bound is 5) is owed the map as of 6, i.e.
+  // the one received at 4 and not the one received at 8.
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(2, "map", 6, &effective));
+  ASSERT_TRUE(sequencer.Subscribe(2, "odometry", 6, &effective));
+  ASSERT_TRUE(sequencer.ClearToAdvance(1, 10));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 10));
+  const Sequencer::Output output = sequencer.Step();
+  EXPECT_EQ(Summarize(output), (Summary{{2, 1, 4}, {2, 1, 8}}));
+  EXPECT_TRUE(output.deliveries[0].latched);
+  EXPECT_FALSE(output.deliveries[1].latched);
+
+  // A wildcard subscriber is owed every latched channel; after a Reset,
+  // nothing.
+  ASSERT_TRUE(sequencer.Subscribe(2, std::nullopt, 0, &effective));
+  EXPECT_EQ(Summarize(sequencer.Step()), (Summary{{2, 1, 8}}));
+  sequencer.Reset(0);
+  ASSERT_TRUE(sequencer.Subscribe(2, "map", 0, &effective));
+  EXPECT_TRUE(sequencer.Step().deliveries.empty());
+}
+
+TEST(Sequencer, PeerClearsHoldTheBoundAndRelayedMessagesInterleave) {
+  Sequencer sequencer;
+  ASSERT_TRUE(sequencer.AddClient(2, 0));
+  Seq effective;
+  ASSERT_TRUE(sequencer.Subscribe(2, "a", 0, &effective));
+  ASSERT_TRUE(sequencer.SetPeerClear(7, 3));
+  EXPECT_EQ(sequencer.local_clear(), 0);
+
+  // Client 1 belongs to peer 7 and is not a client here.
+  ASSERT_TRUE(sequencer.Relay(
+      std::make_shared<const Message>(MakeMessage(1, "a", 3, 6))));
+  ASSERT_TRUE(sequencer.Publish(MakeMessage(2, "a", 4, 6)));
+  ASSERT_TRUE(sequencer.ClearToAdvance(2, 10));
+  Sequencer::Output output = sequencer.Step();
+  EXPECT_EQ(sequencer.bound(), 3);  // Held by the peer.
+  EXPECT_TRUE(output.deliveries.empty());
+
+  ASSERT_TRUE(sequencer.SetPeerClear(7, 10));
+  output = sequencer.Step();
+  EXPECT_EQ(Summarize(output), (Summary{{2, 1, 6}, {2, 2, 6}}));
+  EXPECT_EQ(sequencer.SetPeerClear(7, 9).code(), StatusCode::kProtocolError);
+  EXPECT_EQ(sequencer.Relay(std::make_shared<const Message>(
+                                MakeMessage(1, "a", 8, 9)))
+                .code(),
+            StatusCode::kProtocolError);
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,323 @@
+#include "blocktopus/server_pipeline.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+using Request = ServerPipeline::Request;
+using Kind = Request::Kind;
+
+std::vector<uint8_t> Frame(const Request& request) {
+  std::vector<uint8_t> frame;
+  ServerPipeline::EncodeRequest(request, &frame);
+  return frame;
+}
+
+std::vector<uint8_t> PublishFrame(Seq send_seq, Seq receive_seq) {
+  return Frame({.kind = Kind::kPublish,
+                .message = {.channel = "state", .send_seq = send_seq,
+                            .receive_seq = receive_seq,
+                            .payload = {static_cast<uint8_t>(send_seq)}}});
+}
+
+// (sender, receive_seq, send_seq) of each message received, by recipient.
+using Received =
+    std::map<ClientId, std::vector<std::tuple<ClientId, Seq, Seq>>>;
+
+TEST(ServerPipeline, RequestsFlowThroughEveryStage) {
+  ServerPipeline pipeline({.num_io_threads = 2, .num_routers = 2});
+  for (ClientId client : {1, 2}) {
+    const size_t io = pipeline.IoThreadOf(client);
+    ASSERT_TRUE(pipeline.Decode(io, client, Frame({.kind = Kind::kJoin})));
+    ASSERT_TRUE(pipeline.Decode(
+        io, client, Frame({.kind = Kind::kSubscribe, .channel = "state"})));
+  }
+  ASSERT_TRUE(pipeline.Decode(1, 1, PublishFrame(1, 6)));
+  ASSERT_TRUE(pipeline.Decode(0, 2, PublishFrame(2, 4)));
+  ASSERT_TRUE(pipeline.Decode(
+      1, 1, Frame({.kind = Kind::kClearToAdvance, .seq = 10})));
+  ASSERT_TRUE(pipeline.Decode(
+      0, 2, Frame({.kind = Kind::kClearToAdvance, .seq = 10})));
+
+  EXPECT_TRUE(pipeline.Order());
+  EXPECT_TRUE(pipeline.Route(0));
+  EXPECT_TRUE(pipeline.Route(1));
+  std::map<ClientId, std::vector<uint8_t>> frames;
+  for (size_t io = 0; io < 2; ++io) {
+    EXPECT_TRUE(pipeline.Encode(
+        io, [&](ClientId client, std::vector<uint8_t>&& frame) {
+          EXPECT_EQ(pipeline.IoThreadOf(client), io);
+          frames[client] = std::move(frame);
+        }));
+  }
+  ASSERT_EQ(frames.size(), 2);
+  for (auto& [client, frame] : frames) {
+    std::vector<Message> messages;
+    std::optional<Seq> grant;
+    ASSERT_TRUE(ServerPipeline::ParseOutbound(frame, &messages, &grant));
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0].sender, 2);
+    EXPECT_EQ(messages[0].receive_seq, 4);
+    EXPECT_EQ(messages[1].sender, 1);
+    EXPECT_EQ(grant, 10);
+  }
+  EXPECT_FALSE(pipeline.Order());
+  EXPECT_FALSE(pipeline.Route(0));
+}
+
+TEST(ServerPipeline, ThreadedStagesMatchOneSequencer) {
+  constexpr size_t kIo = 2;
+  constexpr size_t kRouters = 3;
+  constexpr ClientId kClients = 8;
+  constexpr int kMessagesPerClient = 300;
+  const auto send_seq = [](ClientId c, int k) { return Seq{10 * k + c % 4}; };
+  const auto receive_seq = [&](ClientId c, int k) {
+    return send_seq(c, k) + 1 + (k * 3 + c) % 11;
+  };
+
+  Sequencer reference;
+  Seq effective;
+  for (ClientId c = 0; c < kClients; ++c) {
+    ASSERT_TRUE(reference.AddClient(c, 0));
+    ASSERT_TRUE(reference.Subscribe(c, std::nullopt, 0, &effective));
+  }
+  for (ClientId c = 0; c < kClients; ++c) {
+    for (int k = 0; k < kMessagesPerClient; ++k) {
+      ASSERT_TRUE(reference.Publish(Message{.sender = c, .channel = "state",
+                                            .send_seq = send_seq(c, k),
+                                            .receive_seq = receive_seq(c, k)}));
+    }
+    ASSERT_TRUE(reference.ClearToAdvance(c, 1 << 20));
+  }
+  Received expected;
+  for (const auto& delivery : reference.Step().deliveries) {
+    expected[delivery.recipient].emplace_back(delivery.message->sender,
+                                              delivery.message->receive_seq,
+                                              delivery.message->send_seq);
+  }
+
+  ServerPipeline pipeline({.num_io_threads = kIo, .num_routers = kRouters,
+                           .ring_capacity = 16});
+  // Join everyone before anyone can advance.
+  for (ClientId c = 0; c < kClients; ++c) {
+    const size_t io = pipeline.IoThreadOf(c);
+    ASSERT_TRUE(pipeline.Decode(io, c, Frame({.kind = Kind::kJoin})));
+    ASSERT_TRUE(pipeline.Decode(io, c, Frame({.kind = Kind::kSubscribe})));
+  }
+  ASSERT_TRUE(pipeline.Order());
+
+  std::atomic<bool> done = false;
+  std::atomic<bool> failed = false;
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  Received received;
+  std::atomic<size_t> total = 0;
+  const size_t expected_total = kClients * kClients * kMessagesPerClient;
+  threads.emplace_back([&] {
+    while (!done) pipeline.Order();
+  });
+  for (size_t router = 0; router < kRouters; ++router) {
+    threads.emplace_back([&, router] {
+      while (!done) pipeline.Route(router);
+    });
+  }
+  for (size_t io = 0; io < kIo; ++io) {
+    threads.emplace_back([&, io] {
+      const auto encode = [&] {
+        pipeline.Encode(io, [&](ClientId client,
+                                std::vector<uint8_t>&& frame) {
+          std::vector<Message> messages;
+          std::optional<Seq> grant;
+          if (!ServerPipeline::ParseOutbound(frame, &messages, &grant)) {
+            failed = true;
+          }
+          std::lock_guard lock(mutex);
+          for (const Message& m : messages) {
+            received[client].emplace_back(m.sender, m.receive_seq,
+                                          m.send_seq);
+          }
+          total += messages.size();
+        });
+      };
+      const auto decode = [&](ClientId client,
+                              const std::vector<uint8_t>& frame) {
+        Status status;
+        while ((status = pipeline.Decode(io, client, frame)).code() ==
+               StatusCode::kBackpressure) {
+          encode();
+        }
+        if (!status) failed = true;
+      };
+      for (int k = 0; k < kMessagesPerClient; ++k) {
+        for (ClientId c = io; c < kClients; c += kIo) {
+          decode(c, PublishFrame(send_seq(c, k), receive_seq(c, k)));
+        }
+      }
+      for (ClientId c = io; c < kClients; c += kIo) {
+        decode(c, Frame({.kind = Kind::kClearToAdvance, .seq = 1 << 20}));
+      }
+      while (total < expected_total && !failed) encode();
+      done = true;
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  ASSERT_FALSE(failed);
+  EXPECT_EQ(received, expected);
+  EXPECT_EQ(pipeline.rejected_requests(), 0);
+}
+
+TEST(ServerPipeline, BadRequestsAndFullRings) {
+  auto errors = std::make_shared<ErrorChannel>();
+  ServerPipeline pipeline({.ring_capacity = 2, .error_channel = errors});
+  EXPECT_EQ(pipeline.Decode(0, 1, std::vector<uint8_t>{}).code(),
+            StatusCode::kProtocolError);
+  EXPECT_EQ(pipeline.Decode(0, 1, std::vector<uint8_t>{9}).code(),
+            StatusCode::kProtocolError);
+  std::vector<uint8_t> trailing = Frame({.kind = Kind::kLeave});
+  trailing.push_back(0);
+  EXPECT_EQ(pipeline.Decode(0, 1, trailing).code(),
+            StatusCode::kProtocolError);
+
+  // Publishing before joining is refused by the sequencer.
+  ASSERT_TRUE(pipeline.Decode(0, 1, PublishFrame(0, 1)));
+  ASSERT_TRUE(pipeline.Decode(0, 1, Frame({.kind = Kind::kJoin})));
+  EXPECT_EQ(pipeline.Decode(0, 1, Frame({.kind = Kind::kJoin})).code(),
+            StatusCode::kBackpressure);
+  pipeline.Order();
+  EXPECT_EQ(pipeline.rejected_requests(), 1);
+  const std::vector<Status> posted = errors->Drain();
+  ASSERT_EQ(posted.size(), 1);
+  EXPECT_EQ(posted[0].code(), StatusCode::kProtocolError);
+}
+
+TEST(ServerPipeline, RefusedPublicationsHoldBackOnlyTheirClient) {
+  ServerPipeline pipeline({.num_io_threads = 1,
+                           .sequencer_config = {.max_skew = 5}});
+  for (ClientId client : {1, 2}) {
+    ASSERT_TRUE(pipeline.Decode(0, client, Frame({.kind = Kind::kJoin})));
+    ASSERT_TRUE(pipeline.Decode(
+        0, client, Frame({.kind = Kind::kSubscribe, .channel = "state"})));
+  }
+  // Client 1 publishes beyond the window, and its clear waits behind that;
+  // client 2's clear, behind both on the same I/O thread, does not.
+  ASSERT_TRUE(pipeline.Decode(0, 1, PublishFrame(10, 11)));
+  ASSERT_TRUE(pipeline.Decode(
+      0, 1, Frame({.kind = Kind::kClearToAdvance, .seq = 20})));
+  ASSERT_TRUE(pipeline.Decode(
+      0, 2, Frame({.kind = Kind::kClearToAdvance, .seq = 50})));
+
+  std::vector<Message> messages;
+  std::optional<Seq> grant;
+  std::optional<Seq> publish_limit;
+  for (int round = 0; round < 10; ++round) {
+    pipeline.Order();
+    pipeline.Route(0);
+    pipeline.Encode(0, [&](ClientId client, std::vector<uint8_t>&& frame) {
+      if (client != 2) return;
+      ASSERT_TRUE(ServerPipeline::ParseOutbound(frame, &messages, &grant,
+                                                &publish_limit));
+    });
+  }
+  ASSERT_EQ(messages.size(), 1);
+  EXPECT_EQ(messages[0].send_seq, 10);
+  EXPECT_EQ(grant, 20);
+  EXPECT_EQ(publish_limit, 25);
+  EXPECT_EQ(pipeline.rejected_requests(), 0);
+}
+
+TEST(ServerPipeline, ParkedClientsArePushedBackAtIngest) {
+  ServerPipeline pipeline({.num_io_threads = 1,
+                           .sequencer_config = {.max_skew = 5},
+                           .ring_capacity = 4});
+  for (ClientId client : {1, 2}) {
+    ASSERT_TRUE(pipeline.Decode(0, client, Frame({.kind = Kind::kJoin})));
+    ASSERT_TRUE(pipeline.Decode(
+        0, client, Frame({.kind = Kind::kSubscribe, .channel = "state"})));
+  }
+  pipeline.Order();
+  // More than a ring's worth beyond the window, then client 2's clear,
+  // which alone lets them in.
+  for (Seq send_seq = 10; send_seq < 16; ++send_seq) {
+    ASSERT_TRUE(pipeline.Enqueue(0, 1, PublishFrame(send_seq, send_seq + 1)));
+  }
+  ASSERT_TRUE(pipeline.Enqueue(
+      0, 2, Frame({.kind = Kind::kClearToAdvance, .seq = 1000})));
+  const auto no_errors = [](ClientId, const Status& status) {
+    ADD_FAILURE() << status.ToString();
+  };
+  pipeline.DecodeQueued(0, no_errors);
+  pipeline.Order();
+  EXPECT_EQ(pipeline.Decode(0, 1, PublishFrame(16, 17)).code(),
+            StatusCode::kBackpressure);
+
+  std::vector<Message> messages;
+  std::optional<Seq> grant;
+  for (int round = 0; round < 10; ++round) {
+    pipeline.DecodeQueued(0, no_errors);
+    pipeline.Order();
+    pipeline.Route(0);
+    pipeline.Encode(0, [&](ClientId client, std::vector<uint8_t>&& frame) {
+      if (client != 2) return;
+      ASSERT_TRUE(ServerPipeline::ParseOutbound(frame, &messages, &grant));
+    });
+  }
+  // Client 1's last publication bounds the grant, and holds back its own.
+  EXPECT_EQ(grant, 15);
+  ASSERT_EQ(messages.size(), 5);
+  EXPECT_EQ(messages.back().send_seq, 14);
+  EXPECT_TRUE(pipeline.Decode(0, 1, PublishFrame(16, 17)));
+  EXPECT_EQ(pipeline.rejected_requests(), 0);
+}
+
+TEST(ServerPipeline, ControlFramesWaitAtMostATurnBehindABurst) {
+  ServerPipeline pipeline({.ring_capacity = 4,
+                           .ingest_config = {.max_frames_per_turn = 4}});
+  for (ClientId client : {1, 2}) {
+    ASSERT_TRUE(pipeline.Decode(0, client, Frame({.kind = Kind::kJoin})));
+  }
+  ASSERT_TRUE(pipeline.Decode(
+      0, 1, Frame({.kind = Kind::kClearToAdvance, .seq = 1000})));
+  pipeline.Order();
+  // Client 1's burst is queued before client 2's clear, which alone holds
+  // back the bound.
+  for (Seq k = 0; k < 200; ++k) {
+    ASSERT_TRUE(pipeline.Enqueue(0, 1, PublishFrame(1000 + k, 1001 + k)));
+  }
+  ASSERT_TRUE(pipeline.Enqueue(
+      0, 2, Frame({.kind = Kind::kClearToAdvance, .seq = 50})));
+
+  int rounds = 0;
+  std::optional<Seq> grant;
+  while (grant != 50 && rounds < 100) {
+    ++rounds;
+    pipeline.DecodeQueued(0, [](ClientId, const Status& status) {
+      ADD_FAILURE() << status.ToString();
+    });
+    pipeline.Order();
+    pipeline.Route(0);
+    pipeline.Encode(0, [&](ClientId client, std::vector<uint8_t>&& frame) {
+      if (client != 2) return;
+      std::vector<Message> messages;
+      ASSERT_TRUE(ServerPipeline::ParseOutbound(frame, &messages, &grant));
+    });
+  }
+  // One turn of client 1's (a ring's worth), then client 2's.
+  EXPECT_EQ(grant, 50);
+  EXPECT_LE(rounds, 2);
+
+  while (pipeline.DecodeQueued(0, [](ClientId, const Status&) {})) {
+    pipeline.Order();
+  }
+  pipeline.Order();
+  EXPECT_EQ(pipeline.rejected_requests(), 0);
+}
+
+}  // namespace
+}  // namespace blocktopus
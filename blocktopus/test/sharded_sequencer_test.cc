@@ -0,0 +1,237 @@
+#include "blocktopus/sharded_sequencer.h"
+
+#include <atomic>
+#include <map>
+#include <thread>
+#include <tuple>
+
+#include <gtest/gtest.h>
+
+#include "blocktopus/test/test_messages.h"
+
+namespace blocktopus {
+namespace {
+
+// (sender, receive_seq, send_seq) of each delivery, by recipient.
+using Received =
+    std::map<ClientId, std::vector<std::tuple<ClientId, Seq, Seq>>>;
+void Record(const Sequencer::Output& output, Received* received) {
+  for (const auto& delivery : output.deliveries) {
+    (*received)[delivery.recipient].emplace_back(
+        delivery.message->sender, delivery.message->receive_seq,
+        delivery.message->send_seq);
+  }
+}
+
+TEST(ShardedSequencer, MessagesCrossShardsInGlobalOrder) {
+  ShardedSequencer sharded({.num_shards = 2});
+  Shard& even = sharded.shard(0);
+  Shard& odd = sharded.shard(1);
+  ASSERT_EQ(sharded.ShardOf(3), 1);
+  ASSERT_TRUE(even.AddClient(2, 0));
+  ASSERT_TRUE(odd.AddClient(3, 0));
+  Seq effective;
+  ASSERT_TRUE(even.Subscribe(2, "state", 0, &effective));
+  ASSERT_TRUE(odd.Subscribe(3, "state", 0, &effective));
+
+  ASSERT_TRUE(odd.Publish(MakeMessage(3, "state", 1, 5)));
+  ASSERT_TRUE(even.Publish(MakeMessage(2, "state", 2, 5)));
+  ASSERT_TRUE(even.Publish(MakeMessage(2, "state", 3, 4)));
+  ASSERT_TRUE(odd.ClearToAdvance(3, 10));
+  ASSERT_TRUE(even.ClearToAdvance(2, 10));
+  Received received;
+  // Two rounds:  one to exchange clears, one to act on them.
+  for (int round = 0; round < 2; ++round) {
+    Status status;
+    Record(even.Step(&status), &received);
+    ASSERT_TRUE(status);
+    Record(odd.Step(&status), &received);
+    ASSERT_TRUE(status);
+  }
+  const std::vector<std::tuple<ClientId, Seq, Seq>> expected{
+      {2, 4, 3}, {2, 5, 2}, {3, 5, 1}};
+  EXPECT_EQ(received[2], expected);
+  EXPECT_EQ(received[3], expected);
+  EXPECT_EQ(even.bound(), 10);
+  EXPECT_EQ(odd.bound(), 10);
+}
+
+TEST(ShardedSequencer, ThreadPerShardMatchesOneSequencer) {
+  constexpr size_t kShards = 4;
+  constexpr ClientId kClients = 12;
+  constexpr int kMessagesPerClient = 200;
+  const auto for_each_message = [](ClientId client, auto&& publish) {
+    for (int k = 0; k < kMessagesPerClient; ++k) {
+      const Seq send_seq = 10 * k + client % 3;
+      publish(MakeMessage(client, "state", send_seq,
+                          send_seq + 1 + (k + client) % 7));
+    }
+  };
+
+  Sequencer reference;
+  Seq effective;
+  for (ClientId c = 0; c < kClients; ++c) {
+    ASSERT_TRUE(reference.AddClient(c, 0));
+    ASSERT_TRUE(reference.Subscribe(c, std::nullopt, 0, &effective));
+  }
+  for (ClientId c = 0; c < kClients; ++c) {
+    for_each_message(c, [&](Message&& m) {
+      ASSERT_TRUE(reference.Publish(std::move(m)));
+    });
+    ASSERT_TRUE(reference.ClearToAdvance(c, 1 << 20));
+  }
+  Received expected;
+  Record(reference.Step(), &expected);
+
+  ShardedSequencer sharded({.num_shards = kShards, .ring_capacity = 64});
+  std::vector<Received> received(kShards);
+  std::atomic<bool> failed = false;
+  std::atomic<size_t> finished = 0;
+  std::vector<std::thread> threads;
+  for (size_t s = 0; s < kShards; ++s) {
+    threads.emplace_back([&, s] {
+      Shard& shard = sharded.shard(s);
+      std::vector<ClientId> mine;
+      for (ClientId c = s; c < kClients; c += kShards) {
+        mine.push_back(c);
+        Seq start;
+        if (!shard.AddClient(c, 0) ||
+            !shard.Subscribe(c, std::nullopt, 0, &start)) {
+          failed = true;
+        }
+      }
+      const size_t expected_count =
+          mine.size() * kClients * kMessagesPerClient;
+      size_t count = 0;
+      const auto step = [&] {
+        Status status;
+        const Sequencer::Output output = shard.Step(&status);
+        if (!status) failed = true;
+        count += output.deliveries.size();
+        Record(output, &received[s]);
+      };
+      for (ClientId c : mine) {
+        for_each_message(c, [&](Message&& m) {
+          Status status;
+          while ((status = shard.Publish(std::move(m))).code() ==
+                 StatusCode::kBackpressure) {
+            step();  // Lets this shard's peers drain its rings.
+          }
+          if (!status) failed = true;
+        });
+        if (!shard.ClearToAdvance(c, 1 << 20)) failed = true;
+      }
+      while (count < expected_count && !failed) step();
+      // The others may still be waiting for what this shard sends.
+      ++finished;
+      while (finished < kShards && !failed) step();
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  ASSERT_FALSE(failed);
+  Received merged;
+  for (const Received& part : received) merged.insert(part.begin(), part.end());
+  EXPECT_EQ(merged, expected);
+}
+
+TEST(ShardedSequencer, FullRingsPushBackAndLateClientsStartAtTheAnnouncement) {
+  ShardedSequencer sharded({.num_shards = 2, .ring_capacity = 2});
+  Shard& even = sharded.shard(0);
+  Shard& odd = sharded.shard(1);
+  ASSERT_TRUE(even.AddClient(2, 0));
+  ASSERT_TRUE(odd.AddObserver(5));
+  Seq effective;
+  ASSERT_TRUE(odd.Subscribe(5, "state", 0, &effective));
+  even.Step();  // Learns of the interest and answers it.
+  odd.Step();
+  ASSERT_TRUE(even.Publish(MakeMessage(2, "state", 1, 2)));
+  ASSERT_TRUE(even.Publish(MakeMessage(2, "state", 2, 3)));
+  Message third = MakeMessage(2, "state", 3, 4);
+  third.payload = {42};
+  EXPECT_EQ(even.Publish(std::move(third)).code(),
+            StatusCode::kBackpressure);
+  EXPECT_EQ(third.payload, std::vector<uint8_t>{42});
+  odd.Step();
+  EXPECT_TRUE(even.Publish(std::move(third)));
+
+  // The shard with no clients of its own follows the other's clear, and a
+  // client joining it later cannot start behind what it announced.
+  ASSERT_TRUE(even.ClearToAdvance(2, 20));
+  even.Step();
+  odd.Step();
+  odd.Step();  // Announces 20.
+  even.Step();
+  EXPECT_EQ(even.bound(), 20);
+  Seq start;
+  ASSERT_TRUE(odd.AddClient(3, 5, &start));
+  EXPECT_EQ(start, 20);
+}
+
+TEST(ShardedSequencer, MessagesGoOnlyWhereSubscribedUntilLateInterest) {
+  // Messages 0-3 are sent before 7, and message 2 is received after it.
+  const auto publish = [](Seq first, Seq end, auto&& publish_one) {
+    for (Seq k = first; k < end; ++k) {
+      Message message = MakeMessage(2, "state", 2 * k, 2 * k + 1 + 3 * (k % 3));
+      message.channel = k % 2 == 0 ? "state" : "other";
+      publish_one(std::move(message));
+    }
+  };
+  // What one sequencer delivers to a client subscribed to "state" at 7.
+  Sequencer reference;
+  Seq effective;
+  ASSERT_TRUE(reference.AddClient(2, 0));
+  ASSERT_TRUE(reference.AddClient(3, 0));
+  ASSERT_TRUE(reference.ClearToAdvance(3, 100));
+  const auto publish_to_reference = [&](Message&& m) {
+    ASSERT_TRUE(reference.Publish(std::move(m)));
+  };
+  publish(0, 4, publish_to_reference);
+  ASSERT_TRUE(reference.ClearToAdvance(2, 7));
+  reference.Step();
+  ASSERT_TRUE(reference.Subscribe(3, "state", 0, &effective));
+  ASSERT_EQ(effective, 7);
+  publish(4, 10, publish_to_reference);
+  ASSERT_TRUE(reference.ClearToAdvance(2, 100));
+  Received expected;
+  Record(reference.Step(), &expected);
+  ASSERT_EQ(expected[3].size(), 4);
+
+  // With no subscriber on the other shard, nothing is put on its ring.
+  ShardedSequencer sharded({.num_shards = 2, .ring_capacity = 2});
+  Shard& even = sharded.shard(0);
+  Shard& odd = sharded.shard(1);
+  ASSERT_TRUE(even.AddClient(2, 0));
+  ASSERT_TRUE(odd.AddClient(3, 0));
+  ASSERT_TRUE(odd.ClearToAdvance(3, 100));
+  const auto publish_to_even = [&](Message&& m) {
+    ASSERT_TRUE(even.Publish(std::move(m)));
+  };
+  publish(0, 4, publish_to_even);
+  ASSERT_TRUE(even.ClearToAdvance(2, 7));
+  even.Step();
+  odd.Step();
+  ASSERT_EQ(odd.bound(), 7);
+
+  // A late subscriber is sent what was kept for it, and nothing is
+  // delivered until then.
+  ASSERT_TRUE(odd.Subscribe(3, "state", 0, &effective));
+  ASSERT_EQ(effective, 7);
+  publish(4, 10, publish_to_even);
+  ASSERT_TRUE(even.ClearToAdvance(2, 100));
+  Received received;
+  Status status;
+  Record(odd.Step(&status), &received);
+  ASSERT_TRUE(status);
+  EXPECT_TRUE(received.empty());
+  for (int round = 0; round < 3; ++round) {
+    Record(even.Step(&status), &received);
+    ASSERT_TRUE(status);
+    Record(odd.Step(&status), &received);
+    ASSERT_TRUE(status);
+  }
+  EXPECT_EQ(received, expected);
+  EXPECT_EQ(odd.bound(), 100);
+}
+
+}  // namespace
+}  // namespace blocktopus
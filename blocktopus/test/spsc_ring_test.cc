@@ -0,0 +1,73 @@
+#include "blocktopus/spsc_ring.h"
+
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+TEST(SpscRing, FifoAndCapacity) {
+  SpscRing<int> ring(3);
+  EXPECT_EQ(ring.capacity(), 4);
+  for (int i = 0; i < 4; ++i) {
+    int value = i;
+    EXPECT_TRUE(ring.TryPush(std::move(value)));
+  }
+  int overflow = 99;
+  EXPECT_FALSE(ring.TryPush(std::move(overflow)));
+  EXPECT_EQ(ring.size(), 4);
+  for (int i = 0; i < 4; ++i) {
+    int value = -1;
+    ASSERT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(value, i);
+  }
+  int value;
+  EXPECT_FALSE(ring.TryPop(&value));
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(SpscRing, MoveOnly) {
+  SpscRing<std::unique_ptr<int>> ring(2);
+  ASSERT_TRUE(ring.TryPush(std::make_unique<int>(7)));
+  ASSERT_NE(ring.Front(), nullptr);
+  EXPECT_EQ(**ring.Front(), 7);
+  std::unique_ptr<int> out;
+  ASSERT_TRUE(ring.TryPop(&out));
+  EXPECT_EQ(*out, 7);
+  EXPECT_EQ(ring.Front(), nullptr);
+
+  // Consuming in place.
+  auto shared = std::make_shared<int>(8);
+  SpscRing<std::shared_ptr<int>> in_place(2);
+  ASSERT_TRUE(in_place.TryPush(std::shared_ptr<int>(shared)));
+  EXPECT_EQ(**in_place.Front(), 8);
+  in_place.PopFront();
+  EXPECT_TRUE(in_place.empty());
+  EXPECT_EQ(shared.use_count(), 1);  // The slot let go.
+}
+
+TEST(SpscRing, CrossThread) {
+  constexpr int kCount = 100000;
+  SpscRing<int> ring(64);
+  std::thread producer([&]() {
+    for (int i = 0; i < kCount; ++i) {
+      int value = i;
+      while (!ring.TryPush(std::move(value))) std::this_thread::yield();
+    }
+  });
+  for (int expected = 0; expected < kCount; ) {
+    int value;
+    if (ring.TryPop(&value)) {
+      ASSERT_EQ(value, expected);
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,66 @@
+#include "blocktopus/status.h"
+
+#include <cerrno>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+TEST(Status, DefaultIsOk) {
+  Status status;
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(static_cast<bool>(status));
+  EXPECT_EQ(status.code(), StatusCode::kOk);
+}
+
+TEST(Status, FromErrnoClassifies) {
+  EXPECT_EQ(Status::FromErrno("recv", ECONNRESET).code(),
+            StatusCode::kConnectionReset);
+  EXPECT_EQ(Status::FromErrno("send", EPIPE).code(),
+            StatusCode::kConnectionReset);
+  const Status other = Status::FromErrno("poll", EINVAL);
+  EXPECT_EQ(other.code(), StatusCode::kIoError);
+  EXPECT_FALSE(other);
+  EXPECT_EQ(other.system_errno(), EINVAL);
+  EXPECT_NE(other.ToString().find("poll"), std::string::npos);
+}
+
+TEST(ErrorChannel, DrainsInOrder) {
+  ErrorChannel channel;
+  channel.Post(Status(StatusCode::kClosed, "a"));
+  channel.Post(Status(StatusCode::kIoError, "b", EIO));
+  const std::vector<Status> drained = channel.Drain();
+  ASSERT_EQ(drained.size(), 2);
+  EXPECT_STREQ(drained[0].what(), "a");
+  EXPECT_STREQ(drained[1].what(), "b");
+  EXPECT_TRUE(channel.Drain().empty());
+}
+
+TEST(ErrorChannel, DropsWhenFull) {
+  ErrorChannel channel(2);
+  for (int i = 0; i < 5; ++i) {
+    channel.Post(Status(StatusCode::kClosed, "x"));
+  }
+  EXPECT_EQ(channel.Drain().size(), 2);
+  EXPECT_EQ(channel.dropped(), 3);
+}
+
+TEST(ErrorChannel, CrossThread) {
+  ErrorChannel channel;
+  std::thread poster([&]() {
+    for (int i = 0; i < 100; ++i) {
+      channel.Post(Status(StatusCode::kConnectionReset, "recv"));
+    }
+  });
+  size_t received = 0;
+  while (received < 100) {
+    received += channel.Drain().size();
+  }
+  poster.join();
+  EXPECT_EQ(received, 100);
+}
+
+}  // namespace
+}  // namespace blocktopus
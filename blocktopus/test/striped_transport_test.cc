@@ -0,0 +1,150 @@
+#include "blocktopus/striped_transport.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <optional>
+
+#include <gtest/gtest.h>
+
+namespace blocktopus {
+namespace {
+
+// Two striped transports joined by @p num_streams socketpairs.
+struct StripedPair {
+  StripedPair(size_t num_streams, const StripedTransport::Config& config) {
+    std::vector<Transport> client_streams;
+    std::vector<Transport> server_streams;
+    for (size_t i = 0; i < num_streams; ++i) {
+      int fds[2];
+      EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+      client_streams.push_back(Transport::FromConnectedSocket(fds[0], {}));
+      server_streams.push_back(Transport::FromConnectedSocket(
+          fds[1], Transport::Config{.end = Transport::End::kServer}));
+    }
+    client.emplace(std::move(client_streams), config);
+    server.emplace(std::move(server_streams), config);
+  }
+
+  // Pump both ends until the server has received @p count datagrams.
+  std::vector<std::vector<uint8_t>> Receive(size_t count) {
+    std::vector<std::vector<uint8_t>> received;
+    for (int i = 0; i < 10000 && received.size() < count; ++i) {
+      EXPECT_TRUE(client->ProcessIO());
+      EXPECT_TRUE(server->ProcessIO());
+      for (auto& datagram : server->ReceiveAll()) {
+        received.push_back(std::move(datagram));
+      }
+    }
+    return received;
+  }
+
+  std::optional<StripedTransport> client;
+  std::optional<StripedTransport> server;
+};
+
+std::vector<uint8_t> Pattern(size_t size, uint8_t seed) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; ++i) data[i] = seed + i * 7;
+  return data;
+}
+
+TEST(StripedTransport, BulkDatagramsReassembleInOrder) {
+  StripedPair pair(4, {.min_striped_size = 1000, .fragment_size = 1000});
+  // Fragment counts that are not multiples of the three bulk streams, so
+  // each datagram starts on a different stream.
+  const std::vector<std::vector<uint8_t>> sent{
+      Pattern(200000, 1), Pattern(1000, 2), Pattern(54321, 3),
+      Pattern(7001, 4)};
+  for (const auto& datagram : sent) pair.client->Send(datagram);
+  EXPECT_EQ(pair.Receive(sent.size()), sent);
+}
+
+TEST(StripedTransport, ControlDatagramsOvertakeBulk) {
+  StripedPair pair(3, {});
+  const std::vector<uint8_t> bulk = Pattern(8 << 20, 5);
+  const std::vector<uint8_t> control = Pattern(10, 6);
+  pair.client->Send(bulk);
+  pair.client->Send(control);
+  ASSERT_TRUE(pair.client->ProcessIO());
+  ASSERT_TRUE(pair.server->ProcessIO());
+  // Only a fraction of the bulk datagram can have been sent yet.
+  EXPECT_EQ(pair.server->ReceiveAll(),
+            std::vector<std::vector<uint8_t>>{control});
+  EXPECT_EQ(pair.Receive(1), std::vector<std::vector<uint8_t>>{bulk});
+}
+
+TEST(StripedTransport, EmptyDatagramsKeepTheirPlace) {
+  StripedPair pair(3, {.min_striped_size = 0, .fragment_size = 1000});
+  const std::vector<std::vector<uint8_t>> sent{
+      Pattern(1500, 1), {}, Pattern(2500, 2)};
+  for (const auto& datagram : sent) pair.client->Send(datagram);
+  EXPECT_EQ(pair.Receive(sent.size()), sent);
+
+  EXPECT_THROW(StripedTransport(std::vector<Transport>(),
+                                {.fragment_size = 0}),
+               std::invalid_argument);
+}
+
+// @return the status of a `StripedTransport` fed @p fragments on a bulk
+// stream.
+Status Feed(const std::vector<std::vector<uint8_t>>& fragments) {
+  std::vector<Transport> raw;
+  std::vector<Transport> streams;
+  for (int i = 0; i < 2; ++i) {
+    int fds[2];
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    raw.push_back(Transport::FromConnectedSocket(fds[0], {}));
+    streams.push_back(Transport::FromConnectedSocket(
+        fds[1], Transport::Config{.end = Transport::End::kServer}));
+  }
+  StripedTransport striped(std::move(streams), {.max_open_datagrams = 100});
+  for (const auto& fragment : fragments) raw[1].Send(fragment);
+  Status status = Status::Ok();
+  for (int i = 0; i < 1000 && status; ++i) {
+    EXPECT_TRUE(raw[1].ProcessIO());
+    status = striped.ProcessIO();
+    // Nothing is ever complete.
+    EXPECT_TRUE(striped.ReceiveAll().empty());
+  }
+  return status;
+}
+
+TEST(StripedTransport, IdleStreamsAreWaitedOnTogether) {
+  constexpr int kWaitMs = 100;
+  constexpr size_t kNumStreams = 8;
+  std::vector<Transport> streams;
+  std::vector<int> peers;
+  for (size_t i = 0; i < kNumStreams; ++i) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    streams.push_back(Transport::FromConnectedSocket(
+        fds[0], Transport::Config{.io_wait_timeout_ms = kWaitMs}));
+    peers.push_back(fds[1]);
+  }
+  StripedTransport striped(std::move(streams), {});
+  const auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(striped.ProcessIO());
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  // One wait for all of them, not one per stream.
+  EXPECT_LT(elapsed, std::chrono::milliseconds(kNumStreams * kWaitMs / 2));
+  for (int fd : peers) close(fd);
+}
+
+TEST(StripedTransport, MalformedFragmentsAreProtocolErrors) {
+  // Message 0, size 4, offset 3, with 2 bytes.
+  EXPECT_EQ(Feed({{1, 0, 4, 3, 'x', 'y'}}).code(),
+            StatusCode::kProtocolError);
+  // The same 2 bytes twice do not make 4.
+  EXPECT_EQ(Feed({{1, 0, 4, 0, 'x', 'y'}, {1, 0, 4, 0, 'x', 'y'}}).code(),
+            StatusCode::kProtocolError);
+  EXPECT_EQ(Feed({{1, 0, 4, 0, 'x', 'y'}, {1, 0, 4, 1, 'x', 'y'}}).code(),
+            StatusCode::kProtocolError);
+  // Message 100 is beyond the window of open datagrams.
+  EXPECT_EQ(Feed({{1, 100, 4, 0, 'x', 'y'}}).code(),
+            StatusCode::kProtocolError);
+}
+
+}  // namespace
+}  // namespace blocktopus
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "blocktopus/common.h"
+
+/// @file Messages for tests to publish and deliver.
+
+namespace blocktopus {
+
+/// @return a message from @p sender on @p channel carrying @p payload.
+inline Message MakeMessage(ClientId sender, const std::string& channel,
+                           Seq send_seq, Seq receive_seq,
+                           std::vector<uint8_t> payload) {
+  return Message{.sender = sender, .channel = channel,
+                 .send_seq = send_seq, .receive_seq = receive_seq,
+                 .payload = std::move(payload)};
+}
+
+/// As above, with a one-byte payload of @p send_seq, so that deliveries
+/// can be told apart by payload alone.
+inline Message MakeMessage(ClientId sender, const std::string& channel,
+                           Seq send_seq, Seq receive_seq) {
+  return MakeMessage(sender, channel, send_seq, receive_seq,
+                     {static_cast<uint8_t>(send_seq)});
+}
+
+/// @return @p size bytes that differ from one position, and one @p seed, to
+/// the next, so that misplaced or corrupted bytes show.
+inline std::vector<uint8_t> PatternPayload(size_t size, uint8_t seed = 0) {
+  std::vector<uint8_t> payload(size);
+  for (size_t i = 0; i < size; ++i) {
+    payload[i] = static_cast<uint8_t>(i * 7 + seed);
+  }
+  return payload;
+}
+
+/// @return @p message as delivered:  shared and immutable.
+inline std::shared_ptr<const Message> Share(Message&& message) {
+  return std::make_shared<const Message>(std::move(message));
+}
+
+}  // namespace blocktopus
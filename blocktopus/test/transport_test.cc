@@ -1,5 +1,12 @@
 #include "blocktopus/transport.h"
 
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
 #include <thread>
 
 #include <gtest/gtest.h>
@@ -108,4 +115,220 @@ TEST(Connection, SendReceiveMulti) {
   EXPECT_EQ(received.size(), 3);
 }
 
+TEST(Connection, PayloadIntact) {
+  TransportServer server(TransportServer::Config{});
+  auto server_port = server.GetPortNumber();
+  Transport client_transport(Transport::Config{
+    .remote_addr = "localhost",
+    .remote_port = server_port});
+  std::thread client_start([&](){ client_transport.Start(); });
+  Transport server_transport = server.AwaitIncomingConnection();
+  client_start.join();
+  std::string data = "foo";
+
+  client_transport.Send(std::vector<uint8_t>(data.begin(), data.end()));
+  std::vector<std::unique_ptr<Transport::RxBuffer>> received;
+  while (received.size() == 0) {
+    ASSERT_TRUE(client_transport.ProcessIO());
+    ASSERT_TRUE(server_transport.ProcessIO());
+    received = server_transport.ReceiveAll();
+  }
+  ASSERT_EQ(received.size(), 1);
+  EXPECT_EQ(std::string(received[0]->data.begin(), received[0]->data.end()),
+            data);
+}
+
+// Both ends send far more than the socket buffers can hold before either
+// receives anything; a ProcessIO that insisted on finishing its sends before
+// receiving would never return.
+TEST(Connection, BidirectionalBurst) {
+  TransportServer server(TransportServer::Config{});
+  auto server_port = server.GetPortNumber();
+  Transport client_transport(Transport::Config{
+    .remote_addr = "localhost",
+    .remote_port = server_port});
+  std::thread client_start([&](){ client_transport.Start(); });
+  Transport server_transport = server.AwaitIncomingConnection();
+  client_start.join();
+
+  constexpr size_t kNumMessages = 200;
+  constexpr size_t kMessageSize = 64 * 1024;
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    std::vector<uint8_t> data(kMessageSize, static_cast<uint8_t>(i));
+    client_transport.Send(data);
+    server_transport.Send(data);
+  }
+  size_t client_received = 0;
+  size_t server_received = 0;
+  for (int iterations = 0;
+       client_received < kNumMessages || server_received < kNumMessages;
+       ++iterations) {
+    ASSERT_LT(iterations, 100000);
+    ASSERT_TRUE(client_transport.ProcessIO());
+    ASSERT_TRUE(server_transport.ProcessIO());
+    for (const auto& buffer : client_transport.ReceiveAll()) {
+      ASSERT_EQ(buffer->data.size(), kMessageSize);
+      EXPECT_EQ(buffer->data[0], static_cast<uint8_t>(client_received));
+      ++client_received;
+    }
+    for (const auto& buffer : server_transport.ReceiveAll()) {
+      ASSERT_EQ(buffer->data.size(), kMessageSize);
+      EXPECT_EQ(buffer->data[0], static_cast<uint8_t>(server_received));
+      ++server_received;
+    }
+  }
+}
+
+TEST(Connection, PeerCloseIsReportedNotThrown) {
+  auto errors = std::make_shared<ErrorChannel>();
+  TransportServer server(TransportServer::Config{
+    .transport_config_prototype = {.error_channel = errors}});
+  auto server_port = server.GetPortNumber();
+  auto client_transport = std::make_unique<Transport>(Transport::Config{
+    .remote_addr = "localhost",
+    .remote_port = server_port});
+  std::thread client_start([&](){ client_transport->Start(); });
+  Transport server_transport = server.AwaitIncomingConnection();
+  client_start.join();
+
+  client_transport.reset();
+  Status status;
+  for (int i = 0; i < 1000 && status.ok(); ++i) {
+    status = server_transport.ProcessIO();
+  }
+  EXPECT_EQ(status.code(), StatusCode::kClosed);
+  const std::vector<Status> posted = errors->Drain();
+  ASSERT_EQ(posted.size(), 1);
+  EXPECT_EQ(posted[0].code(), StatusCode::kClosed);
+}
+
+// Find a port that is (at least momentarily) free.
+uint16_t UnusedPort() {
+  TransportServer probe(TransportServer::Config{});
+  return probe.GetPortNumber();
+}
+
+TEST(ClientServerPair, ConnectRetriesUntilServerListens) {
+  const uint16_t port = UnusedPort();
+  Transport client(Transport::Config{
+    .remote_addr = "localhost",
+    .remote_port = port});
+  std::thread client_start([&](){ client.Start(); });
+  // The client is now being refused; give it a few retries.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  TransportServer server(TransportServer::Config{.listen_port = port});
+  Transport server_transport = server.AwaitIncomingConnection();
+  client_start.join();
+  EXPECT_EQ(server_transport.config().remote_addr, "127.0.0.1");
+}
+
+TEST(ClientServerPair, ConnectTimesOut) {
+  Transport client(Transport::Config{
+    .remote_addr = "localhost",
+    .remote_port = UnusedPort(),
+    .connect_timeout_ms = 100});
+  EXPECT_THROW(client.Start(), std::runtime_error);
+}
+
+TEST(ClientServerPair, TcpFastOpen) {
+  TransportServer server(TransportServer::Config{
+    .tcp_fast_open_queue_length = 16});
+  Transport client_transport(Transport::Config{
+    .remote_addr = "localhost",
+    .remote_port = server.GetPortNumber(),
+    .tcp_fast_open = true});
+  client_transport.Start();
+  std::string data = "foo";
+  client_transport.Send(std::vector<uint8_t>(data.begin(), data.end()));
+  // With TFO the connection is only made by the first send.
+  ASSERT_TRUE(client_transport.ProcessIO());
+  Transport server_transport = server.AwaitIncomingConnection();
+  std::vector<std::unique_ptr<Transport::RxBuffer>> received;
+  while (received.size() == 0) {
+    ASSERT_TRUE(client_transport.ProcessIO());
+    ASSERT_TRUE(server_transport.ProcessIO());
+    received = server_transport.ReceiveAll();
+  }
+  ASSERT_EQ(received.size(), 1);
+  EXPECT_EQ(std::string(received[0]->data.begin(), received[0]->data.end()),
+            data);
+}
+
+TEST(Connection, InheritedSocket) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  EXPECT_FALSE(Transport::FromInheritedSocket({}).has_value());
+  setenv(Transport::kInheritedSocketEnvVar, std::to_string(fds[1]).c_str(), 1);
+  std::optional<Transport> component = Transport::FromInheritedSocket({});
+  unsetenv(Transport::kInheritedSocketEnvVar);
+  ASSERT_TRUE(component.has_value());
+  component->Start();  // No-op; already connected.
+  Transport server_end = Transport::FromConnectedSocket(
+    fds[0], Transport::Config{.end = Transport::End::kServer});
+
+  std::string data = "foo";
+  component->Send(std::vector<uint8_t>(data.begin(), data.end()));
+  std::vector<std::unique_ptr<Transport::RxBuffer>> received;
+  while (received.size() == 0) {
+    ASSERT_TRUE(component->ProcessIO());
+    ASSERT_TRUE(server_end.ProcessIO());
+    received = server_end.ReceiveAll();
+  }
+  ASSERT_EQ(received.size(), 1);
+  EXPECT_EQ(std::string(received[0]->data.begin(), received[0]->data.end()),
+            data);
+}
+
+TEST(Connection, FileRegionArrivesAsADatagram) {
+  const std::string path = ::testing::TempDir() + "/transport_test." +
+                           std::to_string(getpid());
+  {
+    std::ofstream out(path, std::ios::binary);
+    for (int i = 0; i < (1 << 20); ++i) out.put(static_cast<char>(i % 253));
+  }
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  Transport sender = Transport::FromConnectedSocket(fds[0], {});
+  Transport receiver = Transport::FromConnectedSocket(
+    fds[1], Transport::Config{.end = Transport::End::kServer});
+
+  sender.Send({1, 2, 3});
+  sender.SendFileRegion(
+      FileRegion::Open({.path = path, .offset = 7, .length = 300000}));
+  sender.Send({4});
+  unlink(path.c_str());
+  std::vector<std::unique_ptr<Transport::RxBuffer>> received;
+  while (received.size() < 3) {
+    ASSERT_TRUE(sender.ProcessIO());
+    ASSERT_TRUE(receiver.ProcessIO());
+    for (auto& buffer : receiver.ReceiveAll()) {
+      received.push_back(std::move(buffer));
+    }
+  }
+  EXPECT_EQ(received[0]->data, (std::vector<uint8_t>{1, 2, 3}));
+  ASSERT_EQ(received[1]->data.size(), 300000);
+  for (size_t i = 0; i < received[1]->data.size(); ++i) {
+    ASSERT_EQ(received[1]->data[i], (7 + i) % 253);
+  }
+  EXPECT_EQ(received[2]->data, (std::vector<uint8_t>{4}));
+}
+
+TEST(Connection, FileRegionsBeyondTheDatagramLimitAreRefused) {
+  const std::string path = ::testing::TempDir() + "/transport_test_large." +
+                           std::to_string(getpid());
+  {
+    // Sparse, so it takes no space.
+    std::ofstream out(path, std::ios::binary);
+  }
+  ASSERT_EQ(truncate(path.c_str(), (off_t{1} << 32) + 1), 0);
+  auto region = FileRegion::Open({.path = path, .offset = 0,
+                                  .length = (size_t{1} << 32) + 1});
+  unlink(path.c_str());
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  Transport sender = Transport::FromConnectedSocket(fds[0], {});
+  close(fds[1]);
+  EXPECT_THROW(sender.SendFileRegion(region), std::invalid_argument);
+}
+
 }  // namespace blocktopus
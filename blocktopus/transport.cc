@@ -2,22 +2,56 @@
 
 #include "fmt/core.h"
 
+#include <arpa/inet.h>
 #include <fcntl.h>
-#include <iostream>
 #include <sstream>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "logging.h"
+
 namespace blocktopus {
 
 namespace {
 
+// Writing to a socket whose peer has gone away must report EPIPE rather
+// than kill the process with SIGPIPE.  (MacOS lacks MSG_NOSIGNAL and
+// instead uses the SO_NOSIGPIPE socket option.)
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = MSG_DONTWAIT;
+#endif
+
 /// @brief Perform standard unix return value handling.
 ///
 /// If the potential error value is negative, raise an exception with its
 /// return code's `strerror` or that of the value in `errno`.
 ///
 /// Otherwise @return the non-error value.
+///
+/// Only for setup paths (bind, connect, accept, ...); code on the I/O hot
+/// path reports errors as a `Status` instead.
 int HandleError(const std::string& what, int maybe_error) {
   int error_to_print = maybe_error;
   if (maybe_error >= 0) return maybe_error;
@@ -26,11 +60,34 @@ int HandleError(const std::string& what, int maybe_error) {
     fmt::format("ERROR[{} => {}/{}]: {}",
                 what, maybe_error, error_to_print, strerror(error_to_print));
   // This will often be called outside of the main thread, in which case
-  // the thrown text will not be output.  Write it directly before we throw.
-  std::cerr << error_text << std::endl;
+  // the thrown text will not be output.  Log it before we throw, and since
+  // the exception may well terminate the process (and this is not a hot
+  // path) wait for the log to be written.
+  LogError("{}", error_text);
+  FlushLog();
   throw std::logic_error(error_text);
 }
 
+void SetNonblocking(int fd, bool nonblocking) {
+  const int flags = HandleError("fcntl(F_GETFL)", fcntl(fd, F_GETFL));
+  HandleError("fcntl(F_SETFL)",
+              fcntl(fd, F_SETFL,
+                    nonblocking ? (flags | O_NONBLOCK)
+                                : (flags & ~O_NONBLOCK)));
+}
+
+/// @brief Apply the options every connected socket needs.
+void ConfigureConnectedSocket(int fd) {
+#ifdef SO_NOSIGPIPE
+  int one = 1;
+  HandleError("setsockopt(SO_NOSIGPIPE)",
+              setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one)));
+#endif
+  // Every send and receive is already nonblocking (`MSG_DONTWAIT`), but
+  // `sendfile` takes no flags and so needs the socket itself to be.
+  SetNonblocking(fd, true);
+}
+
 /// @brief Return a bound, listening socket ready for accept() calls.
 ///
 /// Creates and binds a new socket and puts it into listen mode
@@ -59,78 +116,409 @@ int BoundListeningSocket(
   HandleError("listen",
               listen(sock_fd, config.max_connection_queue_size));
 
+  if (config.tcp_fast_open_queue_length > 0) {
+#ifdef TCP_FASTOPEN
+    const int queue_length = config.tcp_fast_open_queue_length;
+    if (setsockopt(sock_fd, IPPROTO_TCP, TCP_FASTOPEN,
+                   &queue_length, sizeof(queue_length)) < 0) {
+      LogWarning("setsockopt(TCP_FASTOPEN): {}", strerror(errno));
+    }
+#else
+    LogWarning("TCP Fast Open is not supported on this platform");
+#endif
+  }
+
   return sock_fd;
 }
 
-bool TryNonblockingReceive(
+/// @brief One candidate address for a remote host.
+struct ResolvedAddress {
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  int family;
+  int socktype;
+  int protocol;
+};
+
+/// How long a successful name resolution is reused.  Launching hundreds of
+/// clients at once otherwise means hundreds of identical lookups (and
+/// every retry of a refused connection would repeat its lookup).
+constexpr std::chrono::seconds kResolutionCacheTtl{60};
+
+/// @brief (BLOCKING) Resolve @p host and @p port, consulting and filling a
+/// process-wide cache.
+///
+/// @return the candidate addresses, or an empty vector (with @p gai_error
+/// set) if resolution failed.  Failures are not cached.
+std::vector<ResolvedAddress> Resolve(const std::string& host, uint16_t port,
+                                     int* gai_error) {
+  struct CacheEntry {
+    std::chrono::steady_clock::time_point expiry;
+    std::vector<ResolvedAddress> addresses;
+  };
+  static std::mutex cache_mutex;
+  static std::map<std::pair<std::string, uint16_t>, CacheEntry> cache;
+
+  const auto key = std::make_pair(host, port);
+  const auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(key);
+    if (it != cache.end() && it->second.expiry > now) {
+      return it->second.addresses;
+    }
+  }
+
+  struct addrinfo hints;
+  struct addrinfo* addr_list;
+  std::string port_string = fmt::format("{}", port);
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  *gai_error = getaddrinfo(host.c_str(), port_string.c_str(),
+                           &hints, &addr_list);
+  if (*gai_error != 0) return {};
+  std::vector<ResolvedAddress> result;
+  for (struct addrinfo* addr = addr_list;
+       addr != NULL;
+       addr = addr->ai_next) {
+    ResolvedAddress resolved{};
+    memcpy(&resolved.addr, addr->ai_addr, addr->ai_addrlen);
+    resolved.addr_len = addr->ai_addrlen;
+    resolved.family = addr->ai_family;
+    resolved.socktype = addr->ai_socktype;
+    resolved.protocol = addr->ai_protocol;
+    result.push_back(resolved);
+  }
+  freeaddrinfo(addr_list);
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  cache[key] = CacheEntry{now + kResolutionCacheTtl, result};
+  return result;
+}
+
+/// @brief (BLOCKING) Race nonblocking connections to every candidate in
+/// @p addresses, returning the first to complete.
+///
+/// Losing attempts are closed.  @return a connected (blocking-mode) socket,
+/// or -1 (with @p last_error set to an errno value) if every attempt failed
+/// or @p deadline passed.
+int RaceConnect(const std::vector<ResolvedAddress>& addresses,
+                std::chrono::steady_clock::time_point deadline,
+                int* last_error) {
+  std::vector<struct pollfd> attempts;
+  auto close_all_but = [&](int keep) {
+    for (const struct pollfd& attempt : attempts) {
+      if (attempt.fd != keep) close(attempt.fd);
+    }
+  };
+  *last_error = ETIMEDOUT;
+  for (const ResolvedAddress& address : addresses) {
+    int fd = socket(address.family, address.socktype, address.protocol);
+    if (fd < 0) {
+      *last_error = errno;
+      continue;
+    }
+    SetNonblocking(fd, true);
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&address.addr),
+                address.addr_len) == 0) {
+      close_all_but(fd);  // Connected synchronously (e.g. loopback).
+      SetNonblocking(fd, false);
+      return fd;
+    }
+    if (errno != EINPROGRESS) {
+      *last_error = errno;
+      close(fd);
+      continue;
+    }
+    attempts.push_back({.fd = fd, .events = POLLOUT, .revents = 0});
+  }
+
+  while (!attempts.empty()) {
+    const auto remaining =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      *last_error = ETIMEDOUT;
+      break;
+    }
+    const int ready = poll(attempts.data(), attempts.size(), remaining);
+    if (ready < 0 && errno != EINTR) {
+      *last_error = errno;
+      break;
+    }
+    for (auto it = attempts.begin(); it != attempts.end(); ) {
+      if (it->revents == 0) {
+        ++it;
+        continue;
+      }
+      int error = 0;
+      socklen_t error_len = sizeof(error);
+      getsockopt(it->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+      if (error == 0) {
+        const int winner = it->fd;
+        close_all_but(winner);
+        SetNonblocking(winner, false);
+        return winner;
+      }
+      *last_error = error;
+      close(it->fd);
+      it = attempts.erase(it);
+    }
+  }
+  close_all_but(-1);
+  return -1;
+}
+
+/// @brief (BLOCKING) Open a TCP Fast Open client socket to the first of
+/// @p addresses.
+///
+/// The SYN (carrying the first datagram) is not sent until the first write,
+/// so there is nothing to race or retry here; connection failures surface
+/// from `ProcessIO` instead.  @return -1 if TFO is unavailable.
+int FastOpenSocket(const std::vector<ResolvedAddress>& addresses) {
+#ifdef TCP_FASTOPEN_CONNECT
+  for (const ResolvedAddress& address : addresses) {
+    int fd = socket(address.family, address.socktype, address.protocol);
+    if (fd < 0) continue;
+    int one = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                   &one, sizeof(one)) == 0 &&
+        connect(fd, reinterpret_cast<const struct sockaddr*>(&address.addr),
+                address.addr_len) == 0) {
+      return fd;
+    }
+    close(fd);
+  }
+#else
+  (void)addresses;
+#endif
+  return -1;
+}
+
+/// @brief (BLOCKING) Connect to the server named in @p config, retrying
+/// with jittered exponential backoff until `config.connect_timeout_ms`.
+///
+/// Servers and clients are commonly launched together, so a refused
+/// connection usually just means the server is not listening yet.
+/// @return a connected socket; throws if the deadline passes first.
+int ConnectWithRetry(const Transport::Config& config) {
+  const auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(config.connect_timeout_ms);
+  // Jitter only spreads out retries; it does not need to be deterministic.
+  std::minstd_rand jitter(std::random_device{}());
+  int backoff_ms = std::max(1, config.connect_retry_initial_ms);
+  std::string last_error_text;
+  while (true) {
+    int gai_error = 0;
+    const std::vector<ResolvedAddress> addresses =
+      Resolve(config.remote_addr, config.remote_port, &gai_error);
+    if (addresses.empty()) {
+      last_error_text = fmt::format("getaddrinfo({}): {}", config.remote_addr,
+                                    gai_strerror(gai_error));
+    } else {
+      if (config.tcp_fast_open) {
+        const int fd = FastOpenSocket(addresses);
+        if (fd >= 0) return fd;
+        LogWarning("TCP Fast Open unavailable; connecting normally");
+      }
+      int last_error = 0;
+      const int fd = RaceConnect(addresses, deadline, &last_error);
+      if (fd >= 0) return fd;
+      last_error_text = fmt::format("connect({}:{}): {}", config.remote_addr,
+                                    config.remote_port, strerror(last_error));
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) break;
+    std::uniform_int_distribution<int> sleep_ms(backoff_ms / 2, backoff_ms);
+    std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+      std::chrono::milliseconds(sleep_ms(jitter)), deadline - now));
+    backoff_ms = std::min(backoff_ms * 2,
+                          std::max(backoff_ms, config.connect_retry_max_ms));
+  }
+  std::string error_text = fmt::format(
+    "ERROR[{} after {}ms]", last_error_text, config.connect_timeout_ms);
+  LogError("{}", error_text);
+  FlushLog();
+  throw std::runtime_error(error_text);
+}
+
+/// @brief The outcome of one nonblocking attempt to move a datagram.
+enum class IoResult {
+  kComplete,    // The whole datagram has now been moved.
+  kWouldBlock,  // The socket can take/give no more right now.
+  kFailed,      // The connection is unusable; see the accompanying Status.
+};
+
+// These run on the I/O hot path, so they report failures via @p status
+// rather than throwing.
+
+IoResult TryNonblockingReceive(
     int fd,
-    Transport::RxBuffer* buffer) {
-  buffer->data.reserve(4);
+    Transport::RxBuffer* buffer,
+    Status* status) {
+  // The header is read into `data`, which is then resized to hold only the
+  // payload once the header has been decoded.
   while (buffer->bytes_received < Transport::kHeaderSize) {
+    buffer->data.resize(Transport::kHeaderSize);
     const ssize_t read_result = recv(
-       fd, &buffer->data.data()[buffer->bytes_received],
+       fd, &buffer->data[buffer->bytes_received],
        Transport::kHeaderSize - buffer->bytes_received,
        MSG_DONTWAIT);
     if (read_result < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
-      return true;
+      return IoResult::kWouldBlock;
     } else if (read_result == 0) {
-      return false;  // The remote end disconnected.
+      *status = Status(StatusCode::kClosed, "recv[header]");
+      return IoResult::kFailed;
+    } else if (read_result < 0) {
+      *status = Status::FromErrno("recv[header]", errno);
+      return IoResult::kFailed;
+    }
+    buffer->bytes_received += read_result;
+    if (buffer->bytes_received == Transport::kHeaderSize) {
+      buffer->payload_size =
+        ntohl(*reinterpret_cast<uint32_t*>(buffer->data.data()));
+      buffer->data.resize(buffer->payload_size);
     }
-    buffer->bytes_received += HandleError("recv[header]", read_result);
   }
-  buffer->payload_size =
-    ntohl(*reinterpret_cast<uint32_t*>(buffer->data.data()));
   size_t message_length = buffer->payload_size + Transport::kHeaderSize;
-  buffer->data.reserve(message_length);
   // TODO(ggould) enforce MTU here
   while (buffer->bytes_received < message_length) {
     const ssize_t read_result = recv(
-       fd, &buffer->data.data()[buffer->bytes_received],
+       fd, &buffer->data[buffer->bytes_received - Transport::kHeaderSize],
        message_length - buffer->bytes_received,
        MSG_DONTWAIT);
     if (read_result < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
-      return true;
+      return IoResult::kWouldBlock;
     } else if (read_result == 0) {
-      return false;  // The remote end disconnected.
+      *status = Status(StatusCode::kClosed, "recv[payload]");
+      return IoResult::kFailed;
+    } else if (read_result < 0) {
+      *status = Status::FromErrno("recv[payload]", errno);
+      return IoResult::kFailed;
     }
-    buffer->bytes_received += HandleError("recv[payload]", read_result);
+    buffer->bytes_received += read_result;
   }
-  return true;
+  return IoResult::kComplete;
 }
 
-bool TryNonblockingSend(
-    int fd,
-    Transport::TxBuffer* buffer) {
-  uint8_t size_data[4];
-  *reinterpret_cast<uint32_t*>(&size_data) = htonl(buffer->payload_size);
-  while (buffer->bytes_sent < Transport::kHeaderSize) {
-    const ssize_t send_result = send(
-       fd, &size_data[buffer->bytes_sent],
-       Transport::kHeaderSize - buffer->bytes_sent,
-       MSG_DONTWAIT);
-    if (send_result < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
-      return true;
-    } else if (send_result == 0) {
-      return false;  // The remote end disconnected.
+#ifdef __linux__
+/// @brief Keeps `sendfile`, which has no `MSG_NOSIGNAL`, from killing the
+/// process with SIGPIPE when the peer has gone:  blocks SIGPIPE on this
+/// thread for the object's lifetime and discards any it raised.
+class ScopedSigpipeSuppression final {
+ public:
+  ScopedSigpipeSuppression() {
+    sigemptyset(&sigpipe_);
+    sigaddset(&sigpipe_, SIGPIPE);
+    sigset_t pending;
+    sigpending(&pending);
+    already_pending_ = sigismember(&pending, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe_, &previous_);
+  }
+
+  ~ScopedSigpipeSuppression() {
+    if (!already_pending_) {
+      const struct timespec zero{};
+      while (sigtimedwait(&sigpipe_, nullptr, &zero) == SIGPIPE) {}
     }
-    buffer->bytes_sent += HandleError("send[header]", send_result);
+    pthread_sigmask(SIG_SETMASK, &previous_, nullptr);
   }
+
+ private:
+  sigset_t sigpipe_;
+  sigset_t previous_;
+  bool already_pending_;
+};
+#endif
+
+/// @brief Move the payload of @p buffer, a file region, from the file to
+/// socket @p fd once its header has been sent.
+IoResult TrySendFilePayload(int fd, Transport::TxBuffer* buffer,
+                            Status* status) {
+  const FileRegion& region = *buffer->file;
+#ifdef __linux__
+  const ScopedSigpipeSuppression no_sigpipe;
+#endif
+  while (buffer->bytes_sent < buffer->payload_size + Transport::kHeaderSize) {
+    const size_t payload_sent = buffer->bytes_sent - Transport::kHeaderSize;
+    const size_t remaining = buffer->payload_size - payload_sent;
+    off_t offset = region.offset() + payload_sent;
+#ifdef __linux__
+    const ssize_t sent = sendfile(fd, region.fd(), &offset, remaining);
+#else
+    // No portable zero-copy path; fall back to a bounded bounce buffer.
+    uint8_t bounce[64 << 10];
+    ssize_t sent = pread(region.fd(), bounce,
+                         std::min(remaining, sizeof(bounce)), offset);
+    if (sent > 0) sent = send(fd, bounce, sent, kSendFlags);
+#endif
+    if (sent < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+      return IoResult::kWouldBlock;
+    } else if (sent < 0) {
+      *status = Status::FromErrno("sendfile", errno);
+      return IoResult::kFailed;
+    } else if (sent == 0) {
+      // The file shrank underneath us; the datagram cannot be completed.
+      *status = Status(StatusCode::kIoError, "sendfile[file truncated]");
+      return IoResult::kFailed;
+    }
+    buffer->bytes_sent += sent;
+  }
+  return IoResult::kComplete;
+}
+
+IoResult TryNonblockingSend(
+    int fd,
+    Transport::TxBuffer* buffer,
+    Status* status) {
+  uint8_t size_data[Transport::kHeaderSize];
+  *reinterpret_cast<uint32_t*>(&size_data) = htonl(buffer->payload_size);
   size_t message_length =
     buffer->payload_size + Transport::kHeaderSize;
   // TODO(ggould) enforce MTU here
   while (buffer->bytes_sent < message_length) {
-    const ssize_t send_result = send(
-       fd, &buffer->data.data()[buffer->bytes_sent],
-       message_length - buffer->bytes_sent,
-       MSG_DONTWAIT);
-    if (send_result < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
-      return true;
-    } else if (send_result == 0) {
-      return false;  // The remote end disconnected.
+    // Gather whatever remains of the header and the payload into a single
+    // syscall.
+    struct iovec iov[2];
+    int iov_count = 0;
+    if (buffer->bytes_sent < Transport::kHeaderSize) {
+      iov[iov_count++] = {
+        .iov_base = &size_data[buffer->bytes_sent],
+        .iov_len = Transport::kHeaderSize - buffer->bytes_sent};
+    }
+    const size_t payload_sent =
+      buffer->bytes_sent - std::min(buffer->bytes_sent, Transport::kHeaderSize);
+    if (buffer->file != nullptr) {
+      if (iov_count == 0) return TrySendFilePayload(fd, buffer, status);
+    } else if (payload_sent < buffer->payload_size) {
+      iov[iov_count++] = {
+        .iov_base = &buffer->data[payload_sent],
+        .iov_len = buffer->payload_size - payload_sent};
+    }
+    struct msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+#ifdef MSG_MORE
+    // Hold a file region's header back until its payload follows.
+    const int flags = kSendFlags |
+        (buffer->file != nullptr && buffer->payload_size > 0 ? MSG_MORE : 0);
+#else
+    const int flags = kSendFlags;
+#endif
+    const ssize_t send_result = sendmsg(fd, &msg, flags);
+    // (EINPROGRESS:  a TCP Fast Open handshake is still under way.)
+    if (send_result < 0 &&
+        (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINPROGRESS)) {
+      return IoResult::kWouldBlock;
+    } else if (send_result < 0) {
+      *status = Status::FromErrno("send", errno);
+      return IoResult::kFailed;
     }
-    buffer->bytes_sent += HandleError("send[payload]", send_result);
+    buffer->bytes_sent += send_result;
   }
-  return true;
+  return IoResult::kComplete;
 }
 
 }  // namespace
@@ -144,36 +532,46 @@ Transport::~Transport() {
   }
 }
 
+// Hand-written so that the moved-from object does not close the socket.
+Transport::Transport(Transport&& other)
+    : config_(other.config_),
+      sock_fd_(std::exchange(other.sock_fd_, -1)),
+      io_thread_id_(other.io_thread_id_),
+      inbound_buffers_(std::move(other.inbound_buffers_)),
+      current_incoming_message_(std::move(other.current_incoming_message_)),
+      outbound_buffers_(std::move(other.outbound_buffers_)),
+      current_outgoing_message_(std::move(other.current_outgoing_message_)) {}
+
+Transport Transport::FromConnectedSocket(int fd, const Config& config) {
+  ConfigureConnectedSocket(fd);
+  Transport result(config);
+  result.sock_fd_ = fd;
+  return result;
+}
+
+std::optional<Transport> Transport::FromInheritedSocket(
+    const Config& config) {
+  const char* fd_text = getenv(kInheritedSocketEnvVar);
+  if (fd_text == nullptr) return std::nullopt;
+  char* end = nullptr;
+  const long fd = strtol(fd_text, &end, 10);
+  if (*fd_text == '\0' || *end != '\0' || fd < 0 ||
+      fcntl(fd, F_GETFD) < 0) {
+    throw std::runtime_error(fmt::format(
+      "{}={} does not name an open descriptor", kInheritedSocketEnvVar,
+      fd_text));
+  }
+  // Grandchildren must not inherit this connection.
+  HandleError("fcntl(F_SETFD)", fcntl(fd, F_SETFD, FD_CLOEXEC));
+  return FromConnectedSocket(static_cast<int>(fd), config);
+}
+
 void Transport::Start() {
+  if (sock_fd_ >= 0) return;  // Already connected.
   switch (config_.end) {
     case Transport::End::kClient: {
-      struct addrinfo hints;
-      struct addrinfo* addr_list;
-      std::string port = fmt::format("{}", config_.remote_port);
-      memset(&hints, 0, sizeof(hints));
-      hints.ai_family = PF_UNSPEC;
-      hints.ai_socktype = SOCK_STREAM;
-      HandleError("getaddrinfo",
-                  getaddrinfo(config_.remote_addr.c_str(), port.c_str(),
-                              &hints, &addr_list));
-      sock_fd_ = -1;
-      int connect_error = 0;
-      // Try each returned addrinfo; discard all but the last error.
-      for (struct addrinfo* addr = addr_list;
-           addr != NULL;
-           addr = addr->ai_next) {
-        sock_fd_ = socket(addr->ai_family,
-                          addr->ai_socktype,
-                          addr->ai_protocol);
-        if (sock_fd_ == -1) continue;
-        connect_error = 0;
-        connect_error = connect(sock_fd_, addr->ai_addr, addr->ai_addrlen);
-        if (connect_error == 0) break;
-      }
-      HandleError("socket", sock_fd_);
-      HandleError(fmt::format("connect({})", config_.remote_port),
-                  connect_error);
-      freeaddrinfo(addr_list);
+      sock_fd_ = ConnectWithRetry(config_);
+      ConfigureConnectedSocket(sock_fd_);
       break;
     }
     case Transport::End::kServer: {
@@ -185,10 +583,30 @@ void Transport::Start() {
   }
 }
 
+namespace {
+
+// The size header of a datagram is 32 bits.
+void CheckDatagramSize(size_t size) {
+  if (size > std::numeric_limits<uint32_t>::max()) {
+    throw std::invalid_argument(fmt::format(
+        "ERROR[Send]: datagram of {} bytes exceeds the 4 GiB limit", size));
+  }
+}
+
+}  // namespace
+
 void Transport::SendBuffer(const Transport::TxBuffer& data) {
+  CheckDatagramSize(data.payload_size);
   outbound_buffers_.push_back(std::make_unique<Transport::TxBuffer>(data));
 }
 
+void Transport::SendFileRegion(std::shared_ptr<const FileRegion> region) {
+  const size_t length = region->length();
+  CheckDatagramSize(length);
+  outbound_buffers_.push_back(std::make_unique<Transport::TxBuffer>(
+      TxBuffer{.payload_size = length, .file = std::move(region)}));
+}
+
 std::vector<std::unique_ptr<Transport::RxBuffer>>
 Transport::ReceiveAll() {
   std::vector<std::unique_ptr<Transport::RxBuffer>> result;
@@ -199,7 +617,53 @@ Transport::ReceiveAll() {
   return result;
 }
 
-bool Transport::ProcessIO() {
+Status Transport::ProcessIO() {
+  bool made_progress = false;
+  Status status = DoProcessIO(&made_progress);
+  // If neither half could move a byte, sleep until the socket is readable
+  // (or writable, if we have something to write) rather than spinning.
+  // Readiness and timeouts are both fine; the next call will sort it out.
+  if (status.ok() && !made_progress) {
+    struct pollfd poll_fd = WaitFor();
+    const int poll_result = poll(&poll_fd, 1, config_.io_wait_timeout_ms);
+    if (poll_result < 0 && errno != EINTR) {
+      status = Status::FromErrno("poll", errno);
+    }
+  }
+  return Report(std::move(status));
+}
+
+Status Transport::TryProcessIO(bool* made_progress,
+                               struct pollfd* wait_for) {
+  *made_progress = false;
+  Status status = DoProcessIO(made_progress);
+  *wait_for = WaitFor();
+  return Report(std::move(status));
+}
+
+struct pollfd Transport::WaitFor() const {
+  const bool want_write =
+    current_outgoing_message_ != nullptr || !outbound_buffers_.empty();
+  return {.fd = sock_fd_,
+          .events = static_cast<short>(POLLIN | (want_write ? POLLOUT : 0)),
+          .revents = 0};
+}
+
+Status Transport::Report(Status status) const {
+  if (!status.ok()) {
+    if (status.code() != StatusCode::kClosed) {
+      LogWarning("Transport to port {} failed: {}[{} => {}]",
+                 config_.remote_port, StatusCodeName(status.code()),
+                 status.what(), status.system_errno());
+    }
+    if (config_.error_channel != nullptr) {
+      config_.error_channel->Post(status);
+    }
+  }
+  return status;
+}
+
+Status Transport::DoProcessIO(bool* made_progress) {
   if (!io_thread_id_.has_value()) {
     io_thread_id_ = std::this_thread::get_id();
   } else if (*io_thread_id_ != std::this_thread::get_id()) {
@@ -210,45 +674,42 @@ bool Transport::ProcessIO() {
     throw std::runtime_error(err.str());
   }
 
-  // Repeatedly send buffers without blocking.
-  if (current_outgoing_message_ == nullptr && !outbound_buffers_.empty()) {
-    current_outgoing_message_ = std::move(outbound_buffers_.front());
-    outbound_buffers_.pop_front();
-  }
-  while (current_outgoing_message_ != nullptr) {
-    bool still_open = TryNonblockingSend(sock_fd_,
-                                     current_outgoing_message_.get());
-    if (!still_open) { return false; }
-    if (current_outgoing_message_ == nullptr ||
-        current_outgoing_message_->done()) {
-      if (!outbound_buffers_.empty()) {
-        current_outgoing_message_ = std::move(outbound_buffers_.front());
-        outbound_buffers_.pop_front();
-      } else {
-        current_outgoing_message_ = nullptr;
-      }
+  // Send and receive under separate budgets, so that a peer which is not
+  // draining its receive window can neither pin this thread in the send
+  // half nor starve the receive half (which could otherwise livelock two
+  // peers that are both sending).
+  Status status;
+  for (size_t sends = 0; sends < config_.max_sends_per_io; ) {
+    if (current_outgoing_message_ == nullptr) {
+      if (outbound_buffers_.empty()) break;
+      current_outgoing_message_ = std::move(outbound_buffers_.front());
+      outbound_buffers_.pop_front();
     }
+    const size_t bytes_before = current_outgoing_message_->bytes_sent;
+    const IoResult result = TryNonblockingSend(
+        sock_fd_, current_outgoing_message_.get(), &status);
+    *made_progress |= current_outgoing_message_->bytes_sent != bytes_before;
+    if (result == IoResult::kFailed) { return status; }
+    if (result == IoResult::kWouldBlock) { break; }
+    current_outgoing_message_ = nullptr;
+    ++sends;
   }
 
-  // Repeatedly receive buffers without blocking.
-  if (current_incoming_message_ == nullptr) {
-    current_incoming_message_ = std::make_unique<Transport::RxBuffer>();
-  }
-  while (current_incoming_message_ != nullptr) {
-    bool still_open = TryNonblockingReceive(sock_fd_,
-                                            current_incoming_message_.get());
-    if (!still_open) { return false; }
-    if (current_incoming_message_->done()) {
-      inbound_buffers_.push_back(std::move(current_incoming_message_));
+  for (size_t receives = 0; receives < config_.max_receives_per_io; ) {
+    if (current_incoming_message_ == nullptr) {
       current_incoming_message_ = std::make_unique<Transport::RxBuffer>();
-    } else {
-      break;  // We couldn't recieve a full message without blocking.
     }
+    const size_t bytes_before = current_incoming_message_->bytes_received;
+    const IoResult result = TryNonblockingReceive(
+        sock_fd_, current_incoming_message_.get(), &status);
+    *made_progress |=
+      current_incoming_message_->bytes_received != bytes_before;
+    if (result == IoResult::kFailed) { return status; }
+    if (result == IoResult::kWouldBlock) { break; }
+    inbound_buffers_.push_back(std::move(current_incoming_message_));
+    ++receives;
   }
-
-  // TODO(ggould) Ideally we would at this point wait on a blocking operation
-  // and a condition variable on the queues.  We don't bother with this yet.
-  return true;
+  return Status::Ok();
 }
 
 TransportServer::TransportServer(
@@ -259,6 +720,10 @@ TransportServer::TransportServer(
   // though in practice that setup rarely/never blocks).
 }
 
+TransportServer::TransportServer(TransportServer&& other)
+    : sock_fd_(std::exchange(other.sock_fd_, -1)),
+      config_(other.config_) {}
+
 TransportServer::~TransportServer() {
   if (sock_fd_ >= 0) {
     close(sock_fd_);
@@ -275,13 +740,20 @@ Transport TransportServer::AwaitIncomingConnection() {
   LazyInitialize();
   struct sockaddr_in client_addr;
   unsigned int client_addr_len = sizeof(struct sockaddr_in);
-  int new_fd = HandleError(
-    "accept",
-    accept(sock_fd_,
-           reinterpret_cast<struct sockaddr*>(&client_addr),
-           &client_addr_len));
+  int new_fd;
+  do {
+    // A client that connects and immediately resets (routine when clients
+    // restart) is not a reason for the server to fail.
+    new_fd = accept(sock_fd_,
+                    reinterpret_cast<struct sockaddr*>(&client_addr),
+                    &client_addr_len);
+  } while (new_fd < 0 && (errno == EINTR || errno == ECONNABORTED));
+  HandleError("accept", new_fd);
+  ConfigureConnectedSocket(new_fd);
   Transport::Config result_config = config_.transport_config_prototype;
-  result_config.remote_addr = client_addr.sin_addr.s_addr;
+  char addr_text[INET_ADDRSTRLEN] = "";
+  inet_ntop(AF_INET, &client_addr.sin_addr, addr_text, sizeof(addr_text));
+  result_config.remote_addr = addr_text;
   result_config.remote_port = ntohs(client_addr.sin_port);
 
   Transport result(result_config);
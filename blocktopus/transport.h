@@ -1,3 +1,5 @@
+#include <poll.h>
+
 #include <deque>
 #include <memory>
 #include <optional>
@@ -5,6 +7,9 @@
 #include <thread>
 #include <vector>
 
+#include "file_region.h"
+#include "status.h"
+
 /// @file The datagram transport layer of the library, which abstracts away
 /// the boring TCP stuff.  Note that this is all written as the functions a
 /// thread would loop over, but does not spawn any actual threads -- that
@@ -58,6 +63,35 @@ class Transport final {
     size_t mtu = 1024;
     size_t max_inbound_queue_size = 32;
     size_t max_outbound_queue_size = 32;
+
+    /// The most datagrams each call to `ProcessIO` will send, and the most
+    /// it will receive; bounding both keeps either direction from starving
+    /// the other.
+    size_t max_sends_per_io = 16;
+    size_t max_receives_per_io = 16;
+
+    /// How long `ProcessIO` may wait for the socket to become ready when it
+    /// could make no progress at all.
+    int io_wait_timeout_ms = 1;
+
+    /// If set, every non-OK status returned by `ProcessIO` is also posted
+    /// here, so that one thread can collect the errors of many transports.
+    /// Server-end transports share their server's prototype's channel.
+    std::shared_ptr<ErrorChannel> error_channel = nullptr;
+
+    /// (Client only) How long `Start` keeps trying to connect.  Refused
+    /// connections are retried with jittered exponential backoff starting
+    /// at `connect_retry_initial_ms` and capped at `connect_retry_max_ms`,
+    /// since the server may simply not be listening yet.
+    int connect_timeout_ms = 10000;
+    int connect_retry_initial_ms = 10;
+    int connect_retry_max_ms = 500;
+
+    /// (Client only) Use TCP Fast Open where available, so that the first
+    /// datagram rides on the SYN.  With this set `Start` does not wait for
+    /// the handshake, and a server that is not there is only discovered by
+    /// `ProcessIO`.  The server must also enable TFO.
+    bool tcp_fast_open = false;
   };
 
   /// @brief A container for the data and length of an outgoing datagram.
@@ -65,6 +99,8 @@ class Transport final {
     size_t payload_size;  // set to zero when empty.
     std::vector<uint8_t> data;
     size_t bytes_sent = 0;
+    /// If set, the payload is this region instead of `data`.
+    std::shared_ptr<const FileRegion> file = nullptr;
 
     bool done() { return bytes_sent == payload_size + kHeaderSize; }
   };
@@ -80,9 +116,31 @@ class Transport final {
 
   Transport(const Config& config);
   ~Transport();
-  Transport(Transport&&) = default;
+  Transport(Transport&&);
+
+  /// Wrap an already-connected stream socket @p fd (e.g. one end of a
+  /// `socketpair`), taking ownership of it.  `Start` is then a no-op.
+  static Transport FromConnectedSocket(int fd, const Config& config);
 
-    /// (BLOCKING) Start the network connection for this service.
+  /// Adopt the pre-connected socket that a launcher (see `launcher.h`)
+  /// handed down to this process, whose descriptor number is in the
+  /// environment variable `kInheritedSocketEnvVar`.
+  ///
+  /// @return `std::nullopt` if this process was not launched that way, in
+  /// which case the caller should connect normally.
+  static std::optional<Transport> FromInheritedSocket(const Config& config);
+
+  /// The environment variable through which a launcher tells a component
+  /// which inherited descriptor is its transport socket.
+  static constexpr char kInheritedSocketEnvVar[] = "BLOCKTOPUS_TRANSPORT_FD";
+
+  /// (BLOCKING) Start the network connection for this service.
+  ///
+  /// For a client, resolves the server address (caching the result) and
+  /// races connections to every candidate address, retrying until
+  /// `config().connect_timeout_ms` has elapsed; throws if that passes
+  /// without a connection.  Does nothing if the transport already has a
+  /// socket (e.g. from `FromConnectedSocket`).
   void Start();
 
   void Send(std::vector<uint8_t> data) { SendBuffer({data.size(), data, 0}); }
@@ -90,9 +148,17 @@ class Transport final {
   /// Send a datagram on this connnection.
   ///
   /// The passed-in data is copied; actual sending is deferred until the
-  /// next call to ProcessIO.
+  /// next call to ProcessIO.  Throws if the datagram exceeds 4 GiB.
   void SendBuffer(const TxBuffer& data);
 
+  /// Send the contents of @p region as a datagram on this connection.
+  ///
+  /// The bytes go straight from the page cache to the socket (`sendfile`)
+  /// and are never copied into this process; @p region is kept open until
+  /// they have been sent.  The receiver sees an ordinary datagram.  Throws
+  /// if the region exceeds 4 GiB, the most a datagram can hold.
+  void SendFileRegion(std::shared_ptr<const FileRegion> region);
+
   /// Receive all queued inbound datagrams on this connnection.
   ///
   /// Each returned handle holds a lock on its respective buffer, which
@@ -103,16 +169,29 @@ class Transport final {
   /// (BLOCKING) The work unit function of this transport.
   ///
   /// @pre All calls to this function must be from the same thread
-  /// @return `true` if the transport remains usable (not closed)
+  /// @return OK if the transport remains usable; otherwise why not (e.g.
+  /// `StatusCode::kClosed` if the remote end disconnected).  I/O failures
+  /// never throw.
   ///
-  /// Attempts to send all pending outbound datagrams and receive any pending
-  /// incoming datagrams from the network.
+  /// Sends up to `config().max_sends_per_io` pending outbound datagrams and
+  /// receives up to `config().max_receives_per_io` incoming datagrams from
+  /// the network.  If no bytes at all could be moved in either direction,
+  /// waits up to `config().io_wait_timeout_ms` for the socket to become
+  /// ready instead of returning to a caller that would only spin.
   ///
   /// To use DatagramTransport as a nonblocking API, run this function in a
   /// loop on a thread; e.g.
   ///
   /// > std::thread([&](){ while(true) my_transport.ProcessIO(); });
-  bool ProcessIO();
+  Status ProcessIO();
+
+  /// As `ProcessIO`, but never waits.  Sets @p made_progress to whether
+  /// any bytes moved and @p wait_for to what `ProcessIO` would have polled
+  /// for, so that a caller driving several transports from one thread can
+  /// wait on all of them at once.
+  ///
+  /// @pre All calls to this and `ProcessIO` must be from the same thread
+  Status TryProcessIO(bool* made_progress, struct pollfd* wait_for);
 
   /// @return the `Config` object this class was created with.
   Config config() const { return config_; }
@@ -121,6 +200,15 @@ class Transport final {
   // Let factory class set private members.
   friend class TransportServer;
 
+  // One pass of sends and receives, without waiting.
+  Status DoProcessIO(bool* made_progress);
+
+  // @return the readiness to wait for when no bytes could move.
+  struct pollfd WaitFor() const;
+
+  // Log and post @p status if it is a failure; @return it.
+  Status Report(Status status) const;
+
   const Config config_;
 
   int sock_fd_ = -1;
@@ -144,6 +232,10 @@ class TransportServer final {
     uint16_t listen_port = 0;
     size_t max_connection_queue_size = 5;
 
+    /// If positive, enable TCP Fast Open on the listening socket with this
+    /// many pending TFO requests.
+    int tcp_fast_open_queue_length = 0;
+
     /// A prototype Config copied for each created Transport objects.
     /// End/addr/port will be ignored.
     Transport::Config transport_config_prototype;
@@ -151,7 +243,7 @@ class TransportServer final {
 
   TransportServer(const Config&);
   ~TransportServer();
-  TransportServer(TransportServer&&) = default;
+  TransportServer(TransportServer&&);
 
   /// @brief  (BLOCKING) Get one incoming connection, build a transport for it.
   /// @return A server-end DatagramTransport for the new connection.